@@ -0,0 +1,234 @@
+/*
+---------------------------------------------------------------------------------------------------------------------------
+File:    huffman.h
+Project: huffmanTree
+Purpose: In-memory interface to the huffman coder in huffmanProject.c
+===========================================================================================================================
+Lets other programs compress and decompress buffers without going through files. A context holds everything a call
+needs (histogram, tree arena, decode table and a block buffer), so after the first call on a context there is no
+setup or allocation left in a call. A context must only be used by one thread at a time; use one per thread.
+
+The compressed buffers use the same format as the files written by "huffman -c", so either side can be the program.
+
+For records of a few hundred bytes, train a dictionary once from sample records and code every record with it. A
+dictionary frame carries only the dictionary ID, the record length and the bitstream: no histogram is counted, no
+tree is built and no code lengths are sent.
+
+HOW TO BUILD:
+gcc -O2 -pthread -DHUFFMAN_NO_MAIN -c huffmanProject.c -o huffman.o
+ar rcs libhuffman.a huffman.o
+Then include huffman.h and link with -L. -lhuffman -pthread.
+---------------------------------------------------------------------------------------------------------------------------
+*/
+
+#ifndef HUFFMAN_H
+#define HUFFMAN_H
+
+#include <stddef.h>
+
+#include <stdint.h>
+
+#define HUFFMAN_ERROR ((size_t)-1) //Returned by a call that failed
+#define HUFFMAN_DICTIONARY_MAX_SIZE 169 //Largest dictionary file: 9 byte header and a full code length table
+
+//Reusable state for compression and decompression calls
+typedef struct huffman_context huffman_context;
+
+//Trained code table for small records. Read only once loaded, so it can be shared between threads.
+typedef struct huffman_dictionary huffman_dictionary;
+
+/*
+PURPOSE
+Allocates a context. Buffers are coded as blocks of up to 1 MiB, each with a single bitstream.
+
+RETURN
+Pointer to the context, NULL if memory ran out
+*/
+huffman_context* huffman_create_context(void);
+
+/*
+PURPOSE
+Frees a context and everything it owns.
+*/
+void huffman_free_context(huffman_context* ctx);
+
+/*
+PURPOSE
+Largest possible compressed size of "srcSize" bytes. A destination this large never makes huffman_compress fail.
+
+RETURN
+Number of bytes
+*/
+size_t huffman_compress_bound(size_t srcSize);
+
+/*
+PURPOSE
+Compresses a buffer.
+
+PARAMETERS
+huffman_context* ctx: Context for the call
+const void* src: Bytes to compress
+size_t srcSize: Number of bytes in src
+void* dst: Where the compressed bytes are written
+size_t dstCapacity: Number of bytes available at dst
+
+RETURN
+Number of bytes written to dst, HUFFMAN_ERROR if they do not fit or memory ran out
+*/
+size_t huffman_compress(huffman_context* ctx, const void* src, size_t srcSize, void* dst, size_t dstCapacity);
+
+/*
+PURPOSE
+Size a compressed buffer decompresses to, found from its block headers without decoding anything.
+
+RETURN
+Number of bytes, HUFFMAN_ERROR if src is not a valid compressed buffer
+*/
+size_t huffman_decompressed_size(const void* src, size_t srcSize);
+
+/*
+PURPOSE
+Decompresses a buffer written by huffman_compress or by the program.
+
+PARAMETERS
+huffman_context* ctx: Context for the call
+const void* src: Compressed bytes
+size_t srcSize: Number of bytes in src
+void* dst: Where the original bytes are written
+size_t dstCapacity: Number of bytes available at dst
+
+RETURN
+Number of bytes written to dst, HUFFMAN_ERROR if src is invalid or does not fit
+*/
+size_t huffman_decompress(huffman_context* ctx, const void* src, size_t srcSize, void* dst, size_t dstCapacity);
+
+/*
+PURPOSE
+Turns checkpoint tables on or off for the next huffman_compress calls on this context (off by default). A checkpoint
+table costs 4 bytes per 64 KiB of input and lets huffman_decompress_range start decoding within 64 KiB of any offset
+instead of at the start of a 1 MiB block.
+*/
+void huffman_set_checkpoints(huffman_context* ctx, int enabled);
+
+/*
+PURPOSE
+Sets how hard the next huffman_compress calls on this context look for places where the data changes, so each part
+gets a code table of its own: 0 codes every 1 MiB block whole, 1 (the default) compares 64 KiB chunks, 2 compares
+16 KiB chunks and 3 compares 4 KiB chunks, which compresses mixed data best and takes the most time.
+*/
+void huffman_set_effort(huffman_context* ctx, int effort);
+
+/*
+PURPOSE
+Turns order-1 coding on or off for the next huffman_compress calls on this context (off by default). Each block is
+then also coded with code tables picked by the character before each character, and keeps whichever is smaller.
+English text gets about 30% smaller, but such blocks decode about 3.5 times slower and have no checkpoint table.
+*/
+void huffman_set_order1(huffman_context* ctx, int enabled);
+
+/*
+PURPOSE
+Decompresses only bytes [offset, offset + length) of a compressed buffer. Blocks before the range are skipped by
+their headers without being decoded.
+
+PARAMETERS
+huffman_context* ctx: Context for the call
+const void* src: Compressed bytes
+size_t srcSize: Number of bytes in src
+size_t offset: First byte of the original data to decompress
+void* dst: Where the bytes are written
+size_t length: Number of bytes to decompress, at most the number of bytes available at dst
+
+RETURN
+Number of bytes written to dst, less than length if the original data ends first, HUFFMAN_ERROR if src is invalid
+*/
+size_t huffman_decompress_range(huffman_context* ctx, const void* src, size_t srcSize, size_t offset, void* dst, size_t length);
+
+/*
+PURPOSE
+Trains a dictionary from sample records. Characters that do not appear in the samples still get a code, so any
+record can be compressed with the dictionary.
+
+PARAMETERS
+const void* samples: Sample records, one after another
+size_t samplesSize: Number of bytes in samples
+uint32_t id: ID stored in the dictionary and in every frame coded with it
+void* dst: Where the dictionary file is written
+size_t dstCapacity: Number of bytes available at dst, at least HUFFMAN_DICTIONARY_MAX_SIZE
+
+RETURN
+Number of bytes written to dst, HUFFMAN_ERROR if dst is too short or memory ran out
+*/
+size_t huffman_train_dictionary(const void* samples, size_t samplesSize, uint32_t id, void* dst, size_t dstCapacity);
+
+/*
+PURPOSE
+Loads a dictionary written by huffman_train_dictionary or "huffman -t", building its code and decode tables once.
+
+RETURN
+Pointer to the dictionary, NULL if src is not a valid dictionary or memory ran out
+*/
+huffman_dictionary* huffman_load_dictionary(const void* src, size_t srcSize);
+
+/*
+PURPOSE
+Frees a dictionary.
+*/
+void huffman_free_dictionary(huffman_dictionary* dict);
+
+/*
+PURPOSE
+ID of a dictionary, as given when it was trained.
+*/
+uint32_t huffman_dictionary_id(const huffman_dictionary* dict);
+
+/*
+PURPOSE
+ID of the dictionary a frame was coded with, so a caller with several dictionaries can pick the right one.
+
+RETURN
+The ID, HUFFMAN_ERROR if src is too short to hold one
+*/
+size_t huffman_frame_dictionary_id(const void* src, size_t srcSize);
+
+/*
+PURPOSE
+Largest possible dictionary frame for a record of "srcSize" bytes.
+*/
+size_t huffman_dictionary_bound(size_t srcSize);
+
+/*
+PURPOSE
+Compresses a record into a dictionary frame.
+
+PARAMETERS
+huffman_context* ctx: Context for the call, only used when dst is shorter than huffman_dictionary_bound
+const huffman_dictionary* dict: Dictionary to code with
+const void* src: Record to compress
+size_t srcSize: Number of bytes in src
+void* dst: Where the frame is written
+size_t dstCapacity: Number of bytes available at dst
+
+RETURN
+Number of bytes written to dst, HUFFMAN_ERROR if they do not fit or memory ran out
+*/
+size_t huffman_compress_with_dictionary(huffman_context* ctx, const huffman_dictionary* dict, const void* src, size_t srcSize, void* dst, size_t dstCapacity);
+
+/*
+PURPOSE
+Decompresses a dictionary frame. Needs no context, since the dictionary already holds the decode tables.
+
+PARAMETERS
+const huffman_dictionary* dict: Dictionary the frame was coded with
+const void* src: The frame
+size_t srcSize: Number of bytes in src
+void* dst: Where the record is written
+size_t dstCapacity: Number of bytes available at dst
+
+RETURN
+Number of bytes written to dst, HUFFMAN_ERROR if the frame is invalid, was coded with another dictionary or does
+not fit
+*/
+size_t huffman_decompress_with_dictionary(const huffman_dictionary* dict, const void* src, size_t srcSize, void* dst, size_t dstCapacity);
+
+#endif
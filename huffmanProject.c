@@ -6,6 +6,7 @@ Purpose: Huffman Tree Group Project
 ===========================================================================================================================
 Program Description:
 Encodes a message from .txt file into binary, records this in a .dat file and decodes back into another .txt file.
+The .dat file is self-describing, so it can be decoded without the tree that was used to encode it.
 ---------------------------------------------------------------------------------------------------------------------------
 Author:  Shailendra Singh, Riley Huston, Tatiana Olenciuc, Adam Scott, Christine Nguyen
 ID:      190777790, 190954880, 191001870, 190600780, 180657710
@@ -17,8 +18,35 @@ used, the function declarations and how the functions would be arranged to make
 for each group member to program on our own. Each of us put our names next to the functions we did. We then put it all 
 together and debugged the program as a group until, there were no errors.
 
+HOW TO BUILD:
+gcc -O2 -pthread huffmanProject.c -o huffman
+
+To use it as a library instead (see huffman.h), leave main out with HUFFMAN_NO_MAIN:
+gcc -O2 -pthread -DHUFFMAN_NO_MAIN -c huffmanProject.c -o huffman.o
+ar rcs libhuffman.a huffman.o
+
 HOW TO USE: 
-The filename you type in to encode should be in the local directory and have the file extension. 
+The filename you type in to encode should be in the local directory and have the file extension. It can also be
+given on the command line, after any options:
+    -T threads     Number of threads used to encode and decode blocks (default 1)
+    -b kilobytes   Size of each independently coded block (default 1024, from 64 to 262144)
+    -e effort      How hard to look for places where the data changes, so each part gets its own code table
+                   (0 to 3, default 1). Each block is cut into chunks of 64 KiB (effort 1), 16 KiB (2) or 4 KiB
+                   (3), and neighbouring chunks are merged as long as the estimated size (entropy plus code
+                   table) goes down. What is left is written as separate blocks. Mixed inputs, such as text
+                   followed by binary, get smaller; effort 1 costs about 6% more time and effort 3 about 50%.
+    -4             Split each block into 4 bitstreams that are decoded side by side, for faster decoding
+    -s             Add a checkpoint table to every block, so any part of the file can be decoded quickly with -r
+    -1             Also try order-1 coding on every block: each character is coded with a table picked by the
+                   character before it, and the block keeps it if it is at least 1/32 smaller. English text gets
+                   about 30% smaller, but the contexts' tables do not all fit in cache, so it decodes about 3.5
+                   times slower (see --bench). Order-1 blocks ignore -4 and -s.
+    -g             With -c, count the whole input first (every thread counting a slice of it) and code every
+                   block with one code table built from that, so blocks are neither counted nor given code lengths
+                   of their own. Suits huge, uniform inputs; mixed inputs compress better without it.
+    -G             Like -g, but the table is built from 4 KiB pieces spread evenly through the input (1 in 32, and
+                   at most 16 MiB in all), so only a sample is counted. A block with a character the sample missed
+                   escapes to a code table of its own.
 
 Example:
 Enter file name you would like to encode: LesMiserables.txt
@@ -26,656 +54,8856 @@ Enter file name you would like to encode: LesMiserables.txt
 The binary will be in encodeOutput.dat
 The decoded file will be in decodeOutput.txt
 
+Running with --bench-tree instead times the tree building for alphabets of 2 to 32768 symbols.
+
+Running with --bench [max kilobytes] times every stage (histogram, tree build, code assignment, encode, decode) on
+its own, with wall clock timers, over generated English text, skewed bytes, uniform random bytes and long runs of a
+single byte. Sizes go from 1 KiB up to the maximum (default 65536, so 64 MiB; at most 1048576, so 1 GiB) in steps of
+16. Each stage is reported in MB/s of input, along with the compression ratio (original size / encoded size) and the
+number of allocations per block made by each stage. The -1 columns give the ratio and the encode and decode speed
+with every block coded as an order-1 block, even where -1 would store it another way. The generated inputs are the same on every run.
+
+STREAMING:
+With -c or -d the program does not prompt. It compresses (-c) or decompresses (-d) the file named on the command line,
+or standard input if there is none, and writes the result to standard output:
+    producer | ./huffman -c -T 4 | ssh host './huffman -d > copy.txt'
+Input is read a batch of blocks (2 per thread) at a time, so memory stays the same however long the input is.
+Since the size of standard input is not known in advance, streamed files have no block index (see FILE FORMAT).
+Reading, coding and writing overlap: a reader thread fills the next batch (or, with -d, the next 4 MiB) while the
+coder works on the one before, and a writer thread writes 1 MiB buffers from a ring of 4 while the coder fills the
+next. Memory is two batches instead of one.
+    -u             Read and write through io_uring (Linux 5.6 or later), queueing up to 4 requests at once. Falls
+                   back to read and write if the kernel does not allow it.
+    -v             When done, print to standard error how much of the time the reader, the coder and the writer
+                   each spent working and waiting on each other, and how full the rings between them were. The
+                   stage that is busy nearly all the time is the bottleneck.
+
+Adding -a to -c codes the input with adaptive huffman coding (FGK) instead of blocks: the tree starts empty and is
+updated after every character, so each character is sent as soon as it is read, without waiting for a block to fill.
+Whenever the input goes quiet the output is padded to a whole byte and flushed, so a reader on the other end can
+decode everything sent so far. This suits live logs; block mode compresses better and much faster otherwise.
+    tail -f app.log | ./huffman -c -a | ssh host './huffman -d >> app.log'
+-d recognizes adaptive files by their header.
+
+STATISTICS:
+-V prints a report to standard error when done, and -J prints the same as one line of JSON (with the timing of every
+block as well), for the round trip, -c, -d, -A and -X, word (-w), adaptive (-a) and dictionary (-D) files included.
+They are refused with -t, -r, -S and -C. Without either nothing is counted or timed, so coding runs at full speed. If
+the run fails, -J prints {"error":...} instead. The report gives:
+    bytes         Original and encoded bytes, the ratio, and the speed over the whole run
+    bits/char     Order-0 entropy of the whole input, the average entropy of each block on its own (what per-block
+                  tables can reach), and the bits per character achieved, headers and tables included
+    code length   Longest and average code of the huffman and global blocks, and the characters coded at each length
+    decode table  Characters decoded in one lookup of the DECODE_TABLE_BITS (11) bit table, and on the slow path
+    block types   Blocks written, and of each type the blocks and the original bytes they hold
+    thread time   Time spent in each stage (histogram, tables and encode, or decode), added up over the threads, and
+                  the speed of one thread in it
+    thread        Blocks taken and time busy on each thread of the pool, 0 being the thread that posted the batches
+    block time    Fastest, median, 99th percentile and slowest block, and where the slowest starts
+Blocks are timed as a thread takes them. When encoding that is a block of input (-b), which -e may write as several
+blocks, so "block types" can count more blocks than "thread" and "block time"; when decoding they are the same.
+Word, adaptive and dictionary files are one bitstream on one thread, so their report has no block entropy, block
+types, thread or block time (null or empty in JSON), and only dictionary frames have the decode table. The code
+lengths of a word file count tokens instead of characters. Adaptive codes change with every character, so each is
+counted at the length it was sent with, and ones longer than 28 bits as 28.
+-v is separate and reports the reader, coder and writer of the streaming pipeline.
+
+WORDS:
+Adding -w to -c codes natural language text a word at a time instead of a byte at a time. The input is cut into
+tokens: runs of letters, digits and UTF-8 bytes (words), and runs of everything else (spaces, punctuation, line
+breaks), at most 64 bytes each. Every distinct token is one symbol, so the alphabet can hold millions of entries; a
+hash table finds them, and their code lengths are worked out in place without building a tree. The file starts with
+the sorted, front-coded token dictionary, and the decoder writes out a whole token for every table lookup.
+    ./huffman -c -w LesMiserables.txt > les.huf
+On English prose (the 9.5 MB of vim's manuals) the result is 40% smaller than block mode and 25% smaller than -1.
+The whole input is read before anything is written. Small files pay for their dictionary, and binary data, which has
+no words, gets bigger. -d recognizes word files by their header.
+
+ARCHIVES:
+-A archive stores every file named on the command line, and everything under every directory, in one encoded file.
+An operand starting with @ is a file that lists paths one per line (@- reads them from standard input). Symbolic
+links and special files are skipped, and empty directories are not stored:
+    find logs -name '*.log' | ./huffman -A logs.huf -T 8 @-
+    ./huffman -X logs.huf -T 8 restored
+-X archive recreates the files, with their permission bits, in the directory given (the current one by default),
+which is created if it does not exist.
+The files are stored one after another and cut into blocks like any other input, so thousands of tiny files share a
+block and a file of several GB is spread over thousands of blocks. Each batch (4 blocks per thread) is read and coded
+with work stealing: every thread starts on a run of neighbouring blocks and, once done, takes over the back half of
+the largest run another thread has left, so a thread stuck on slow blocks (many small files to open, or text that
+is costly to code) does not hold up the batch. -d and -r treat an archive as one file holding all of them.
+
+DAEMON:
+For jobs that compress thousands of small inputs a minute, starting a process for each costs more than coding it.
+-S socket runs a daemon that listens on a Unix domain socket and answers requests until it is killed; -C socket
+sends one request to it, with the file named on the command line (or standard input), and writes the reply to
+standard output:
+    ./huffman -S /tmp/huffman.sock -e 2 &
+    ./huffman -C /tmp/huffman.sock -c record.txt > record.huf
+    ./huffman -C /tmp/huffman.sock -d record.huf
+    ./huffman -C /tmp/huffman.sock
+Without -c or -d the client prints the daemon's request count and table cache hits and misses. Every connection is
+served on a thread of its own, and may send any number of requests. A request is 1 byte for the operation ('c', 'd'
+or 's' for statistics), 8 bytes for the payload size (little endian, at most 1 GiB) and the payload; the reply is 1
+byte of status (0 for success), 8 bytes for the size and the result. Output is in the same format as -c (without a
+block index), and the daemon's block options (-b, -e, -4, -1, -s) apply to every request.
+Contexts (histogram, arena, decode table and buffers) are kept warm from one connection to the next, and the daemon
+keeps the 256 most recently used code tables. A block whose histogram has the same shape as one seen before (every
+character's ideal code length, log2 of the total over its count, rounds down to the same value) reuses its code
+lengths instead of building a tree, as long as they code every character of the block and cost at most 1/64 more
+than they did for the block they were built for. Decode tables are kept by their code lengths, so a block coded with
+lengths seen before skips building its decode table. A socket left behind by a daemon that was killed is replaced.
+The socket is created under a umask of 077, so only the user running the daemon can connect to it.
+
+RANGES:
+-r offset[:length] decodes only that part of the original file (to the end if no length is given) from the encoded
+file named on the command line to standard output:
+    ./huffman -r 1073741824:4096 logs.huf
+A length of 0, or an offset at or past the end of the original file, is an error. Blocks before the range are
+skipped by their headers alone, and only the blocks that overlap the range are decoded. In a file written with -s,
+decoding starts at the last checkpoint before the offset, so at most 64 KiB is decoded for nothing; otherwise it
+starts at the block (or, with -4, the bitstream) that holds the offset. Word (-w) and adaptive (-a) files have no
+blocks, so ranges are not supported for them; decode them whole with -d.
+
+DICTIONARIES:
+Small records (a few hundred bytes) cost more to describe with their own code lengths than they save. Instead, a
+code table can be trained once from sample data and saved to a dictionary file:
+    ./huffman -t records.hufd -i 7 sample1.txt sample2.txt
+Then -D uses it with -c or -d. Each record becomes a dictionary frame, which has no header, code lengths or index:
+    ./huffman -c -D records.hufd record.txt > record.huf
+    ./huffman -d -D records.hufd < record.huf
+-i sets the dictionary ID (default 1) that frames carry, so a frame is never decoded with the wrong dictionary.
+Every character gets a code when training, even ones missing from the samples, so any input can be compressed.
+
+FILE FORMAT:
+All multi-byte integers are little endian. The input is split into blocks that are coded independently, each with
+its own code lengths, so blocks can be encoded and decoded in parallel.
+    4 bytes  Magic "HUFZ"
+    1 byte   Format version
+    1 byte   Flags: 0x01 if the file was streamed and has no block index, 0x02 if it is adaptive, 0x04 if it is a
+             word file (see below), 0x08 if it has a global code table, 0x10 if it is an archive
+    8 bytes  Number of bytes in the original file (0 if streamed); for an archive, in all of its files
+With flag 0x08 (-g or -G) the global code table follows, as a bitmap and code lengths like those of a huffman block.
+Then for every block:
+    4 bytes  Number of bytes in the original block
+    4 bytes  Number of bytes in the block payload that follows
+    1 byte   Block type (0 = huffman, 1 = raw, 2 = RLE, 3 = order-1, 4 = global), plus 0x10 if a huffman or global block
+             is split into 4 bitstreams, plus 0x20 if it has a checkpoint table
+A raw block's payload is the original bytes, and an RLE block's payload is the one character the block repeats. The
+encoder picks them from the block's histogram: RLE when only one character appears, raw when the entropy says huffman
+would save less than 1/64 of the block (random or already compressed data), so those are copied or filled at memory
+speed and never grow. A huffman block's payload is:
+   32 bytes  Bitmap of the characters that appear in the block (bit i set if character i appears)
+  n/2 bytes  Code length of each character in the bitmap, in character order, two 4 bit lengths per byte (low first)
+   12 bytes  Only with 4 bitstreams: number of bytes in each of the first 3 bitstreams
+    ...      Packed bitstream(s), most significant bit first, each padded with zero bits to a whole byte
+    ...      Only with a checkpoint table: 4 bytes for each multiple of CHECKPOINT_INTERVAL (65536) inside the block,
+             the bit offset of the code of the byte at that position from the start of the bitstream that holds it
+With 4 bitstreams the block is cut into 4 equal segments (the last one shorter) and each segment is coded into its
+own bitstream, so the decoder can follow 4 independent streams in the same loop.
+A global block's payload is a huffman block's payload without the bitmap and code lengths: the global table is used.
+An order-1 block's payload is:
+    1 byte   Number of code tables, minus 1
+  256 bytes  Code table used after each character (character 0 is assumed before the first)
+    ...      Each code table, as a bitmap and code lengths like those of a huffman block
+    ...      One packed bitstream, each character coded with the table of the character before it
+Contexts seen often enough to pay for their own code lengths get a table each; the rest share one table.
+An empty block header (all zero) marks the end of the blocks. An archive's file table comes next:
+    4 bytes  Number of files
+    ...      For each file, in the order its bytes are stored: a varint for the number of bytes in its path, the
+             path (relative, "/" between directories, no ".." parts), a varint for its size and a varint for its
+             permission bits
+Then the block index:
+  8 bytes per block  Offset of the block header from the start of the file
+    8 bytes  Offset of the block index (0 if streamed)
+    4 bytes  Number of blocks
+    4 bytes  Magic "HUFX"
+A streamed file goes straight from the end of blocks marker to the last 16 bytes, so it is read block by block.
+
+An adaptive file is the header (flags 0x02, size 0) followed by one bitstream, most significant bit first. Both
+sides keep the same FGK tree over 258 symbols: the 256 characters, END (256) and FLUSH (257). Each symbol is sent as
+its code in the current tree, except that a symbol not yet in the tree is sent as the code of the NYT ("not yet
+transmitted") leaf followed by the symbol in 9 bits. After each symbol the tree is updated. After FLUSH the stream
+is padded with zero bits to a whole byte; after END it is padded and ends. The tree starts over once it has counted
+ADAPTIVE_MAX_WEIGHT symbols.
+
+A word file is the header (flags 0x04, original size) followed by:
+    varint   Number of distinct tokens
+ 28 varints  Number of tokens with a code of 1, 2, ... WORD_MAX_CODE_LEN (28) bits
+    ...      Every token, in canonical order (shorter codes first, then by bytes): a varint for the number of bytes
+             it shares with the start of the token before it, a varint for the number of bytes after those, then
+             those bytes
+    ...      Packed bitstream of token codes, most significant bit first, padded with zero bits to a whole byte
+Since the tokens are stored in canonical order, their codes follow from the counts per length alone.
+
+Dictionary file (all multi-byte integers little endian):
+    4 bytes  Magic "HUFD"
+    1 byte   Dictionary format version (1)
+    4 bytes  Dictionary ID
+    ...      Code length table, as in a block payload, with all 256 characters present
+Dictionary frame:
+    varint   Dictionary ID (7 bits per byte, low first, high bit set on every byte but the last)
+    varint   Number of bytes in the original record
+    ...      Packed bitstream, most significant bit first, padded with zero bits to a whole byte
+
+Only the code lengths are stored. Both sides turn the lengths into canonical codes (shorter codes first, ties broken by
+character value) so the decoder can rebuild exactly the codes the encoder used. Codes are never longer than
+MAX_CODE_LEN bits; when the huffman tree is deeper than that, the lengths are recomputed with package-merge, which
+finds the best code lengths that respect the limit.
+
 LIMITS:
-Since the frequency of characters is stored in an int type, the most a single character can repeat itself is 2,147,483,647
-times. Anymore than that and it will break. This is an enormous number and most probably will not be in test but, is worth 
-mentioning here. 
+Frequencies are counted in 64 bit integers, so a single character can repeat itself up to 18,446,744,073,709,551,615
+times, far more than any file we can read.
+A word file holds at most 2^24 (16,777,216) distinct tokens; -w gives up on inputs with more, such as random data.
 ---------------------------------------------------------------------------------------------------------------------------
 */
 
 //Includes
+#define _POSIX_C_SOURCE 200809L   // For clock_gettime, madvise
+#define _DEFAULT_SOURCE           // For MADV_SEQUENTIAL
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>         // For clock_t, clock(), CLOCKS_PER_SEC
+#include <stdint.h>       // For uint64_t
+#include <time.h>         // For clock_t, clock(), CLOCKS_PER_SEC, clock_gettime()
+#include <fcntl.h>        // For open()
+#include <unistd.h>       // For read(), write(), close()
+#include <sys/mman.h>     // For mmap()
+#include <sys/stat.h>     // For fstat(), umask()
+#include <pthread.h>      // For the thread pool
+#include <errno.h>        // For EINTR, ECANCELED, EEXIST
+#include <dirent.h>       // For opendir(), readdir()
+#include <signal.h>       // For signal(), SIGPIPE
+#include <sys/socket.h>   // For the daemon's socket
+#include <sys/un.h>       // For sockaddr_un
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>  // For the io_uring structures, used through raw system calls (no liburing)
+#include <sys/syscall.h>     // For syscall(), __NR_io_uring_setup, __NR_io_uring_enter
+#define HAVE_IO_URING 1
+#endif
+#endif
+#include "huffman.h"      // Library interface
 
 //Constants
-#define MAX_BINARY_LEN 20 //Compressing Les Miserables needed at minimum, MAX_BINARY_LEN = 12. Set to 20 to be safe
+#define MAX_CODE_LEN 12 //Longest code allowed. Compressing Les Miserables needs 12 without a limit
+#define ALPHABET_SIZE 256 //Number of distinct byte values
+#define HUF_MAGIC "HUFZ" //Identifies an encoded file
+#define HUF_MAGIC_LEN 4
+#define HUF_FORMAT_VERSION 5
+#define HUF_HEADER_SIZE 14 //Magic, version, flags and original size
+#define HUF_FLAG_NO_INDEX 0x01 //Streamed file: original size and index offset are 0
+#define HUF_FLAG_ADAPTIVE 0x02 //Adaptive file: one FGK bitstream instead of blocks
+#define HUF_FLAG_WORDS 0x04 //Word file: a token dictionary and one bitstream instead of blocks
+#define HUF_FLAG_GLOBAL_TABLE 0x08 //The header is followed by a code length table that blocks can share
+#define HUF_FLAG_ARCHIVE 0x10 //Archive: the blocks hold several files one after another, listed in a file table
+#define BLOCK_HEADER_SIZE 9 //Original size, payload size and type of a block
+#define BLOCK_HUFFMAN 0 //Block type: code lengths then bitstream
+#define BLOCK_RAW 1 //Block type: the original bytes
+#define BLOCK_RLE 2 //Block type: one character, repeated for the whole block
+#define BLOCK_ORDER1 3 //Block type: code tables picked by the character before, then bitstream
+#define BLOCK_GLOBAL 4 //Block type: bitstream coded with the file's global table
+#define BLOCK_TYPE_MASK 0x0F
+#define RAW_MIN_SAVING 64 //Blocks are stored raw unless huffman coding is estimated to save more than 1/64 of them
+#define ORDER1_MIN_SAVING 32 //With -1, blocks are coded order-1 only if that saves more than 1/32 of the order-0 size
+#define GLOBAL_COUNTED 1 //-g: the global table is built from every byte, counted by all threads
+#define GLOBAL_SAMPLED 2 //-G: the global table is built from pieces of the input spread evenly through it
+#define SAMPLE_CHUNK_SIZE 4096 //Bytes in each piece sampled by -G
+#define SAMPLE_EVERY 32 //-G samples one piece in every 32, or fewer on inputs over 512 MiB
+#define SAMPLE_MAX_CHUNKS 4096 //Most pieces sampled by -G, so at most 16 MiB is counted
+#define ARCHIVE_BATCH_PER_THREAD 4 //Blocks per thread in each batch of an archive, so threads have work to steal
+#define ARCHIVE_MAX_NAME 4096 //Longest path stored in an archive
+#define TABLE_CACHE_SIZE 256 //Code and decode tables the daemon keeps; the least recently used is replaced first
+#define TABLE_CACHE_SLACK 64 //A cached code table is used if it costs at most 1/64 more than when it was built
+#define DAEMON_HEADER_SIZE 9 //Operation (or status) byte and 8 byte payload size that start every daemon message
+#define DAEMON_MAX_PAYLOAD ((uint64_t)1 << 30) //Largest request or reply the daemon handles
+#define DAEMON_MAX_CLIENTS 64 //Connections the daemon serves at once; more wait to be accepted
+#define DAEMON_RETRY_MILLISECONDS 100 //Longest wait before accepting again when the process is out of file descriptors
+#define BLOCK_FLAG_FOUR_STREAMS 0x10 //Block is coded as 4 bitstreams
+#define BLOCK_FLAG_CHECKPOINTS 0x20 //Block ends with a checkpoint table
+#define STREAM_JUMP_TABLE_SIZE 12 //Sizes of the first 3 of 4 bitstreams
+#define CHECKPOINT_INTERVAL (1 << 16) //Bytes of a block between checkpoints
+#define RANGE_SKIP_SIZE 4096 //Bytes decoded at a time while skipping from a checkpoint to the start of a range
+#define HUF_FOOTER_MAGIC "HUFX" //Ends the block index
+#define HUF_FOOTER_SIZE 16 //Index offset, block count and footer magic
+#define DEFAULT_BLOCK_SIZE (1 << 20) //Bytes of input per block unless -b says otherwise
+#define MIN_BLOCK_SIZE (1 << 16)
+#define MAX_BLOCK_SIZE (1 << 28)
+#define MAX_THREADS 256
+#define MAX_EFFORT 3 //Highest -e level
+#define DEFAULT_EFFORT 1
+#define SPLIT_CHUNK_SIZE (1 << 16) //Chunks compared by the block splitter at effort 1. Each level above divides it by 4
+#define SPLIT_MIN_CHUNK (SPLIT_CHUNK_SIZE >> (2 * (MAX_EFFORT - 1))) //Chunk size at the highest effort
+#define SPLIT_MAX_CHUNKS 256 //Most chunks a block is cut into. Larger blocks get larger chunks
+#define LOG2_TABLE_BITS 8 //log2 is looked up from 2^8 + 1 mantissa values and interpolated
+#define NO_NODE 0xFFFF //Child index of a leaf in the tree
+#define MAX_ARENA_LEAVES 32768 //Most characters an arena can hold, so 2 * 32768 - 1 tree nodes fit 16 bit indices
+#define ADAPTIVE_END 256 //Adaptive symbol that ends the stream
+#define ADAPTIVE_FLUSH 257 //Adaptive symbol after which the stream is padded to a whole byte
+#define ADAPTIVE_SYMBOLS 258 //Characters plus END and FLUSH
+#define ADAPTIVE_NYT (-2) //Symbol of the "not yet transmitted" leaf
+#define ADAPTIVE_INTERNAL (-1) //Symbol of an internal node
+#define ADAPTIVE_NODES (2 * ADAPTIVE_SYMBOLS + 1) //Every symbol as a leaf, the NYT leaf and the internal nodes
+#define ADAPTIVE_ROOT (ADAPTIVE_NODES - 1)
+#define ADAPTIVE_SYMBOL_BITS 9 //Bits of a symbol sent after the NYT code
+#define ADAPTIVE_MAX_WEIGHT (1u << 30) //Symbols counted before the adaptive tree starts over
+#define ADAPTIVE_READ_SIZE (1 << 16) //Bytes read from the input at a time in adaptive mode
+#define DICT_MAGIC "HUFD" //Identifies a dictionary file
+#define DICT_VERSION 1
+#define DICT_HEADER_SIZE 9 //Magic, version and ID of a dictionary file
+#define DICT_DEFAULT_ID 1
+#define VARINT_MAX_SIZE 10 //Bytes in the longest 64 bit varint
+#define WORD_MAX_LENGTH 64 //Longest token of a word file. Longer runs of word or separator bytes are split
+#define WORD_MAX_TOKENS (1 << 24) //Most distinct tokens in a word file
+#define WORD_MAX_CODE_LEN 28 //Longest token code, so 2 codes fit in the 57 bits of a decode window
+#define WORD_TABLE_BITS 12 //Bits looked up at once by the word decoder
+#define WORD_COPY_SIZE 16 //Tokens up to this long are copied with one fixed size move
+#define WORD_MIN_SLOTS (1 << 12) //Starting size of the token hash table, which doubles when half full
+#define WORD_ENCODE_CHUNK (1 << 16) //Bytes of bitstream coded into the sink's buffer before it is committed
+#define BENCH_DEFAULT_SIZE (64u << 20) //Largest generated input of --bench unless a size is given
+#define BENCH_MAX_SIZE (1u << 30)
+#define BENCH_STAGES 5 //Histogram, tree build, code assignment, encode, decode
+#define BENCH_CORPUS_KINDS 4 //English, skewed, uniform, runs
+#define CODE_LENGTHS_MAX_SIZE (ALPHABET_SIZE / 8 + ALPHABET_SIZE / 2) //Largest possible code length table
+#define HUF_WRITE_SLACK 8 //encode_buffer stores whole 64 bit words, so its output needs this many spare bytes
+#define HISTOGRAM_CHUNK (1u << 30) //Bytes counted into 32 bit sub-histograms before they are added to the 64 bit totals
+#define SINK_BUFFER_SIZE (1 << 20) //Output is collected into writes of this size
+#define READ_CHUNK_SIZE (1 << 20) //Inputs that cannot be mapped are read in chunks of this size
+#define PIPE_MAX_SLOTS 4 //Most buffers in the ring between an I/O thread and the coder
+#define READ_SLOTS 2 //compress_stream reads the next batch of blocks while the one before is coded
+#define WRITE_SLOTS 4 //The writer thread's ring holds up to 4 buffers of SINK_BUFFER_SIZE
+#define PIPE_CHUNK_SIZE (4 << 20) //decompress_stream reads the encoded file in buffers of this size
+#define URING_DEPTH 4 //Reads or writes queued at once through io_uring
+#define URING_MAX_PIECE (1u << 30) //Largest single io_uring read
+#define DECODE_TABLE_BITS 11 //Bits looked up at once by the decoder. 2^11 entries of 4 bytes stay in L1 cache
+#define STAGE_HISTOGRAM 0 //Statistics stage: counting characters, and finding where to split a block
+#define STAGE_TABLES 1 //Statistics stage: building code lengths and codes, or planning order-1 tables
+#define STAGE_ENCODE 2 //Statistics stage: writing headers and bitstreams
+#define STAGE_DECODE 3 //Statistics stage: decoding blocks, their lookup tables included
+#define STAGE_COUNT 4
+#define BLOCK_TYPE_COUNT (BLOCK_GLOBAL + 1)
+#define STATS_MAX_CODE_LEN WORD_MAX_CODE_LEN //Longest code the statistics count by length. Longer adaptive codes count as this long
+#define CODING_BLOCKS 0 //Statistics: the file is coded in blocks
+#define CODING_WORDS 1 //Statistics: the file is a word file (-w), coded as one bitstream of tokens
+#define CODING_ADAPTIVE 2 //Statistics: the file is an adaptive file (-a)
+#define CODING_DICTIONARY 3 //Statistics: the input is one dictionary frame (-D)
+
+#if MAX_CODE_LEN > 14
+#error "encode_buffer packs 4 codes per 64 bit store, which needs MAX_CODE_LEN <= 14"
+#endif
 
 //Structures---------------------------------------------------------------------------------------------------------------
 
 //Table 
 typedef struct table_node 
 {
+    uint64_t frequency;                   ///< Frequency of value
+    uint32_t code;                        ///< Canonical code of the character, right aligned.
+    unsigned char length;                 ///< Number of bits in the code of the character.
     char value;                           ///< Character index.
-    char binary[MAX_BINARY_LEN];          ///< Binary representation of character.
-    int frequency;                        ///< Frequency of value
-    struct table_node* next;              ///< Pointer to next node
 } table_node;
 
 typedef struct table 
 {
-    table_node* head;                     ///< Head of the table.
+    table_node* nodes;                    ///< Nodes of the table, one after another in character order.
     int count;                            ///< Number of unique characters.
 } table;
 
-// A Huffman tree node
+// A Huffman tree node. Nodes live in one array and refer to their children by index.
 typedef struct tree_node
 {
+    uint64_t frequency;                   ///< Frequency of character value
+    uint16_t left;                        ///< Index of the left child, NO_NODE for a leaf.
+    uint16_t right;                       ///< Index of the right child, NO_NODE for a leaf.
     char value;                           ///< Character stored in node
-    int frequency;                        ///< Frequency of character value
-    struct tree_node* left;               ///< Pointer to the left child.
-    struct tree_node* right;               ///< Pointer to the right child.
 } tree_node;
 
-//Priority Queue
+//Code table entry, indexed directly by character
+typedef struct code_entry
+{
+    uint32_t code;                        ///< Canonical code, right aligned
+    uint32_t length;                      ///< Number of bits in code, 0 if the character is unused
+} code_entry;
+
+//Decode table entry, indexed by the next DECODE_TABLE_BITS bits of the bitstream
+typedef struct decode_entry
+{
+    unsigned char symbols[2];             ///< Characters resolved by this entry
+    unsigned char count;                  ///< Number of characters resolved, 0 if the code is longer than the table
+    unsigned char bits;                   ///< Number of bits used by the resolved characters
+} decode_entry;
+
+typedef struct decode_table
+{
+    decode_entry fast[1 << DECODE_TABLE_BITS]; ///< One or two whole characters per lookup
+    uint64_t limit[MAX_CODE_LEN + 1];   ///< Slow path: end of the codes of each length, left aligned to 32 bits
+    uint32_t firstCode[MAX_CODE_LEN + 1]; ///< Slow path: first canonical code of each length
+    uint32_t firstIndex[MAX_CODE_LEN + 1]; ///< Slow path: position of that code's character in sorted
+    unsigned char sorted[ALPHABET_SIZE];  ///< Slow path: characters in canonical order
+    int maxLength;                        ///< Longest code length
+} decode_table;
+
+//Parts of a block payload, found from the block header and the payload's own tables
+typedef struct block_layout
+{
+    unsigned char lengths[ALPHABET_SIZE]; ///< Code length of every character (0 if unused)
+    int streams;                          ///< Number of bitstreams, 1 or 4
+    const unsigned char* stream[4];       ///< First byte of each bitstream
+    size_t streamSize[4];                 ///< Number of bytes in each bitstream
+    const unsigned char* checkpoints;     ///< Checkpoint table, NULL if the block has none
+} block_layout;
+
+//Decode tables of an order-1 block, read from its payload
+typedef struct order1_layout
+{
+    unsigned char tableOf[ALPHABET_SIZE]; ///< Table used after each character
+    int tableCount;                       ///< Number of code tables
+    decode_table* tables;                 ///< One decode table per code table, single characters per lookup
+    const unsigned char* stream;          ///< First byte of the bitstream
+    size_t streamSize;                    ///< Number of bytes in the bitstream
+} order1_layout;
+
+//Whole input, either memory mapped or read into one buffer, shared by every stage that needs it
+typedef struct input_span
+{
+    const unsigned char* data;            ///< First byte of the input
+    size_t size;                          ///< Number of bytes in the input
+    void* mapping;                        ///< Start of the mapping, NULL if the input was read into a buffer
+    unsigned char* buffer;                ///< Buffer the input was read into, NULL if it is mapped
+} input_span;
+
+//Time spent by each stage of a streaming pipeline, in nanoseconds, and how full the rings between them were
+typedef struct pipeline_stats
+{
+    uint64_t readBusy;                    ///< Reader thread inside read
+    uint64_t readWait;                    ///< Reader thread waiting for the coder to free a buffer
+    uint64_t codeInputWait;               ///< Coder waiting for the reader
+    uint64_t codeOutputWait;              ///< Coder waiting for the writer to free a buffer
+    uint64_t writeBusy;                   ///< Writer thread inside write
+    uint64_t writeWait;                   ///< Writer thread waiting for the coder
+    uint64_t inputFull;                   ///< Full input buffers, added up every time the coder takes one
+    uint64_t inputSamples;                ///< Number of input buffers the coder took
+    uint64_t outputFull;                  ///< Full output buffers, added up every time the coder hands one over
+    uint64_t outputSamples;               ///< Number of output buffers the coder handed over
+    int inputSlots;                       ///< Buffers in the reader's ring, 0 if there was no reader thread
+    int outputSlots;                      ///< Buffers in the writer's ring, 0 if there was no writer thread
+    int uring;                            ///< Set if the reads or writes went through io_uring
+} pipeline_stats;
+
+//How the streaming modes read and write
+typedef struct stream_io
+{
+    int uring;                            ///< Set to read and write through io_uring, if the kernel allows it
+    pipeline_stats* stats;                ///< Where the stages add up their time, NULL if nobody asked
+} stream_io;
+
+//Just enough of io_uring to queue reads or writes of one file, through the raw system calls
+typedef struct io_ring
+{
+    int fd;                               ///< Ring file descriptor
+    unsigned char* sqRing;                ///< Mapped submission ring
+    size_t sqRingSize;                    ///< Bytes mapped at sqRing
+    unsigned char* cqRing;                ///< Mapped completion ring
+    size_t cqRingSize;                    ///< Bytes mapped at cqRing
+    struct io_uring_sqe* sqes;            ///< Mapped submission entries
+    size_t sqesSize;                      ///< Bytes mapped at sqes
+    unsigned* sqTail;                     ///< Submission ring tail, written by us
+    unsigned* sqMask;                     ///< Submission ring index mask
+    unsigned* sqArray;                    ///< Submission ring, indices into sqes
+    unsigned* cqHead;                     ///< Completion ring head, written by us
+    unsigned* cqTail;                     ///< Completion ring tail, written by the kernel
+    unsigned* cqMask;                     ///< Completion ring index mask
+    struct io_uring_cqe* cqes;            ///< Completion entries
+} io_ring;
+
+//Ring of large buffers between an I/O thread and the coder, so reading, coding and writing overlap. A reader thread
+//fills buffers from a file and the coder empties them; for a writer thread it is the other way around. Each side
+//waits only when the ring is empty or full.
+typedef struct io_pipe
+{
+    pthread_t thread;                     ///< Reader or writer thread
+    int fd;                               ///< File read or written
+    unsigned char* buffers[PIPE_MAX_SLOTS]; ///< The ring
+    size_t sizes[PIPE_MAX_SLOTS];         ///< Bytes held in each buffer
+    size_t capacities[PIPE_MAX_SLOTS];    ///< Size of each buffer
+    int slots;                            ///< Buffers in the ring
+    int head;                             ///< Next buffer to fill, owned by the producer
+    int tail;                             ///< Next buffer to empty
+    int full;                             ///< Number of filled buffers, starting at tail
+    int done;                             ///< Set once the producer has nothing more to add
+    int failed;                           ///< Set once a read or write fails
+    int stop;                             ///< Set to make the reader thread quit early
+    int reading;                          ///< Set while the reader thread is inside read
+    int partial;                          ///< Set if the reader hands over whatever one read returns
+    size_t consumed;                      ///< Bytes of the buffer at tail already taken by pipe_read
+    pthread_mutex_t lock;                 ///< Guards head, tail, full, done, stop, reading and the reader's stats
+    pthread_cond_t changed;               ///< Signalled whenever a buffer is filled or emptied
+    io_ring* ring;                        ///< io_uring the thread reads or writes with, NULL for read and write
+    pipeline_stats* stats;                ///< Where the time spent is added up
+    pipeline_stats ownStats;              ///< Used when the caller wants no stats
+} io_pipe;
+
+//Buffered output file. Small writes are collected into one large buffer; callers can also reserve space in the
+//buffer and encode or decode straight into it.
+typedef struct output_sink
+{
+    int fd;                               ///< File descriptor written to
+    unsigned char* buffer;                ///< Output waiting to be written
+    size_t used;                          ///< Bytes waiting in buffer
+    size_t capacity;                      ///< Size of buffer
+    uint64_t written;                     ///< Bytes handed to the sink so far, written out or not
+    int failed;                           ///< Set once a write fails
+    io_pipe* pipe;                        ///< Writer thread that full buffers are handed to, NULL to write them here
+} output_sink;
+
+//Function run by the thread pool for each index of a batch
+typedef void (*pool_task)(void* context, size_t index);
+
+//Indices of a batch left to one thread while it is run with work stealing
+typedef struct pool_range
+{
+    pthread_mutex_t lock;                 ///< Guards begin and end
+    size_t begin;                         ///< Next index the owner runs
+    size_t end;                           ///< One past the last index left; thieves take the back half
+} pool_range;
+
+//Fixed set of worker threads that run batches of independent tasks. The thread that posts a batch works on it too.
+typedef struct thread_pool
+{
+    pthread_t* threads;                   ///< Worker threads
+    int threadCount;                      ///< Number of worker threads
+    pthread_mutex_t lock;                 ///< Guards everything below
+    pthread_cond_t wake;                  ///< Signalled when a batch is posted or the pool is stopped
+    pthread_cond_t done;                  ///< Signalled when the last task of a batch finishes
+    pool_task task;                       ///< Function run for every index of the current batch
+    void* context;                        ///< Passed to task
+    size_t next;                          ///< Next index to hand out
+    size_t count;                         ///< Number of indices in the current batch
+    size_t finished;                      ///< Number of indices completed
+    int stop;                             ///< Set when the pool is being destroyed
+    pool_range* ranges;                   ///< Indices left to each worker and (last) the caller, for pool_run_stealing
+    int started;                          ///< Number of workers that have taken their range
+    size_t stealingBatch;                 ///< Counts pool_run_stealing batches, so workers know a new one was posted
+} thread_pool;
+
+//Code lengths kept by the daemon between requests, with the decode tables built from them when used for decoding
+typedef struct cached_table
+{
+    uint64_t key;                         ///< Fingerprint of the histogram's shape (encoder) or of the code lengths (decoder)
+    uint64_t lastUsed;                    ///< Cache clock when last found or stored, 0 if the slot is free
+    int decoder;                          ///< Set if decodeTable is built; the lengths are then compared in full
+    double ratio;                         ///< Encoder: size with these lengths over the entropy estimate, for the histogram they were built from
+    unsigned char lengths[ALPHABET_SIZE]; ///< Code lengths
+    decode_table decodeTable;             ///< Decoder: lookup tables built from lengths
+} cached_table;
+
+//Least recently used cache of code and decode tables, shared by threads
+typedef struct table_cache
+{
+    pthread_mutex_t lock;                 ///< Guards everything below
+    cached_table* entries;                ///< TABLE_CACHE_SIZE slots
+    uint64_t clock;                       ///< Counts lookups and stores, to find the least recently used slot
+    uint64_t hits[2];                     ///< Lookups that found a table: code tables, then decode tables
+    uint64_t misses[2];                   ///< Lookups that had to build one
+} table_cache;
+
+//Statistics one thread of the pool adds up over the blocks it codes, so threads never share a counter
+typedef struct thread_stats
+{
+    uint64_t stageNanos[STAGE_COUNT];     ///< Time spent in each stage
+    uint64_t nanos;                       ///< Time spent on blocks, all stages together
+    uint64_t jobs;                        ///< Blocks of input taken (one may be written as several blocks)
+    uint64_t counts[ALPHABET_SIZE];       ///< Every character coded
+    double blockEntropyBits;              ///< Sum over written blocks of their size times their own entropy
+    uint64_t lengthSymbols[STATS_MAX_CODE_LEN + 1]; ///< Characters of huffman and global blocks (or tokens of a word file) coded with each code length
+    int maxLength;                        ///< Longest code of any huffman or global block, or of the file's one bitstream
+    uint64_t typeBlocks[BLOCK_TYPE_COUNT]; ///< Blocks written of each type
+    uint64_t typeBytes[BLOCK_TYPE_COUNT]; ///< Original bytes in the blocks of each type
+} thread_stats;
+
+//Timing of one block of input, in the order of the input
+typedef struct block_record
+{
+    uint64_t offset;                      ///< Where the block starts in the original
+    uint32_t rawSize;                     ///< Original bytes
+    uint32_t encodedSize;                 ///< Bytes of the block (or blocks, when split) with their headers
+    uint64_t nanos;                       ///< Time from taking the block to finishing it
+    int thread;                           ///< Thread of the pool that coded it, 0 for the thread that posted the batch
+} block_record;
+
+//Statistics of one compression or decompression, for -V and -J
+typedef struct run_stats
+{
+    int decoding;                         ///< Set if the run decoded
+    int coding;                           ///< CODING_BLOCKS, or how a file coded as one bitstream (no blocks or tables) is coded
+    int threadCount;                      ///< Threads of the pool
+    uint64_t originalBytes;               ///< Bytes before coding
+    uint64_t encodedBytes;                ///< Bytes of the encoded file, headers and index included
+    uint64_t wallNanos;                   ///< Wall time of the whole run
+    thread_stats threads[MAX_THREADS];    ///< Added up by each thread of the pool
+    block_record* records;                ///< Every block of input, in order
+    size_t recordCount;                   ///< Number of records
+    size_t recordCapacity;                ///< Number of records there is room for
+    int failed;                           ///< Set if memory ran out for the records
+} run_stats;
+
+//Options chosen on the command line for compression
+typedef struct compress_options
+{
+    int threads;                          ///< Threads used to encode blocks
+    size_t blockSize;                     ///< Bytes of input per block
+    int streams;                          ///< Bitstreams per block, 1 or 4
+    int checkpoints;                      ///< Set to end every block with a checkpoint table
+    int effort;                           ///< 0 to code every block whole, up to MAX_EFFORT to split blocks where their statistics change
+    int order1;                           ///< Set to also try order-1 tables (picked by the character before) for every huffman block
+    int globalTable;                      ///< GLOBAL_COUNTED or GLOBAL_SAMPLED to code blocks with one table for the whole file, 0 for a table per block
+    const unsigned char* globalLengths;   ///< Code lengths of the global table while compress_file codes with it, NULL otherwise
+    table_cache* cache;                   ///< Code lengths shared with earlier calls (the daemon), NULL to build every table
+    run_stats* stats;                     ///< Where blocks add up their statistics and timings, NULL (free) unless asked for
+} compress_options;
+
+//One file of an archive being created
+typedef struct archive_entry
+{
+    char* source;                         ///< Path the file is read from
+    const char* name;                     ///< Path stored in the archive: source without a leading "/" or "./"
+    uint64_t offset;                      ///< Where the file starts in the archive's contents, all files one after another
+    uint64_t size;                        ///< Number of bytes in the file
+    uint32_t mode;                        ///< Permission bits
+} archive_entry;
+
+//Files going into an archive, in the order they are stored
+typedef struct archive_list
+{
+    archive_entry* entries;               ///< The files
+    size_t count;                         ///< Number of entries
+    size_t capacity;                      ///< Number of entries there is room for
+    uint64_t totalSize;                   ///< Bytes in all the files together
+} archive_list;
+
+//Priority Queue, made of two FIFO queues: the leaves sorted by frequency, and the combined nodes, which are created
+//in increasing order of frequency. The front of one of the two queues is always the smallest node. Both queues are
+//ranges of the node array: the leaves are sorted in place at the start and combined nodes are appended after them,
+//so neither queue needs storage of its own.
 typedef struct pq
 {
-    struct pq_node* head;                 ///< Head of the priority queue
-}pq;
+    tree_node* nodes;                     ///< Every node of the tree (2 * leafCount - 1), leaves first
+    int leafHead;                         ///< Index of the first leaf still in the queue
+    int leafCount;                        ///< Number of leaves
+    int combinedHead;                     ///< Index of the first combined node still in the queue
+    int nodeCount;                        ///< Number of nodes used, combined nodes being those from leafCount on
+} pq;
+
+//Block splitter state. A block is cut into chunks, then neighbouring segments (at first one chunk each) are merged
+//while that saves bits. A segment is known by its first chunk, and its histogram is kept in that chunk's row.
+typedef struct split_workspace
+{
+    uint32_t counts[SPLIT_MAX_CHUNKS][ALPHABET_SIZE]; ///< Histogram of every segment, in the row of its first chunk
+    double bits[SPLIT_MAX_CHUNKS];        ///< Estimated size of every segment coded as a block of its own
+    double saving[SPLIT_MAX_CHUNKS];      ///< Bits saved by merging every segment with the one after it
+    uint16_t next[SPLIT_MAX_CHUNKS];      ///< First chunk of the next segment, the chunk count after the last one
+    uint16_t previous[SPLIT_MAX_CHUNKS];  ///< First chunk of the segment before, NO_NODE before the first one
+} split_workspace;
+
+//Order-1 tables of a block. The characters that follow each character (its context) are counted, then contexts that
+//pay for a code table of their own get one and the rest share a single table.
+typedef struct context_workspace
+{
+    uint32_t counts[ALPHABET_SIZE][ALPHABET_SIZE]; ///< Number of times each character follows each context
+    unsigned char lengths[ALPHABET_SIZE][ALPHABET_SIZE]; ///< Code lengths of every table
+    code_entry codes[ALPHABET_SIZE][ALPHABET_SIZE]; ///< Codes of every table
+    unsigned char tableOf[ALPHABET_SIZE]; ///< Table used in each context
+    int tableCount;                       ///< Number of tables, 1 to 256
+} context_workspace;
+
+//Storage for the table, queue and tree of a block. It is allocated once, then reset and reused for every block, so
+//building a block's codes never touches the allocator.
+typedef struct huffman_arena
+{
+    table valueTable;                     ///< The table handed out by create_table
+    pq queue;                             ///< The queue handed out by new_pq
+    table_node* tableNodes;               ///< Room for maxLeaves table nodes
+    tree_node* treeNodes;                 ///< Room for 2 * maxLeaves - 1 tree nodes
+    int maxLeaves;                        ///< Most characters the arena can hold
+    split_workspace* split;               ///< Block splitter state, allocated the first time a block is split
+    context_workspace* contexts;          ///< Order-1 tables, allocated the first time a block is coded with them
+    uint64_t* stageNanos;                 ///< Where each stage adds up its time while statistics are on, NULL otherwise
+} huffman_arena;
+
+//Node of the adaptive (FGK) tree. Nodes are numbered by their place in the array, and the tree keeps the sibling
+//property: weights never decrease as the number goes up and siblings are numbered next to each other.
+typedef struct adaptive_node
+{
+    uint32_t weight;                      ///< Number of times the symbols below this node have been coded
+    uint16_t parent;                      ///< Number of the parent, NO_NODE for the root
+    uint16_t left;                        ///< Number of the left child, NO_NODE for a leaf
+    uint16_t right;                       ///< Number of the right child, NO_NODE for a leaf
+    int16_t symbol;                       ///< Symbol of a leaf, ADAPTIVE_NYT or ADAPTIVE_INTERNAL
+} adaptive_node;
+
+//Adaptive tree shared in the same state by the encoder and decoder
+typedef struct adaptive_model
+{
+    adaptive_node nodes[ADAPTIVE_NODES];  ///< The root is the highest number, unused nodes sit below the NYT leaf
+    uint16_t leaf[ADAPTIVE_SYMBOLS];      ///< Number of the leaf of every symbol, NO_NODE if not yet in the tree
+    uint16_t nyt;                         ///< Number of the NYT leaf
+} adaptive_model;
+
+//Distinct token of a word file
+typedef struct word_token
+{
+    const unsigned char* text;            ///< Bytes of the token, where it was first seen in the input
+    uint32_t length;                      ///< Number of bytes, 1 to WORD_MAX_LENGTH
+    uint32_t hash;                        ///< Hash of the bytes, kept so the hash table can be rebuilt without them
+    uint64_t count;                       ///< Number of times the token appears
+    uint32_t code;                        ///< Canonical code, right aligned
+    uint32_t codeLength;                  ///< Number of bits in code
+} word_token;
+
+//Every distinct token of an input, found through an open addressing hash table
+typedef struct word_dictionary
+{
+    word_token* tokens;                   ///< In the order first seen, then in canonical code order
+    size_t count;                         ///< Number of distinct tokens
+    size_t capacity;                      ///< Room in tokens
+    uint32_t* slots;                      ///< Token number plus 1 in each used slot, 0 in empty ones
+    size_t slotMask;                      ///< Number of slots (a power of 2) minus 1
+} word_dictionary;
+
+//Decode table entry of a word file, indexed by the next WORD_TABLE_BITS bits of the bitstream
+typedef struct word_entry
+{
+    uint32_t token;                       ///< Token resolved by this entry
+    uint32_t bits;                        ///< Length of its code, 0 if the code is longer than the table
+} word_entry;
+
+//Tokens and decode tables of a word file
+typedef struct word_decoder
+{
+    word_entry fast[1 << WORD_TABLE_BITS]; ///< One whole token per lookup
+    uint64_t limit[WORD_MAX_CODE_LEN + 1]; ///< Slow path: end of the codes of each length, left aligned to 32 bits
+    uint32_t firstCode[WORD_MAX_CODE_LEN + 1]; ///< Slow path: first code of each length
+    uint32_t firstIndex[WORD_MAX_CODE_LEN + 1]; ///< Slow path: token with that first code
+    int maxLength;                        ///< Longest code length
+    uint32_t* offset;                     ///< Where each token starts in text, plus the end of the last one
+    unsigned char* text;                  ///< Bytes of every token back to back, then WORD_COPY_SIZE spare bytes
+} word_decoder;
+
+//Library context (huffman.h). Everything a call needs is kept here and reused by the next call.
+struct huffman_context
+{
+    compress_options options;             ///< Block size and bitstreams, one thread
+    uint64_t counts[ALPHABET_SIZE];       ///< Histogram of the current block
+    huffman_arena* arena;                 ///< Table and tree of the current block
+    decode_table decodeTable;             ///< Decode tables of the current block
+    unsigned char* scratch;               ///< Output when dst is too short to encode into, allocated when first needed
+    size_t scratchSize;                   ///< Number of bytes in scratch
+};
 
-typedef struct pq_node
+//Trained code table (huffman.h). Never changed once loaded, so one dictionary can be shared by every thread.
+struct huffman_dictionary
 {
-    struct tree_node* ptr;                ///< Pointer to tree within node
-    struct pq_node* next;                 ///< Pointer to next pq node
-} pq_node;
+    uint32_t id;                          ///< ID carried by every frame coded with this dictionary
+    code_entry codes[ALPHABET_SIZE];      ///< Code of every character, all of them used
+    decode_table decodeTable;             ///< Decode tables, built once when the dictionary is loaded
+};
 
 
 //Functions to be in main:-------------------------------------------------------------------------------------------------
 
 /*
  PURPOSE
- Will take  pointer to file with input.txt, allocate memory for and create a table
- and record all the characters and frequencies intocreated table
+ Will take the bytes of input.txt, count the characters with count_frequencies
+ and create a table from the counts with histogram_to_table
 
  PARAMETERS
- FILE* input: Input file with text to be encoded
+ const unsigned char* src: Text to be encoded
+ size_t size: Number of bytes in src
 
  RETURN
- Pointer to table with characters and frequencies. All binary strings are empty strings.
- The table is the same table
+ Pointer to table with characters and frequencies. All codes are empty (length 0).
+ The table is the same table, and it lives in the arena
  */
-table* convert_to_table(FILE *input); //Tatiana
+table* convert_to_table(huffman_arena* arena, const unsigned char* src, size_t size); //Tatiana
 
 /*
 PURPOSE
-Takes the characters and frequencies in table, puts them as pq nodes and then inserts
-them into the pq.
+Histogram stage. Adds the number of times each byte value appears in "src" to "counts". Bytes are loaded 8 at a
+time and spread over 4 interleaved 32 bit sub-histograms, so runs of the same byte do not wait on the previous
+increment of the same counter.
 
 PARAMETERS
-table* t: The table with characters and frequencies
+const unsigned char* src: Bytes to be counted
+size_t size: Number of bytes in src
+uint64_t counts[]: ALPHABET_SIZE running totals
 
 RETURN
-Pointer to finished priority queue
+N/A
 */
-pq* table_to_queue(table* t); //Christine
+void count_frequencies(const unsigned char* src, size_t size, uint64_t counts[]);
 
 /*
-PURPOSE 
-Converts PQ into a PQ with one node that contains the
-completed huffman tree
+PURPOSE
+Estimates the size of a block with histogram "counts" coded on its own: the Shannon entropy of its characters, but
+at least 1 bit each since no huffman code is shorter, plus its block header and code length table.
 
 PARAMETERS
-pq* main: Priority queue to be transformed.
+const uint64_t counts[]: Number of times each character appears in the block
 
 RETURN
-Root of the completed tree
+Estimated size in bits
 */
-tree_node* huffman_process(pq* main); //Adam
+double estimate_block_bits(const uint64_t counts[]);
 
 /*
-PURPOSE 
-Traverses through tree, determines the binary value of each character
-and inserts the unique binary code into the given table.
+PURPOSE
+Picks the block type for a histogram without coding anything: RLE when there is a single character, RAW when
+huffman coding is estimated to save less than 1/RAW_MIN_SAVING of the block (random or already compressed data),
+HUFFMAN otherwise.
 
 PARAMETERS
-tree_node* huffman_root: Pointer to the root of the huffman tree. 
-table* t: Pointer to the table that will have the binary code recorded for each 
-unique character.
-char* binaryString: String that will accumulate binary digits to be inserted into table
+const uint64_t counts[]: Number of times each character appears in the block
+double* bits: Set to the estimated size of the block, header included, with the type picked
 
 RETURN
-N/A
+BLOCK_HUFFMAN, BLOCK_RAW or BLOCK_RLE
 */
-void insert_binary_values_into_table(tree_node* huffman_root, table* t, char* binaryString); //Shailendra
+int choose_block_type(const uint64_t counts[], double* bits);
 
 /*
-PURPOSE 
-Encode the text from "input" using the table into binary and write that into "output".
+PURPOSE
+Estimates the bits needed to code the characters counted in "counts" with codes made for another histogram, "model",
+which must count every character that "counts" does. Used by the order-1 mode to decide which contexts are worth a
+code table of their own.
 
 PARAMETERS
-table* t: The table containing the unique characters with their binary representations
-FILE* input: Pointer to file with the text to be encoded.
-FILE* output: File where binaries will be written.
+const uint64_t counts[]: Number of times each character appears in the data to be coded
+const uint64_t model[]: Histogram the codes are made for
 
 RETURN
-N/A
+Estimated size in bits
 */
-void encode(table* t, FILE* input, FILE* output); //Riley
+double estimate_cross_bits(const uint64_t counts[], const uint64_t model[]);
 
 /*
 PURPOSE
-Takes the tree root, the pointer to the binary and the pointer to the output file and decodes the binary file into the
-output file.
+Materializes the table from a histogram, one node per character with a non-zero count.
 
 PARAMETERS
-tree_node* root: Root of huffman tree
-FILE* input: Pointer to binary data file to be decoded
-FILE* output: Pointer to txt file that will have decoded message written into.
+huffman_arena* arena: Arena the table is built in, with room for ALPHABET_SIZE characters
+const uint64_t counts[]: Number of times each character appears
 
 RETURN
-N/A
+Pointer to the arena's table
 */
-void decode(tree_node* root, FILE* input, FILE* output); //Riley
+table* histogram_to_table(huffman_arena* arena, const uint64_t counts[]);
 
-//Helper Functions---------------------------------------------------------------------------------------------------------
+/*
+PURPOSE
+Takes the characters and frequencies in table, puts them as leaf nodes in the pq and sorts
+them by frequency. The tree is built in the arena's node array.
+
+PARAMETERS
+huffman_arena* arena: Arena holding the table
+table* t: The table with characters and frequencies
+
+RETURN
+Pointer to finished priority queue
+*/
+pq* table_to_queue(huffman_arena* arena, table* t); //Christine
 
 /*
 PURPOSE 
-Allocates memory for and creates empty table
+Converts PQ into a PQ with one node that contains the
+completed huffman tree. Runs in linear time since both
+queues stay sorted without any searching.
+
+PARAMETERS
+pq* main: Priority queue to be transformed.
 
 RETURN
-Pointer to created empty table
+Index of the root of the completed tree in main->nodes, NO_NODE if the queue is empty
 */
-table* create_table(); //Shailendra
+uint16_t huffman_process(pq* main); //Adam
 
 /*
 PURPOSE 
-Allocates memory for and creates a table node
+Traverses through tree, determines the code length of each character, shortens the lengths to MAX_CODE_LEN if the
+tree is too deep, and records the canonical code of each character in the given table.
 
 PARAMETERS
-char value: Character to be placed in node and table.
-int freq: Frequency of character "value"
+const tree_node nodes[]: Node array of the huffman tree.
+uint16_t huffman_root: Index of the root of the huffman tree. 
+table* t: Pointer to the table that will have the code recorded for each unique character.
+unsigned char lengths[]: Array of ALPHABET_SIZE code lengths to be filled in. 0 for characters not in the table.
 
 RETURN
-Pointer to created node.
+N/A
 */
-table_node* create_table_node(char value, int freq); //Shailendra
+void assign_codes_to_table(const tree_node nodes[], uint16_t huffman_root, table* t, unsigned char lengths[]); //Shailendra
 
 /*
-PURPOSE
-Allocates memory for new tree node and creates it with given data.
+PURPOSE 
+Encode the text in "src" using the table into binary and write that into "dst" as a block payload: the code
+length table followed by the packed bitstream.
 
 PARAMETERS
-char value: Character to be stored in tree node
-int frequency: Frequency of character "value"
-tree_node* left: Pointer to left child of new node
-tree_node* right: Pointer to right child of new node
+table* t: The table containing the unique characters with their frequencies and canonical codes
+const unsigned char lengths[]: Code length of every character, as filled in by assign_codes_to_table
+const unsigned char* src: Text to be encoded, the same bytes that were counted into the table
+size_t srcSize: Number of bytes in src
+unsigned char* dst: Where binaries will be written. Must hold block_bound(srcSize) bytes.
+int streams: 1 for a single bitstream, 4 to code each quarter of src into its own bitstream after a jump table
 
 RETURN
-Pointer to new tree node.
+Number of bytes written to dst
 */
-tree_node* newNode(char value, int frequency, tree_node *left, tree_node *right); //Adam
+size_t encode(table* t, const unsigned char lengths[], const unsigned char* src, size_t srcSize, unsigned char* dst, int streams); //Riley
 
 /*
 PURPOSE
-Compares two tree nodes and checks which one is smaller, greater or 
-if they are equal.
+Encoder kernel. Packs the code of every byte in "src" into "dst", most significant bit first, using a 64 bit
+accumulator. Four codes are added at a time, then the accumulator is stored to "dst" as a whole word and "dst" is
+advanced by the number of complete bytes.
 
 PARAMETERS
-tree_node* n1: First node
-tree_node* n2: Second node
+const code_entry codes[]: Code and length of every character. Lengths must be between 1 and MAX_CODE_LEN for characters
+in src.
+const unsigned char* src: Bytes to be encoded
+size_t srcSize: Number of bytes in src
+unsigned char* dst: Output buffer. Must hold the encoded size rounded up to a byte plus HUF_WRITE_SLACK.
 
 RETURN
-If n1 < n2: -1
-If n1 > n2: 1
-If n2 = n1: 0
+Number of bytes written to dst (the last byte is padded with zero bits)
 */
-int node_compare(tree_node* n1, tree_node* n2); //Adam
+size_t encode_buffer(const code_entry codes[], const unsigned char* src, size_t srcSize, unsigned char* dst);
 
 /*
 PURPOSE
-Takes nodes n1 and n2, adds their frequencies and creates a node
-with the value set as NULL, frequency set as the sum and left child set
-as n1 and right child set as n2. (IMPORTANT: n1 < n2)
+Builds the lookup tables used by decode_buffer from a set of code lengths. Each fast entry holds every whole code
+that fits in its DECODE_TABLE_BITS bits (up to two); longer codes are resolved from the canonical code ranges.
 
 PARAMETERS
-tree_node* n1: Node to be left child of parent
-tree_node* n2: Node to be right child of parent
+const unsigned char lengths[]: Code length of every character (0 if unused)
+decode_table* dt: Table to be filled in
 
 RETURN
-Parent node with n1 and n2 as their children with the sum of their frequencies
-as the frequency of the parent.
+1 if the lengths describe a valid prefix code, 0 if not
 */
-tree_node* node_combine (tree_node *n1, tree_node *n2); //Adam
+int build_decode_table(const unsigned char lengths[], decode_table* dt);
 
 /*
 PURPOSE
-Inserts node into priority queue in proper order
+Decoder kernel. Decodes exactly dstSize characters from the packed bitstream in "src" into "dst", resolving up to
+two characters per table lookup.
 
 PARAMETERS
-pq* pq_main: Priority queue 
-pq_node*: node: Node to be inserted into priority 
-queue
+const decode_table* dt: Tables built by build_decode_table
+const unsigned char* src: Packed bitstream
+size_t srcSize: Number of bytes in src
+unsigned char* dst: Output buffer, preallocated to the original size
+size_t dstSize: Number of characters to decode
 
 RETURN
-if node is inserted, then return 1
-if node is not inserted, then return 0
+1 if all characters were decoded, 0 if the bitstream is invalid or too short
 */
-int pq_insert(pq* pq_main, pq_node* node); //Adam   
+int decode_buffer(const decode_table* dt, const unsigned char* src, size_t srcSize, unsigned char* dst, size_t dstSize);
 
 /*
 PURPOSE
-Creates and allocate memory for new PQ node.
+Decoder kernel for 4 bitstreams. Stream k holds the k-th quarter of the block. The 4 streams have no dependency on
+each other, so advancing all of them in one loop lets the CPU overlap their lookups.
+
+PARAMETERS
+const decode_table* dt: Tables built by build_decode_table
+const unsigned char* const src[]: The 4 bitstreams
+const size_t srcSize[]: Number of bytes in each bitstream
+unsigned char* dst: Output buffer, preallocated to the original size
+size_t dstSize: Number of characters to decode
 
 RETURN
-The new PQ node
+1 if all characters were decoded, 0 if a bitstream is invalid or too short
 */
-pq_node* newPQNode(); //Adam
+int decode_buffer_4(const decode_table* dt, const unsigned char* const src[], const size_t srcSize[], unsigned char* dst, size_t dstSize);
 
 /*
 PURPOSE
-Traverses table to search for entry with input character
+Reads the code lengths of a block payload, builds the decode table from them and decodes the bitstream that follows.
+
+PARAMETERS
+const unsigned char* payload: Block payload written by encode
+size_t payloadSize: Number of bytes in payload
+unsigned char* dst: Where the decoded block will be written
+size_t dstSize: Number of bytes in the original block
+unsigned char type: Block type from the block header, which tells how many bitstreams there are and whether the
+payload ends with a checkpoint table
 
 RETURN
-Table node with character. NULL if character is not found
+1 if the block was decoded, 0 if the code lengths or bitstream are invalid
 */
-table_node* search_for_table_node(char character, table *t); //Tatiana
+int decode(const unsigned char* payload, size_t payloadSize, unsigned char* dst, size_t dstSize, unsigned char type); //Riley
 
 /*
 PURPOSE
-Allocates memory for and creates new Priority Queue
+Decodes an order-1 block payload: the context map and code tables, then one bitstream in which every character is
+coded with the table of the character before it (character 0 before the first).
+
+PARAMETERS
+const unsigned char* payload: Block payload
+size_t payloadSize: Number of bytes in payload
+unsigned char* dst: Where the decoded block will be written
+size_t dstSize: Number of bytes in the original block
 
 RETURN
-Pointer to priority queue
+1 if the block was decoded, 0 if it is invalid or memory for the decode tables ran out
 */
-pq* new_pq (); //Adam
+int decode_order1(const unsigned char* payload, size_t payloadSize, unsigned char* dst, size_t dstSize);
 
-//Code---------------------------------------------------------------------------------------------------------------------
-//Shailendra
-int main(int argc, char *argv[])
-{
-    //Turns standard output buffering off
-    setbuf(stdout, NULL);
+/*
+PURPOSE
+Decodes only bytes [from, to) of a block. Decoding starts at the last checkpoint (or bitstream start) at or before
+"from", and the bytes up to "from" are decoded and dropped, so at most CHECKPOINT_INTERVAL bytes are wasted in a
+block with a checkpoint table.
 
-    //Prompt for file name in project
-    char file_name[264];
-    printf("Enter file name you would like to encode: ");
-    scanf("%s", file_name);
+PARAMETERS
+decode_table* dt: Filled in with the block's decode tables
+const unsigned char* globalLengths: Code lengths of the file's global table, NULL if it has none
+const unsigned char* payload: Block payload
+size_t payloadSize: Number of bytes in payload
+size_t rawSize: Number of bytes in the original block
+unsigned char type: Block type from the block header
+size_t from: First byte of the block to decode
+size_t to: Byte after the last one to decode (from < to <= rawSize)
+unsigned char* dst: Where the to - from bytes are written
 
-    //To store execution time of code
-    double timeSpent = 0.0;
+RETURN
+1 if the bytes were decoded, 0 if the block is invalid
+*/
+int decode_block_range(decode_table* dt, const unsigned char* globalLengths, const unsigned char* payload, size_t payloadSize, size_t rawSize, unsigned char type, size_t from, size_t to, unsigned char* dst);
 
-    //Start clock
-    clock_t beginTime = clock();
+/*
+PURPOSE
+Largest number of bytes compress_block can write for a block of "size" bytes.
+*/
+size_t block_bound(size_t size);
 
-    //Open input file
-    FILE* encodeInput = fopen(file_name, "r");
+/*
+PURPOSE
+Compresses one block: counts its characters, builds its tree and codes, and writes the block header and payload.
+Above effort 0 the block is first split where its statistics change enough for a new code table to pay for itself,
+and each part is written as a block of its own, one after another.
 
-    //Crash program if file was not found
-    if(encodeInput == NULL)
-    {
-        printf("NO FILE FOUND");
-        exit(0);
-    }
+PARAMETERS
+const unsigned char* src: Bytes of the block
+size_t srcSize: Number of bytes in src (1 to MAX_BLOCK_SIZE)
+unsigned char* dst: Output, at least block_bound(srcSize) bytes
+uint64_t counts[]: Filled in with the block's character counts
+const compress_options* options: Number of bitstreams, whether to add a checkpoint table and the effort
+huffman_arena* arena: Arena for the block's table and tree, reset before use
+size_t* blockCount: Set to the number of blocks written
 
-    //Initialize table
-    table* valueTable;
+RETURN
+Number of bytes written to dst
+*/
+size_t compress_block(const unsigned char* src, size_t srcSize, unsigned char* dst, uint64_t counts[], const compress_options* options, huffman_arena* arena, size_t* blockCount);
 
-    //Put file values in table
-    valueTable = convert_to_table(encodeInput);
+/*
+PURPOSE
+Writes the file header, the blocks of "src" and the block index to "output". Batches of blocks are compressed in
+parallel and written in order. With options->globalTable set, the input is first counted (or sampled) by all
+threads and one code table built from that follows the header, for every block it fits.
 
-    //Calculate number of unique characters
-    int uniqueCharacters = valueTable->count;
+PARAMETERS
+const unsigned char* src: Whole input
+size_t srcSize: Number of bytes in src
+output_sink* output: Where the encoded file is written
+const compress_options* options: Thread count and block size
+uint64_t counts[]: Filled in with the character counts of the whole input, or of the sample with GLOBAL_SAMPLED
 
-    //Print number of unique characters
-    printf("Unique Characters: %d\n", uniqueCharacters);
+RETURN
+1 on success, 0 if memory ran out
+*/
+int compress_file(const unsigned char* src, size_t srcSize, output_sink* output, const compress_options* options, uint64_t counts[]);
 
-    //Reopen input file
-    fclose(encodeInput);
-    encodeInput = fopen(file_name, "r");
+/*
+PURPOSE
+Checks the header and block index of an encoded file and decodes all its blocks in parallel, each straight into its
+place in the output.
 
-    //Convert table into priority queue
-    pq* huffmanQueue = table_to_queue(valueTable);
+PARAMETERS
+const unsigned char* src: Whole encoded file
+size_t srcSize: Number of bytes in src
+output_sink* output: Where the decoded file is written
+int threads: Number of threads to decode with
+run_stats* stats: Where to add up the statistics of every block, NULL if nobody asked
 
-    //Perform huffman process on queue and return pointer to tree
-    tree_node* huffmanTree = huffman_process(huffmanQueue);
+RETURN
+1 if the file was decoded, 0 if it is invalid
+*/
+int decompress_file(const unsigned char* src, size_t srcSize, output_sink* output, int threads, run_stats* stats);
 
-    //Special case (Only 1 unique character)
-    if(uniqueCharacters == 1)
-    {
-        huffmanTree = node_combine(newNode(NULL, 0, NULL, NULL), huffmanTree);
-    }
+/*
+PURPOSE
+Compresses everything that can be read from "fd" without knowing its size. A reader thread reads the next batch of
+blocks while the batch before is compressed in parallel and written, so at most READ_SLOTS batches are held in
+memory. The file is written without a block index.
 
-    //Traverse through tree and put binary values for each char in the table
-    char emptyString[MAX_BINARY_LEN];
-    emptyString[0]  = '\0';
-    insert_binary_values_into_table(huffmanTree, valueTable, emptyString);
+PARAMETERS
+int fd: File descriptor to read, such as standard input
+output_sink* output: Where the encoded file is written
+const compress_options* options: Thread count, block size and bitstreams per block
+const stream_io* io: Whether to read through io_uring and where to add up the reader's time, or NULL
 
-    //Create output   file
-    FILE* encodeOutput = fopen("encodeOutput.txt", "w");
+RETURN
+1 on success, 0 if reading failed or memory ran out
+*/
+int compress_stream(int fd, output_sink* output, const compress_options* options, const stream_io* io);
 
-    //Encode the input message into output.txt using the binaries from table
-    encode(valueTable, encodeInput, encodeOutput);
+/*
+PURPOSE
+Decompresses an encoded file read from "fd", block by block from the front, so the block index is not needed. A
+batch of blocks is decoded in parallel and written while a reader thread reads ahead.
 
-    //Close file pointers
-    fclose(encodeInput);
-    fclose(encodeOutput);
+PARAMETERS
+int fd: File descriptor to read, such as standard input
+output_sink* output: Where the decoded file is written
+int threads: Number of threads to decode with
+const stream_io* io: Whether to read through io_uring and where to add up the reader's time, or NULL
+run_stats* stats: Where to add up the statistics of every block, NULL if nobody asked
 
-    //Open decode files
-    FILE* decodeInput = fopen("encodeOutput.txt", "r");
-    FILE* decodeOutput = fopen("decodeOutput.txt", "w");
+RETURN
+1 if the file was decoded, 0 if it is invalid, cut short or memory ran out
+*/
+int decompress_stream(int fd, output_sink* output, int threads, const stream_io* io, run_stats* stats);
 
-    //Decode input
-    decode(huffmanTree, decodeInput, decodeOutput);
+/*
+PURPOSE
+Adds a path to the files an archive will hold. A regular file is added as it is, and a directory with everything
+under it, in sorted order. A path starting with "@" names a file that lists paths one per line ("@-" for standard
+input). Anything else, such as a symbolic link, is skipped with a warning.
 
-    //Close decode files
-    fclose(decodeInput);
-    fclose(decodeOutput);
+PARAMETERS
+archive_list* list: List to add to, zeroed before the first call
+const char* path: File, directory or @list
 
-    //End clock
-    clock_t endTime = clock();
+RETURN
+1 on success, 0 if a path cannot be read or stored (names with a ".." part are refused) or memory ran out
+*/
+int archive_add_path(archive_list* list, const char* path);
 
-    //Calculate elapsed time by finding difference (end - begin) and dividing the difference by CLOCKS_PER_SEC to convert to seconds
-    timeSpent += (double)(endTime - beginTime) / CLOCKS_PER_SEC;
+/*
+PURPOSE
+Frees the entries of an archive list.
+*/
+void free_archive_list(archive_list* list);
 
-    //Print execution time
-    printf("Encoding and decoding time was %f seconds", timeSpent);
-    printf("\nEND! \n");
+/*
+PURPOSE
+Writes the files of "list" as one encoded file: their contents one after another, cut into blocks like compress_file,
+then a file table naming each file, its size and its permission bits. Small files share blocks, and big files are
+spread over many. Each batch of blocks is read from the files and compressed with work stealing, so the threads stay
+busy even when some blocks cost much more than others.
 
-    //Free all memory
-    exit(0);
+PARAMETERS
+const archive_list* list: Files to store
+output_sink* output: Where the archive is written
+const compress_options* options: Thread count, block size and block options. The global table options are ignored.
 
-    //Return Statement
-    return 0;
+RETURN
+1 on success, 0 if a file could not be read or memory ran out
+*/
+int compress_archive(const archive_list* list, output_sink* output, const compress_options* options);
 
-}
+/*
+PURPOSE
+Checks an archive written by compress_archive and recreates its files, and the directories above them, under the
+current directory. Batches of blocks are decoded in parallel with work stealing and written out in order.
 
-//Adam
-tree_node* newNode(char value, int frequency, tree_node *left, tree_node *right)
-{
-    tree_node* node = malloc(sizeof(tree_node));
-    node->value = value;
-    node->frequency = frequency;
-    node->left = left;
-    node->right = right;
-    return node;
-}
+PARAMETERS
+const unsigned char* src: Whole archive
+size_t srcSize: Number of bytes in src
+int threads: Number of threads to decode with
+run_stats* stats: Where to add up the statistics of every block, NULL if nobody asked
 
-//Adam
-int node_compare(tree_node *n1, tree_node *n2) {
-    int rtrn;
-    if (n1->frequency > n2->frequency) {
-        rtrn = 1;
-    }
-    else if (n1->frequency < n2->frequency) {
-        rtrn = -1;
-    }
-    else {
-        rtrn = 0;
-    }
-    return rtrn;
-}
+RETURN
+1 if every file was written, 0 if the archive is invalid or a file could not be created
+*/
+int extract_archive(const unsigned char* src, size_t srcSize, int threads, run_stats* stats);
 
-//Adam
-tree_node* node_combine (tree_node *n1, tree_node *n2) {
-    return(newNode(NULL, (n1->frequency + n2->frequency), n1, n2));
-}
+/*
+PURPOSE
+Sets up an empty table cache.
 
-//Adam
-int pq_insert(pq* pq_main, pq_node* node) {
+RETURN
+1 on success, 0 if memory ran out
+*/
+int init_table_cache(table_cache* cache);
 
-    //return 1 on successful insert, 0 on no insert
-    pq_node* prev = NULL;
-    pq_node* curr = pq_main->head;
-    int inserted = 0;
-    if (curr == NULL) { //pq is empty, insert and set head to node
-        pq_main->head = node;
-    }
-    else { //pq is not empty; iterate through the pq
-        while (curr != NULL && inserted == 0) {
-            tree_node* t_node1 = curr->ptr;
-            tree_node* t_node2 = node->ptr;
+/*
+PURPOSE
+Frees the tables held by a cache.
+*/
+void free_table_cache(table_cache* cache);
 
+/*
+PURPOSE
+Looks for code lengths built for a histogram of the same shape as "counts": one where every character's ideal code
+length (log2 of the total over its count) rounds down to the same value. They are used only if they give every
+character of "counts" a code and cost at most 1/TABLE_CACHE_SLACK more, relative to the entropy estimate, than they
+did for the histogram they were built from.
 
-            if (node_compare(t_node1, t_node2) == -1 ) { // curr has lower freq than the key node; iterate
-                prev = curr;
-                curr = curr->next;
-            }
-            else { // node to be inserted has lower frequency than curr; insert
-                if (prev == NULL) { // node is smallest in the pq
-                    node->next = pq_main->head;
-                    pq_main->head = node;
-                }
-                else { // node is not the smallest
-                    prev->next = node;
-                    node->next = curr;
-                }
-                inserted = 1;
-            }
-        }
-        if(inserted!= 1){ // insert at the end of the list
-            prev->next = node;
-            node->next = NULL;
-            inserted = 1;
-        }
-    }
-    return inserted;
-}
+PARAMETERS
+table_cache* cache: Cache to look in
+const uint64_t counts[]: Histogram of the block
+double bits: Estimated size of the block from estimate_block_bits
+unsigned char lengths[]: Where the code lengths are copied
 
-//Adam
-tree_node* huffman_process(pq* pq_main) { // takes the priority queue as input, outputs the root of the completed Huffman Tree
-    tree_node* combined_node;
-    pq_node* new_pq_node;
+RETURN
+1 if lengths were found, 0 if the block needs its own
+*/
+int cached_code_lengths(table_cache* cache, const uint64_t counts[], double bits, unsigned char lengths[]);
 
-    pq_node* smallest = pq_main->head;
-    pq_node* second_smallest = smallest->next;
-    while(smallest->next != NULL) {
-        pq_main->head = second_smallest->next; //set the new front to the 3rd smallest
+/*
+PURPOSE
+Stores code lengths just built for "counts" in the cache, replacing the least recently used entry.
+*/
+void store_code_lengths(table_cache* cache, const uint64_t counts[], double bits, const unsigned char lengths[]);
+
+/*
+PURPOSE
+Fills "dt" with the decode tables of a set of code lengths, copied from the cache if they were built before, and
+otherwise built and stored in the cache.
+
+RETURN
+1 on success, 0 if the lengths are invalid
+*/
+int cached_decode_table(table_cache* cache, const unsigned char lengths[], decode_table* dt);
+
+/*
+PURPOSE
+Runs the daemon: listens on a Unix domain socket and answers compress and decompress requests from any number of
+clients, each connection on a thread of its own. Contexts are kept warm between connections, and every connection
+shares one cache of recently built code and decode tables. Only returns if the socket cannot be set up or accepting
+fails.
+
+PARAMETERS
+const char* socketPath: Path of the socket. A stale socket left there is replaced.
+const compress_options* options: Block size and block options every request is compressed with
+
+RETURN
+0
+*/
+int run_daemon(const char* socketPath, const compress_options* options);
+
+/*
+PURPOSE
+Sends one request to a running daemon and writes the reply to standard output.
+
+PARAMETERS
+const char* socketPath: Path of the daemon's socket
+int operation: 'c' to compress, 'd' to decompress, 's' for the daemon's statistics
+const char* inputPath: File to send, NULL for standard input. Not read for 's'.
+
+RETURN
+1 if the daemon answered, 0 if it could not be reached or the request failed
+*/
+int daemon_request(const char* socketPath, int operation, const char* inputPath);
+
+/*
+PURPOSE
+Decodes only bytes [offset, offset + length) of the original file, without decoding the blocks before them. Blocks
+are found by their headers, and within a block decoding starts from the nearest checkpoint.
+
+PARAMETERS
+const unsigned char* src: Whole encoded file
+size_t srcSize: Number of bytes in src
+uint64_t offset: First byte of the original file to decode
+uint64_t length: Number of bytes to decode. The range stops early at the end of the original file.
+output_sink* output: Where the decoded bytes are written
+
+RETURN
+Number of bytes decoded, 0 if the range starts at or past the end of the original file, or HUFFMAN_ERROR if the file
+is invalid or memory ran out
+*/
+size_t decompress_range(const unsigned char* src, size_t srcSize, uint64_t offset, uint64_t length, output_sink* output);
+
+/*
+PURPOSE
+Compresses everything that can be read from "fd" as an adaptive file. Every character is coded as soon as it is
+read, and the output is flushed whenever the input has nothing more to give right away.
+
+PARAMETERS
+int fd: File descriptor to read, such as standard input
+output_sink* output: Where the encoded file is written
+run_stats* stats: Where the characters, code lengths and time are added up, NULL for none
+
+RETURN
+1 on success, 0 if reading failed
+*/
+int compress_adaptive(int fd, output_sink* output, run_stats* stats);
+
+/*
+PURPOSE
+Decompresses the bitstream of an adaptive file read from "fd", after its header. Output is flushed before every
+read that may have to wait, so what has been decoded is passed on right away.
+
+PARAMETERS
+int fd: File descriptor to read, positioned just after the header
+output_sink* output: Where the decoded file is written
+run_stats* stats: Where the characters, code lengths and time are added up, NULL for none
+
+RETURN
+1 if the stream was decoded up to its END, 0 if it is invalid or cut short
+*/
+int decompress_adaptive(int fd, output_sink* output, run_stats* stats);
+
+/*
+PURPOSE
+Empties an adaptive model, leaving only the NYT leaf as the root.
+*/
+void adaptive_reset(adaptive_model* model);
+
+/*
+PURPOSE
+Adds one to the count of "symbol" and restores the sibling property (FGK update). A symbol that is not yet in the
+tree is added first by splitting the NYT leaf into a new NYT leaf and the symbol's leaf.
+*/
+void adaptive_update(adaptive_model* model, int symbol);
+
+/*
+PURPOSE
+Compresses src as a word file. The input is cut into tokens, each a run of word bytes (letters, digits and UTF-8
+sequences) or a run of anything else, and every distinct token becomes one symbol of a huffman code, so common words
+cost a few bits each.
+
+PARAMETERS
+const unsigned char* src: Whole input, since the token dictionary is written before the first code
+size_t srcSize: Number of bytes in src
+output_sink* output: Where the encoded file is written
+run_stats* stats: Where the characters, token code lengths and stage times are added up, NULL for none
+
+RETURN
+1 on success, 0 if memory ran out or the input has more than WORD_MAX_TOKENS distinct tokens
+*/
+int compress_words(const unsigned char* src, size_t srcSize, output_sink* output, run_stats* stats);
+
+/*
+PURPOSE
+Decompresses the rest of a word file read from "fd", after its header.
+
+PARAMETERS
+int fd: File descriptor to read, positioned just after the header
+const unsigned char header[]: The file header, for the original size
+output_sink* output: Where the decoded file is written
+run_stats* stats: Where the characters, token code lengths and time are added up, NULL for none
+
+RETURN
+1 if the file was decoded, 0 if it is invalid or memory ran out
+*/
+int decompress_words(int fd, const unsigned char header[], output_sink* output, run_stats* stats);
+
+/*
+PURPOSE
+Replaces "n" weights, sorted smallest first, with the lengths of a minimum-redundancy (huffman) code for them, in
+place and in linear time (Moffat and Katajainen). No tree is built, so alphabets of millions of symbols cost no more
+memory than their weights. The lengths come out longest first; a single weight gets a length of 1.
+
+PARAMETERS
+uint64_t weights[]: Weights in ascending order, replaced by code lengths
+size_t n: Number of weights
+*/
+void minimum_redundancy_lengths(uint64_t weights[], size_t n);
+
+/*
+PURPOSE
+Starts a thread pool. With "threads" set to 1 no threads are started and batches run on the calling thread.
+
+RETURN
+Pointer to the pool, NULL if it could not be started
+*/
+thread_pool* create_pool(int threads);
+
+/*
+PURPOSE
+Runs task(context, i) for every i from 0 to count - 1 across the pool and the calling thread, and returns once all of
+them have finished.
+*/
+void pool_run(thread_pool* pool, pool_task task, void* context, size_t count);
+
+/*
+PURPOSE
+Runs task(context, i) for every i from 0 to count - 1 like pool_run, but with work stealing: every thread starts on
+a range of neighbouring indices of its own and, once that runs out, takes the back half of the largest range left.
+Neighbouring tasks stay on one thread, and a thread held up by slow tasks has the rest of its range taken over.
+*/
+void pool_run_stealing(thread_pool* pool, pool_task task, void* context, size_t count);
+
+/*
+PURPOSE
+Stops the pool's threads and frees it.
+*/
+void destroy_pool(thread_pool* pool);
+
+//Helper Functions---------------------------------------------------------------------------------------------------------
+
+/*
+PURPOSE
+Allocates an arena with room for the table and tree of "maxLeaves" characters, in a single allocation
+
+PARAMETERS
+int maxLeaves: Most characters the arena will hold, from 1 to MAX_ARENA_LEAVES
+
+RETURN
+Pointer to the arena, NULL if memory ran out
+*/
+huffman_arena* create_arena(int maxLeaves);
+
+/*
+PURPOSE
+Empties the arena so the next block can reuse it. Tables, queues and trees from before are no longer valid.
+*/
+void reset_arena(huffman_arena* arena);
+
+/*
+PURPOSE
+Frees an arena along with everything built in it.
+*/
+void free_arena(huffman_arena* arena);
+
+/*
+PURPOSE 
+Empties and returns the arena's table
+
+RETURN
+Pointer to the empty table
+*/
+table* create_table(huffman_arena* arena); //Shailendra
+
+/*
+PURPOSE 
+Adds a node to the end of a table. The table's arena must have room for it.
+
+PARAMETERS
+table* t: Table to add to
+char value: Character to be placed in node and table.
+uint64_t freq: Frequency of character "value"
+
+RETURN
+Pointer to created node.
+*/
+table_node* create_table_node(table* t, char value, uint64_t freq); //Shailendra
+
+/*
+PURPOSE
+Compares two tree nodes and checks which one is smaller, greater or 
+if they are equal.
+
+PARAMETERS
+const tree_node* n1: First node
+const tree_node* n2: Second node
+
+RETURN
+If n1 < n2: -1
+If n1 > n2: 1
+If n2 = n1: 0
+*/
+int node_compare(const tree_node* n1, const tree_node* n2); //Adam
+
+/*
+PURPOSE
+Takes nodes n1 and n2, adds their frequencies and creates a node
+with the value set as 0, frequency set as the sum and left child set
+as n1 and right child set as n2. (IMPORTANT: n1 < n2)
+The node comes from the pq's node storage and is added to the back of its combined queue.
+
+PARAMETERS
+pq* pq_main: Priority queue that owns the tree
+uint16_t n1: Index of the node to be left child of parent
+uint16_t n2: Index of the node to be right child of parent
+
+RETURN
+Index of the parent node with n1 and n2 as their children with the sum of their frequencies
+as the frequency of the parent.
+*/
+uint16_t node_combine (pq* pq_main, uint16_t n1, uint16_t n2); //Adam
+
+/*
+PURPOSE
+Removes the node with the lowest frequency from the priority queue. On a tie the leaf
+is taken first, which keeps the tree as shallow as possible.
+
+PARAMETERS
+pq* pq_main: Priority queue
+
+RETURN
+Index of the removed node, NO_NODE if the queue is empty
+*/
+uint16_t pq_remove_min(pq* pq_main); //Adam
+
+/*
+PURPOSE
+Traverses table to search for entry with input character
+
+RETURN
+Table node with character. NULL if character is not found
+*/
+table_node* search_for_table_node(char character, table *t); //Tatiana
+
+/*
+PURPOSE
+Empties and returns the arena's Priority Queue, which builds its tree in the arena's node array
+
+RETURN
+Pointer to priority queue
+*/
+pq* new_pq (huffman_arena* arena); //Adam
+
+/*
+PURPOSE
+Micro-benchmark for table_to_queue + huffman_process. Builds trees for alphabets from 2 to 32768 symbols
+with random frequencies and prints the time per build and per symbol.
+*/
+void benchmark_tree_build(void);
+
+/*
+PURPOSE
+Benchmark for each stage of compression and decompression on its own. Generates every kind of input at every size
+from 1 KiB to maxSize, codes it in DEFAULT_BLOCK_SIZE blocks on one thread, checks that it decodes back, and prints
+the throughput of each stage, the compression ratio and the allocations per block of each stage.
+
+PARAMETERS
+size_t maxSize: Largest input generated, in bytes
+*/
+void benchmark_stages(size_t maxSize);
+
+/*
+PURPOSE
+Builds a dictionary from character counts: code lengths for all 256 characters, limited to MAX_CODE_LEN, with
+characters that were never counted treated as if they appeared once.
+
+PARAMETERS
+const uint64_t counts[]: Number of times each character appears in the samples
+uint32_t id: Dictionary ID
+unsigned char* dst: Where the dictionary file is stored, HUFFMAN_DICTIONARY_MAX_SIZE bytes
+
+RETURN
+Number of bytes stored, 0 if memory ran out
+*/
+size_t store_dictionary(const uint64_t counts[], uint32_t id, unsigned char* dst);
+
+/*
+PURPOSE
+Trains a dictionary from sample files and saves it.
+
+PARAMETERS
+const char* path: Dictionary file to write
+uint32_t id: Dictionary ID
+char* const samples[]: Names of the sample files
+int sampleCount: Number of sample files
+
+RETURN
+1 if the dictionary was written, 0 if a sample could not be read or the file could not be written
+*/
+int train_dictionary_file(const char* path, uint32_t id, char* const samples[], int sampleCount);
+
+/*
+PURPOSE
+Compresses (mode 'c') or decompresses (mode 'd') a whole input as one dictionary frame, to standard output.
+
+PARAMETERS
+int mode: 'c' or 'd'
+const char* dictionaryPath: Dictionary file written by train_dictionary_file
+const char* inputPath: File to read, NULL for standard input
+run_stats* stats: Where the characters, code lengths and stage times are added up, NULL for none
+
+RETURN
+1 on success, 0 if the dictionary or input could not be read or the frame is invalid
+*/
+int dictionary_stream(int mode, const char* dictionaryPath, const char* inputPath, run_stats* stats);
+
+/*
+PURPOSE
+Computes canonical codes from code lengths. Codes are handed out in order of increasing length, and in order of
+character value within a length.
+
+PARAMETERS
+const unsigned char lengths[]: Code length of every character (0 if unused)
+unsigned int codes[]: Array of ALPHABET_SIZE codes to be filled in
+
+RETURN
+N/A
+*/
+void compute_canonical_codes(const unsigned char lengths[], unsigned int codes[]);
+
+/*
+PURPOSE
+Replaces code lengths with the optimal lengths that are no longer than maxLength, using the package-merge algorithm.
+
+PARAMETERS
+const uint64_t weights[]: Frequency of every character (0 if unused)
+unsigned char lengths[]: Array of ALPHABET_SIZE code lengths to be filled in
+int maxLength: Longest code allowed. 2^maxLength must be at least the number of used characters.
+
+RETURN
+N/A
+*/
+void limit_code_lengths(const uint64_t weights[], unsigned char lengths[], int maxLength);
+
+/*
+PURPOSE
+Writes the code length table: a bitmap of used characters, then their lengths packed two per byte.
+
+PARAMETERS
+const unsigned char lengths[]: Code length of every character (0 if unused, otherwise at most 15)
+unsigned char* out: Buffer of at least CODE_LENGTHS_MAX_SIZE bytes
+
+RETURN
+Number of bytes written
+*/
+size_t write_code_lengths(const unsigned char lengths[], unsigned char* out);
+
+/*
+PURPOSE
+Reads a code length table written by write_code_lengths.
+
+PARAMETERS
+const unsigned char* in: Start of the table
+size_t available: Number of readable bytes at "in"
+unsigned char lengths[]: Array of ALPHABET_SIZE code lengths to be filled in
+
+RETURN
+Number of bytes read, 0 if the table is cut short or holds a zero length
+*/
+size_t read_code_lengths(const unsigned char* in, size_t available, unsigned char lengths[]);
+
+/*
+PURPOSE
+Stores a 64 bit word most significant byte first, as used by the bitstream.
+*/
+static inline void store_u64_be(unsigned char* p, uint64_t value)
+{
+    for(int i = 0; i < 8; i++)
+    {
+        p[i] = (unsigned char)(value >> (56 - 8 * i));
+    }
+}
+
+/*
+PURPOSE
+Loads a 64 bit word most significant byte first. The padded version treats bytes past srcSize as zero.
+*/
+static inline uint64_t load_u64_be(const unsigned char* p)
+{
+    uint64_t value = 0;
+    for(int i = 0; i < 8; i++)
+    {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+static inline uint64_t load_u64_be_padded(const unsigned char* src, size_t srcSize, uint64_t pos)
+{
+    uint64_t value = 0;
+    for(int i = 0; i < 8; i++)
+    {
+        value = (value << 8) | ((pos + i < srcSize) ? src[pos + i] : 0);
+    }
+    return value;
+}
+
+/*
+PURPOSE
+Stores / loads an unsigned 32 bit integer in little endian byte order, as used by block headers.
+*/
+static inline void store_u32_le(unsigned char* p, uint32_t value)
+{
+    for(int i = 0; i < 4; i++)
+    {
+        p[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+static inline uint32_t load_u32_le(const unsigned char* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/*
+PURPOSE
+Stores / loads an unsigned 64 bit integer in little endian byte order, as used by the header.
+*/
+static inline void store_u64_le(unsigned char* p, uint64_t value)
+{
+    for(int i = 0; i < 8; i++)
+    {
+        p[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+static inline uint64_t load_u64_le(const unsigned char* p)
+{
+    uint64_t value = 0;
+    for(int i = 7; i >= 0; i--)
+    {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+/*
+PURPOSE
+Opens the whole input file as one span of memory. Regular files are memory mapped; anything else (pipes, devices)
+is read into a single buffer.
+
+PARAMETERS
+const char* path: Name of the file
+input_span* in: Span to be filled in
+
+RETURN
+1 if the file was opened, 0 if not
+*/
+int open_input(const char* path, input_span* in);
+
+/*
+PURPOSE
+Reads everything left in a file descriptor into one buffer, for inputs that cannot be mapped. The descriptor is
+left open.
+
+PARAMETERS
+int fd: File descriptor to read
+input_span* in: Span to be filled in
+
+RETURN
+1 if the input was read to its end, 0 if reading failed or memory ran out
+*/
+int read_input(int fd, input_span* in);
+
+/*
+PURPOSE
+Unmaps or frees an input span.
+*/
+void close_input(input_span* in);
+
+/*
+PURPOSE
+Creates (or truncates) a file and returns a buffered sink that writes to it.
+
+PARAMETERS
+const char* path: Name of the file
+
+RETURN
+Pointer to the sink, NULL if the file could not be created
+*/
+output_sink* open_sink(const char* path);
+
+/*
+PURPOSE
+Returns a buffered sink that writes to a file descriptor that is already open, such as standard output. The
+descriptor is closed by close_sink.
+
+RETURN
+Pointer to the sink, NULL if memory ran out
+*/
+output_sink* open_sink_fd(int fd);
+
+/*
+PURPOSE
+Returns room for "size" bytes at the end of the sink's buffer, flushing or growing the buffer as needed. Nothing is
+written until sink_commit says how many of those bytes were used.
+
+PARAMETERS
+output_sink* sink: Sink to write to
+size_t size: Number of bytes needed
+
+RETURN
+Pointer to the reserved bytes, NULL if the buffer could not be grown
+*/
+unsigned char* sink_reserve(output_sink* sink, size_t size);
+
+/*
+PURPOSE
+Adds "size" bytes of the space returned by sink_reserve to the output.
+*/
+void sink_commit(output_sink* sink, size_t size);
+
+/*
+PURPOSE
+Copies "size" bytes to the sink.
+*/
+void sink_write(output_sink* sink, const void* data, size_t size);
+
+/*
+PURPOSE
+Writes out everything in the sink's buffer now, for output that someone is waiting on.
+*/
+void sink_flush(output_sink* sink);
+
+/*
+PURPOSE
+Writes whatever is left in the buffer, closes the file and frees the sink.
+
+RETURN
+1 if everything was written, 0 if any write failed
+*/
+int close_sink(output_sink* sink);
+
+/*
+PURPOSE
+Like open_sink_fd, but full buffers are handed to a writer thread through a ring of WRITE_SLOTS buffers, so writing
+one buffer overlaps with filling the next. Falls back to a plain sink if the thread cannot be started.
+
+PARAMETERS
+int fd: File descriptor to write, closed by close_sink
+const stream_io* io: Whether to write through io_uring and where to add up the writer's time, or NULL
+
+RETURN
+Pointer to the sink, NULL if memory ran out
+*/
+output_sink* open_sink_pipelined(int fd, const stream_io* io);
+
+/*
+PURPOSE
+Starts a reader thread that fills a ring of buffers from a file, so reading overlaps with coding. The file is read
+from its current position.
+
+PARAMETERS
+int fd: File descriptor to read, left open
+size_t capacity: Size of each buffer
+int slots: Number of buffers, 2 to PIPE_MAX_SLOTS
+int partial: 0 to fill every buffer but the last, 1 to hand over whatever each read returns, so data that trickles
+             in from a pipe is not held back until a buffer fills
+const stream_io* io: Whether to read through io_uring and where to add up the reader's time, or NULL
+
+RETURN
+Pointer to the reader, NULL if memory ran out or the thread could not be started
+*/
+io_pipe* open_reader(int fd, size_t capacity, int slots, int partial, const stream_io* io);
+
+/*
+PURPOSE
+Waits for the next full buffer of a reader. The buffer stays valid until pipe_release. Unless the reader is partial,
+only a buffer at the end of the file is less than full.
+
+RETURN
+The buffer, with its size in *size; NULL once the file has ended, or if reading failed (reader->failed is then set)
+*/
+const unsigned char* pipe_acquire(io_pipe* reader, size_t* size);
+
+/*
+PURPOSE
+Hands the buffer returned by pipe_acquire back to the reader thread to fill again.
+*/
+void pipe_release(io_pipe* reader);
+
+/*
+PURPOSE
+Copies the next "size" bytes of a reader's file to dst, like read_full on the file itself.
+
+RETURN
+Number of bytes copied, less than size only at the end of the file, or -1 if reading failed
+*/
+ssize_t pipe_read(io_pipe* reader, unsigned char* dst, size_t size);
+
+/*
+PURPOSE
+Stops a reader thread and frees the reader.
+*/
+void close_reader(io_pipe* reader);
+
+/*
+PURPOSE
+Prints to standard error how much of the time each stage of the streaming pipeline spent working and how much it
+spent waiting on the stage before or after it, and how full the rings between them were on average.
+
+PARAMETERS
+const pipeline_stats* stats: Time added up by the stages
+double seconds: Wall clock time of the whole run
+*/
+void report_pipeline(const pipeline_stats* stats, double seconds);
+
+/*
+PURPOSE
+Allocates empty statistics for one run, for compress_options.stats or the decoders' stats parameter. Each thread of
+the pool adds up its own counters, so the run's threads have to be known in advance.
+
+PARAMETERS
+int decoding: 1 for a decoding run, 0 for an encoding run
+int threads: Threads of the run's pool, 1 to MAX_THREADS
+
+RETURN
+Pointer to the statistics, NULL if memory ran out
+*/
+run_stats* create_run_stats(int decoding, int threads);
+
+/*
+PURPOSE
+Frees statistics from create_run_stats.
+*/
+void free_run_stats(run_stats* stats);
+
+/*
+PURPOSE
+Prints the statistics of a run: bytes in and out, the entropy of the input against the bits per character achieved,
+the code lengths used and how many characters the decoder's table resolves in one lookup, then the time of each
+stage, thread and block. The same figures can be printed as one line of JSON, with every block's timing.
+
+PARAMETERS
+const run_stats* stats: Statistics filled in by the run
+int json: 1 for JSON, 0 for text
+FILE* out: Where to print
+*/
+void report_stats(const run_stats* stats, int json, FILE* out);
+
+//Code---------------------------------------------------------------------------------------------------------------------
+
+//The benchmark counts the allocations made by each stage. Only the program's allocations go through the counters,
+//and they only count while the benchmark runs, so library builds and the other modes pay nothing for them.
+static size_t allocationCount = 0;
+static int countAllocations = 0;
+
+#ifndef HUFFMAN_NO_MAIN
+static void* counted_malloc(size_t size)
+{
+    if(countAllocations)
+    {
+        allocationCount++;
+    }
+    return malloc(size);
+}
+
+static void* counted_calloc(size_t count, size_t size)
+{
+    if(countAllocations)
+    {
+        allocationCount++;
+    }
+    return calloc(count, size);
+}
+
+static void* counted_realloc(void* pointer, size_t size)
+{
+    if(countAllocations)
+    {
+        allocationCount++;
+    }
+    return realloc(pointer, size);
+}
+
+#define malloc(size) counted_malloc(size)
+#define calloc(count, size) counted_calloc(count, size)
+#define realloc(pointer, size) counted_realloc(pointer, size)
+#endif
+
+/*
+Monotonic wall clock time in nanoseconds, for the pipeline stages' timers.
+*/
+static uint64_t monotonic_nanos(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+//Thread of the pool running the current task, for the statistics: 0 for the thread that posted the batch, 1 on for
+//the workers
+static __thread int poolThread;
+
+#ifndef HUFFMAN_NO_MAIN
+/*
+Prints the statistics of a run to standard error, as text (-V) or JSON (-J), and frees them. Statistics that could not
+be allocated, or that a failed run never filled in, are only noted, as a JSON object with -J.
+*/
+static void finish_stats(run_stats* stats, int format)
+{
+    if(stats == NULL || stats->wallNanos == 0)
+    {
+        fprintf(stderr, format == 'J' ? "{\"error\":\"no statistics: the run failed or memory ran out\"}\n"
+                                      : "No statistics: the run failed or memory ran out.\n");
+    }
+    else
+    {
+        report_stats(stats, format == 'J', stderr);
+    }
+    if(stats != NULL)
+    {
+        free_run_stats(stats);
+    }
+}
+
+/*
+Reads the decimal number at the start of text into *value. Returns the character after it, or NULL if text does not
+start with a digit or the number is larger than max.
+*/
+static const char* parse_decimal(const char* text, uint64_t max, uint64_t* value)
+{
+    char* end;
+    if(*text < '0' || *text > '9')
+    {
+        return NULL;
+    }
+    errno = 0;
+    unsigned long long number = strtoull(text, &end, 10);
+    if(errno == ERANGE || number > max)
+    {
+        return NULL;
+    }
+    *value = number;
+    return end;
+}
+
+//Shailendra
+int main(int argc, char *argv[])
+{
+    //Turns standard output buffering off
+    setbuf(stdout, NULL);
+
+    //Tree building micro-benchmark instead of encoding a file
+    if(argc > 1 && strcmp(argv[1], "--bench-tree") == 0)
+    {
+        benchmark_tree_build();
+        return 0;
+    }
+
+    //Per-stage benchmark on generated input instead of encoding a file
+    if(argc > 1 && strcmp(argv[1], "--bench") == 0)
+    {
+        size_t maxSize = BENCH_DEFAULT_SIZE;
+        if(argc > 2)
+        {
+            long kilobytes = atol(argv[2]);
+            if(kilobytes < 1 || kilobytes > BENCH_MAX_SIZE / 1024)
+            {
+                printf("Usage: %s --bench [max kilobytes, 1 to %u]\n", argv[0], BENCH_MAX_SIZE / 1024);
+                return 1;
+            }
+            maxSize = (size_t)kilobytes * 1024;
+        }
+        benchmark_stages(maxSize);
+        return 0;
+    }
+
+    //Options
+    compress_options options;
+    options.threads = 1;
+    options.blockSize = DEFAULT_BLOCK_SIZE;
+    options.streams = 1;
+    options.checkpoints = 0;
+    options.effort = DEFAULT_EFFORT;
+    options.order1 = 0;
+    options.globalTable = 0;
+    options.globalLengths = NULL;
+    options.cache = NULL;
+    options.stats = NULL;
+    pipeline_stats pipelineStats;
+    memset(&pipelineStats, 0, sizeof(pipelineStats));
+    stream_io io;
+    io.uring = 0;
+    io.stats = NULL;
+    int mode = 0;    //'c' or 'd' to stream to standard output, 't' to train, 'A' or 'X' for archives, 'S' for the daemon, 0 for the encode and decode round trip
+    int adaptive = 0;
+    int words = 0;
+    const char* dictionaryPath = NULL;
+    const char* archivePath = NULL;
+    const char* daemonPath = NULL;
+    uint32_t dictionaryId = DICT_DEFAULT_ID;
+    uint64_t rangeOffset = 0;
+    uint64_t rangeLength = UINT64_MAX;
+    int statsFormat = 0;    //'V' to print the statistics report as text, 'J' as JSON, 0 for none
+
+    int option;
+    const char* end;    //Past the number parsed from an option's argument
+    uint64_t number;
+    while((option = getopt(argc, argv, "T:b:41gGacwdt:D:i:sr:e:uvVJA:X:S:C:")) != -1)
+    {
+        if(option == 'T' && atoi(optarg) >= 1 && atoi(optarg) <= MAX_THREADS)
+        {
+            options.threads = atoi(optarg);
+        }
+        else if(option == 'b' && atol(optarg) >= MIN_BLOCK_SIZE / 1024 && atol(optarg) <= MAX_BLOCK_SIZE / 1024)
+        {
+            options.blockSize = (size_t)atol(optarg) * 1024;
+        }
+        else if(option == '4')
+        {
+            options.streams = 4;
+        }
+        else if(option == 'c' || option == 'd')
+        {
+            mode = option;
+        }
+        else if(option == 'a')
+        {
+            adaptive = 1;
+        }
+        else if(option == 'w')
+        {
+            words = 1;
+        }
+        else if(option == 't' || option == 'D')
+        {
+            mode = option == 't' ? 't' : mode;
+            dictionaryPath = optarg;
+        }
+        else if(option == 'S' || option == 'C')
+        {
+            mode = option == 'S' ? 'S' : mode;
+            daemonPath = optarg;
+        }
+        else if(option == 'A' || option == 'X')
+        {
+            mode = option;
+            archivePath = optarg;
+        }
+        else if(option == 'i' && (end = parse_decimal(optarg, UINT32_MAX, &number)) != NULL && *end == '\0')
+        {
+            dictionaryId = (uint32_t)number;
+        }
+        else if(option == 'e' && optarg[0] >= '0' && optarg[0] <= '0' + MAX_EFFORT && optarg[1] == '\0')
+        {
+            options.effort = optarg[0] - '0';
+        }
+        else if(option == 's')
+        {
+            options.checkpoints = 1;
+        }
+        else if(option == '1')
+        {
+            options.order1 = 1;
+        }
+        else if(option == 'g' || option == 'G')
+        {
+            options.globalTable = option == 'g' ? GLOBAL_COUNTED : GLOBAL_SAMPLED;
+        }
+        else if(option == 'u')
+        {
+            io.uring = 1;
+        }
+        else if(option == 'v')
+        {
+            io.stats = &pipelineStats;
+        }
+        else if(option == 'V' || option == 'J')
+        {
+            statsFormat = option;
+        }
+        else if(option == 'r' && (end = parse_decimal(optarg, UINT64_MAX, &rangeOffset)) != NULL
+            && (*end == '\0' || (*end == ':' && (end = parse_decimal(end + 1, UINT64_MAX, &rangeLength)) != NULL
+            && *end == '\0' && rangeLength > 0)))
+        {
+            //offset:length, or just offset to read to the end
+            mode = 'r';
+        }
+        else
+        {
+            fprintf(stderr, "Usage: %s [-c | -d] [-T threads] [-b block kilobytes] [-e effort] [-4] [-1] [-s] [-g | -G] [-a | -w] [-u] [-v] [-V | -J] [-D dictionary] [file]\n", argv[0]);
+            fprintf(stderr, "       %s -r offset[:length] file\n", argv[0]);
+            fprintf(stderr, "       %s -t dictionary [-i id] sample files...\n", argv[0]);
+            fprintf(stderr, "       %s -A archive [-T threads] [-b block kilobytes] [-e effort] [-4] [-1] [-s] [-V | -J] files, directories or @list...\n", argv[0]);
+            fprintf(stderr, "       %s -X archive [-T threads] [-V | -J] [directory]\n", argv[0]);
+            fprintf(stderr, "       %s -S socket [-b block kilobytes] [-e effort] [-4] [-1] [-s]    (only its user may connect)\n", argv[0]);
+            fprintf(stderr, "       %s -C socket [-c | -d] [file]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    //Training, ranges and the daemon code nothing the statistics could describe
+    if(statsFormat != 0 && (mode == 't' || mode == 'r' || daemonPath != NULL))
+    {
+        fprintf(stderr, "ERROR --> -%c does not apply to -t, -r, -S or -C.\n", statsFormat);
+        return 1;
+    }
+
+    //Dictionary training: every operand is a sample file
+    if(mode == 't')
+    {
+        if(optind >= argc || !train_dictionary_file(dictionaryPath, dictionaryId, argv + optind, argc - optind))
+        {
+            fprintf(stderr, "ERROR --> Unable to train %s from the sample files.\n", dictionaryPath);
+            return 1;
+        }
+        return 0;
+    }
+
+    //Daemon: answers requests on a Unix domain socket until it is killed
+    if(mode == 'S')
+    {
+        return run_daemon(daemonPath, &options) ? 0 : 1;
+    }
+
+    //Client: the daemon does the work, so this process builds no tables; without -c or -d it asks for statistics
+    if(daemonPath != NULL)
+    {
+        if(!daemon_request(daemonPath, mode == 'c' || mode == 'd' ? mode : 's', optind < argc ? argv[optind] : NULL))
+        {
+            fprintf(stderr, "ERROR --> The daemon on %s did not complete the request.\n", daemonPath);
+            return 1;
+        }
+        return 0;
+    }
+
+    //Archive: every operand is a file, a directory to store whole, or @ and a file listing paths one per line
+    if(mode == 'A')
+    {
+        archive_list archiveList;
+        memset(&archiveList, 0, sizeof(archiveList));
+        int ok = optind < argc;
+        for(int i = optind; ok && i < argc; i++)
+        {
+            ok = archive_add_path(&archiveList, argv[i]);
+        }
+        output_sink* archiveOutput = ok ? open_sink(archivePath) : NULL;
+        options.stats = statsFormat != 0 ? create_run_stats(0, options.threads) : NULL;
+        ok = archiveOutput != NULL && compress_archive(&archiveList, archiveOutput, &options);
+        ok = archiveOutput != NULL && close_sink(archiveOutput) && ok;
+        free_archive_list(&archiveList);
+        if(statsFormat != 0)
+        {
+            finish_stats(options.stats, statsFormat);
+        }
+        if(!ok)
+        {
+            fprintf(stderr, "ERROR --> Unable to create %s.\n", archivePath);
+            return 1;
+        }
+        return 0;
+    }
+
+    //Files of an archive, recreated in the directory given, or the current one
+    if(mode == 'X')
+    {
+        input_span archiveInput;
+        if(!open_input(archivePath, &archiveInput))
+        {
+            fprintf(stderr, "NO FILE FOUND\n");
+            return 1;
+        }
+        //The directory is created if it is not there yet, like the directories inside the archive
+        if(optind < argc && ((mkdir(argv[optind], 0777) != 0 && errno != EEXIST) || chdir(argv[optind]) != 0))
+        {
+            fprintf(stderr, "ERROR --> Unable to create or enter the directory %s.\n", argv[optind]);
+            close_input(&archiveInput);
+            return 1;
+        }
+        int ok = 1;
+        run_stats* extractStats = statsFormat != 0 ? create_run_stats(1, options.threads) : NULL;
+        ok = ok && extract_archive(archiveInput.data, archiveInput.size, options.threads, extractStats);
+        close_input(&archiveInput);
+        if(statsFormat != 0)
+        {
+            finish_stats(extractStats, statsFormat);
+        }
+        if(!ok)
+        {
+            fprintf(stderr, "ERROR --> %s is not a valid archive, or its files could not be written.\n", archivePath);
+            return 1;
+        }
+        return 0;
+    }
+
+    //Part of an encoded file, which has to be a file so the blocks before the range can be skipped
+    if(mode == 'r')
+    {
+        input_span rangeInput;
+        if(optind >= argc || !open_input(argv[optind], &rangeInput))
+        {
+            fprintf(stderr, "NO FILE FOUND\n");
+            return 1;
+        }
+        //Word and adaptive files are one bitstream, with no blocks to skip
+        if(rangeInput.size >= HUF_HEADER_SIZE && memcmp(rangeInput.data, HUF_MAGIC, HUF_MAGIC_LEN) == 0
+            && (rangeInput.data[5] & (HUF_FLAG_WORDS | HUF_FLAG_ADAPTIVE)))
+        {
+            fprintf(stderr, "ERROR --> Ranges are not supported for %s files; decode %s with -d instead.\n",
+                (rangeInput.data[5] & HUF_FLAG_WORDS) ? "word" : "adaptive", argv[optind]);
+            close_input(&rangeInput);
+            return 1;
+        }
+        if(rangeInput.mapping != NULL)
+        {
+            madvise(rangeInput.mapping, rangeInput.size, MADV_RANDOM);
+        }
+        output_sink* rangeOutput = open_sink_fd(STDOUT_FILENO);
+        size_t decoded = rangeOutput != NULL ? decompress_range(rangeInput.data, rangeInput.size, rangeOffset, rangeLength, rangeOutput) : HUFFMAN_ERROR;
+        int ok = rangeOutput != NULL && close_sink(rangeOutput) && decoded != HUFFMAN_ERROR;
+        close_input(&rangeInput);
+        if(!ok)
+        {
+            fprintf(stderr, "ERROR --> %s is not a valid encoded file.\n", argv[optind]);
+            return 1;
+        }
+        if(decoded == 0)
+        {
+            fprintf(stderr, "ERROR --> Offset %llu is at or past the end of the original file of %s.\n", (unsigned long long)rangeOffset, argv[optind]);
+            return 1;
+        }
+        return 0;
+    }
+
+    //Records coded with a dictionary: one frame for the whole input
+    if(mode != 0 && dictionaryPath != NULL)
+    {
+        run_stats* dictionaryStats = statsFormat != 0 ? create_run_stats(mode == 'd', 1) : NULL;
+        int ok = dictionary_stream(mode, dictionaryPath, optind < argc ? argv[optind] : NULL, dictionaryStats);
+        if(statsFormat != 0)
+        {
+            finish_stats(dictionaryStats, statsFormat);
+        }
+        if(!ok)
+        {
+            fprintf(stderr, "ERROR --> Unable to %s the input with %s.\n", mode == 'c' ? "encode" : "decode", dictionaryPath);
+            return 1;
+        }
+        return 0;
+    }
+
+    //Words: the token dictionary comes before the first code, so the whole input is read first
+    if(mode == 'c' && words)
+    {
+        input_span wordInput;
+        if(!open_input(optind < argc ? argv[optind] : "/dev/stdin", &wordInput))
+        {
+            fprintf(stderr, "NO FILE FOUND\n");
+            return 1;
+        }
+        output_sink* wordOutput = open_sink_fd(STDOUT_FILENO);
+        run_stats* wordStats = statsFormat != 0 ? create_run_stats(0, 1) : NULL;
+        int ok = wordOutput != NULL && compress_words(wordInput.data, wordInput.size, wordOutput, wordStats);
+        ok = wordOutput != NULL && close_sink(wordOutput) && ok;
+        close_input(&wordInput);
+        if(statsFormat != 0)
+        {
+            finish_stats(wordStats, statsFormat);
+        }
+        if(!ok)
+        {
+            fprintf(stderr, "ERROR --> Unable to encode the input.\n");
+            return 1;
+        }
+        return 0;
+    }
+
+    //Global table: every block of the input is known before the first is coded, so the whole input is read first
+    if(mode == 'c' && options.globalTable != 0 && !adaptive)
+    {
+        input_span globalInput;
+        if(!open_input(optind < argc ? argv[optind] : "/dev/stdin", &globalInput))
+        {
+            fprintf(stderr, "NO FILE FOUND\n");
+            return 1;
+        }
+        uint64_t globalCounts[ALPHABET_SIZE];
+        output_sink* globalOutput = open_sink_fd(STDOUT_FILENO);
+        options.stats = statsFormat != 0 ? create_run_stats(0, options.threads) : NULL;
+        int ok = globalOutput != NULL && compress_file(globalInput.data, globalInput.size, globalOutput, &options, globalCounts);
+        ok = globalOutput != NULL && close_sink(globalOutput) && ok;
+        close_input(&globalInput);
+        if(statsFormat != 0)
+        {
+            finish_stats(options.stats, statsFormat);
+        }
+        if(!ok)
+        {
+            fprintf(stderr, "ERROR --> Unable to encode the input.\n");
+            return 1;
+        }
+        return 0;
+    }
+
+    //Streaming: the named file or standard input goes to standard output, and messages go to standard error
+    if(mode != 0)
+    {
+        int inputFd = optind < argc ? open(argv[optind], O_RDONLY) : STDIN_FILENO;
+        if(inputFd < 0)
+        {
+            fprintf(stderr, "NO FILE FOUND\n");
+            return 1;
+        }
+        //Reading, coding and writing overlap: a reader thread and a writer thread sit on either side of the coder
+        uint64_t streamStart = monotonic_nanos();
+        output_sink* streamOutput = open_sink_pipelined(STDOUT_FILENO, &io);
+        if(streamOutput == NULL)
+        {
+            fprintf(stderr, "ERROR --> Not enough memory.\n");
+            return 1;
+        }
+
+        int ok;
+        run_stats* streamStats = statsFormat != 0 ? create_run_stats(mode == 'd', options.threads) : NULL;
+        options.stats = streamStats;
+        if(mode == 'c')
+        {
+            ok = adaptive ? compress_adaptive(inputFd, streamOutput, streamStats) : compress_stream(inputFd, streamOutput, &options, &io);
+        }
+        else
+        {
+            ok = decompress_stream(inputFd, streamOutput, options.threads, &io, streamStats);
+        }
+        ok = close_sink(streamOutput) && ok;
+        if(io.stats != NULL)
+        {
+            report_pipeline(io.stats, (double)(monotonic_nanos() - streamStart) / 1e9);
+        }
+        if(statsFormat != 0)
+        {
+            finish_stats(streamStats, statsFormat);
+        }
+        if(inputFd != STDIN_FILENO)
+        {
+            close(inputFd);
+        }
+        if(!ok)
+        {
+            fprintf(stderr, mode == 'c' ? "ERROR --> Unable to encode the input.\n" : "ERROR --> The input is not a valid encoded file.\n");
+            return 1;
+        }
+        return 0;
+    }
+
+    //File name from the command line, otherwise prompt for it
+    char file_name[264];
+    if(optind < argc)
+    {
+        snprintf(file_name, sizeof(file_name), "%s", argv[optind]);
+    }
+    else
+    {
+        printf("Enter file name you would like to encode: ");
+        if(scanf("%263s", file_name) != 1)
+        {
+            return 1;
+        }
+    }
+
+    //To store execution time of code
+    double timeSpent = 0.0;
+
+    //Start clock
+    clock_t beginTime = clock();
+
+    //Open input file, once, for both counting and encoding
+    input_span encodeInput;
+
+    //Crash program if file was not found
+    if(!open_input(file_name, &encodeInput))
+    {
+        printf("NO FILE FOUND");
+        exit(0);
+    }
+
+    //Create output file
+    output_sink* encodeOutput = open_sink("encodeOutput.dat");
+    if(encodeOutput == NULL)
+    {
+        printf("ERROR --> Unable to create encodeOutput.dat");
+        exit(0);
+    }
+
+    //Encode the input message into the output file, block by block
+    uint64_t counts[ALPHABET_SIZE];
+    options.stats = statsFormat != 0 ? create_run_stats(0, options.threads) : NULL;
+    if(!compress_file(encodeInput.data, encodeInput.size, encodeOutput, &options, counts))
+    {
+        printf("ERROR --> Not enough memory to encode the file.");
+        exit(0);
+    }
+
+    //Calculate number of unique characters
+    int uniqueCharacters = 0;
+    for(int i = 0; i < ALPHABET_SIZE; i++)
+    {
+        uniqueCharacters += counts[i] != 0;
+    }
+
+    //Print number of unique characters
+    printf("Unique Characters: %d\n", uniqueCharacters);
+
+    //Close input and output
+    close_input(&encodeInput);
+    if(!close_sink(encodeOutput))
+    {
+        printf("ERROR --> Unable to write encodeOutput.dat");
+        exit(0);
+    }
+
+    //Open decode files
+    input_span decodeInput;
+    output_sink* decodeOutput = open_sink("decodeOutput.txt");
+    if(!open_input("encodeOutput.dat", &decodeInput) || decodeOutput == NULL)
+    {
+        printf("ERROR --> Unable to open decode files");
+        exit(0);
+    }
+
+    //Decode input using only what is stored in the encoded file
+    run_stats* decodeStats = statsFormat != 0 ? create_run_stats(1, options.threads) : NULL;
+    if(!decompress_file(decodeInput.data, decodeInput.size, decodeOutput, options.threads, decodeStats))
+    {
+        printf("ERROR --> encodeOutput.dat is not a valid encoded file.\n");
+    }
+
+    //Close decode files
+    close_input(&decodeInput);
+    if(!close_sink(decodeOutput))
+    {
+        printf("ERROR --> Unable to write decodeOutput.txt");
+    }
+
+    //End clock
+    clock_t endTime = clock();
+
+    //Calculate elapsed time by finding difference (end - begin) and dividing the difference by CLOCKS_PER_SEC to convert to seconds
+    timeSpent += (double)(endTime - beginTime) / CLOCKS_PER_SEC;
+
+    //Print execution time
+    printf("Encoding and decoding time was %f seconds", timeSpent);
+    printf("\nEND! \n");
+
+    //Statistics of both halves, if asked for
+    if(statsFormat != 0)
+    {
+        finish_stats(options.stats, statsFormat);
+        finish_stats(decodeStats, statsFormat);
+    }
+
+    //Return Statement, everything has been freed
+    return 0;
+
+}
+#endif
+
+//Adam
+int node_compare(const tree_node *n1, const tree_node *n2) {
+    int rtrn;
+    if (n1->frequency > n2->frequency) {
+        rtrn = 1;
+    }
+    else if (n1->frequency < n2->frequency) {
+        rtrn = -1;
+    }
+    else {
+        rtrn = 0;
+    }
+    return rtrn;
+}
+
+//Adam
+uint16_t node_combine (pq* pq_main, uint16_t n1, uint16_t n2) {
+    // The new node goes to the end of the node array, which is the back of the combined queue
+    uint16_t parent = (uint16_t)pq_main->nodeCount++;
+    pq_main->nodes[parent].value = 0;
+    pq_main->nodes[parent].frequency = pq_main->nodes[n1].frequency + pq_main->nodes[n2].frequency;
+    pq_main->nodes[parent].left = n1;
+    pq_main->nodes[parent].right = n2;
+    return parent;
+}
+
+//Adam
+uint16_t pq_remove_min(pq* pq_main) {
+    int leavesLeft = pq_main->leafHead < pq_main->leafCount;
+    int combinedLeft = pq_main->combinedHead < pq_main->nodeCount;
+
+    if (leavesLeft && (!combinedLeft || node_compare(&pq_main->nodes[pq_main->leafHead], &pq_main->nodes[pq_main->combinedHead]) <= 0)) {
+        return (uint16_t)pq_main->leafHead++;
+    }
+    if (combinedLeft) {
+        return (uint16_t)pq_main->combinedHead++;
+    }
+    return NO_NODE; // queue is empty
+}
+
+//Adam
+uint16_t huffman_process(pq* pq_main) { // takes the priority queue as input, outputs the root of the completed Huffman Tree
+    // n leaves need n - 1 combines; each combined node goes to the back of the combined queue, which stays
+    // sorted since every combine is at least as large as the one before it
+    for (int i = 1; i < pq_main->leafCount; i++) {
+        uint16_t smallest = pq_remove_min(pq_main);
+        uint16_t second_smallest = pq_remove_min(pq_main);
+        node_combine(pq_main, smallest, second_smallest); //create an interior node with combined frequencies
+    }
+
+    return pq_remove_min(pq_main); // this is the root of the completed Huffman Tree
+}
+
+huffman_arena* create_arena(int maxLeaves)
+{
+    //One allocation: the arena, then the tree nodes, then the table nodes. Both node types are 16 bytes, so every
+    //array stays aligned.
+    size_t treeNodes = (size_t)(2 * maxLeaves - 1);
+    huffman_arena* arena = malloc(sizeof(huffman_arena) + treeNodes * sizeof(tree_node) + (size_t)maxLeaves * sizeof(table_node));
+    if(arena == NULL)
+    {
+        return NULL;
+    }
+
+    arena->treeNodes = (tree_node*)(arena + 1);
+    arena->tableNodes = (table_node*)(arena->treeNodes + treeNodes);
+    arena->maxLeaves = maxLeaves;
+    arena->split = NULL;
+    arena->contexts = NULL;
+    arena->stageNanos = NULL;
+    reset_arena(arena);
+    return arena;
+}
+
+void reset_arena(huffman_arena* arena)
+{
+    arena->valueTable.nodes = arena->tableNodes;
+    arena->valueTable.count = 0;
+    arena->queue.nodes = arena->treeNodes;
+    arena->queue.leafHead = 0;
+    arena->queue.leafCount = 0;
+    arena->queue.combinedHead = 0;
+    arena->queue.nodeCount = 0;
+}
+
+void free_arena(huffman_arena* arena)
+{
+    free(arena->split);
+    free(arena->contexts);
+    free(arena);
+}
+
+//Shailendra
+table* create_table(huffman_arena* arena)
+{
+    //The table's nodes are the arena's table nodes
+    table* valueTable = &arena->valueTable;
+
+    //Initialize values
+    valueTable->nodes = arena->tableNodes;
+    valueTable->count = 0;
+
+    //Return table pointer
+    return valueTable;
+}
+
+//Shailendra
+table_node* create_table_node(table* t, char value, uint64_t freq)
+{
+    //Next free node at the end of the table
+    table_node* newNode = &t->nodes[t->count++];
+
+    //Initialize data
+    newNode->value = value;
+    newNode->frequency = freq;
+    newNode->length = 0;
+    newNode->code = 0;
+
+    //Return new pointer
+    return newNode;
+}
+
+/*
+Writes the code length table, then src coded with "codes" as 1 or 4 bitstreams. Returns the payload size.
+*/
+static size_t encode_with_codes(const code_entry codes[], const unsigned char lengths[], const unsigned char* src, size_t srcSize, unsigned char* dst, int streams){
+    // Code length table first, so the block can be decoded on its own
+    size_t size = write_code_lengths(lengths, dst);
+
+    if(streams == 1)
+        return size + encode_buffer(codes, src, srcSize, dst + size);
+
+    // One bitstream per quarter, back to back after the jump table. Each stream's slack bytes are overwritten by the
+    // stream after it.
+    unsigned char* jumpTable = dst + size;
+    size += STREAM_JUMP_TABLE_SIZE;
+    size_t segment = (srcSize + 3) / 4;
+    for(int k = 0; k < 4; k++){
+        size_t start = k * segment < srcSize ? k * segment : srcSize;
+        size_t end = start + segment < srcSize ? start + segment : srcSize;
+        size_t streamSize = encode_buffer(codes, src + start, end - start, dst + size);
+        if(k < 3)
+            store_u32_le(jumpTable + 4 * k, (uint32_t)streamSize);
+        size += streamSize;
+    }
+    return size;
+}
+
+size_t encode(table* t, const unsigned char lengths[], const unsigned char* src, size_t srcSize, unsigned char* dst, int streams){ // Made by Riley
+    code_entry codes[ALPHABET_SIZE];
+
+    // Direct-indexed code table for the kernel. The table was counted from src, so every character has a code.
+    memset(codes, 0, sizeof(codes));
+    for(int i = 0; i < t->count; i++){
+        codes[(unsigned char)t->nodes[i].value].code = t->nodes[i].code;
+        codes[(unsigned char)t->nodes[i].value].length = t->nodes[i].length;
+    }
+    return encode_with_codes(codes, lengths, src, srcSize, dst, streams);
+}
+
+/*
+The encoding kernel behind encode_buffer. If "missing" is not NULL, every code length less one is ORed into it, so
+bit 31 ends up set if a character had no code. With NULL the check is compiled out.
+*/
+static inline size_t encode_symbols(const code_entry codes[], const unsigned char* src, size_t srcSize, unsigned char* dst, uint32_t* missing){
+    unsigned char* start = dst;
+    uint64_t bits = 0;    // Pending bits, left aligned: the next bit to be written is bit 63
+    unsigned int count = 0;    // Number of pending bits, always less than 8 between symbols
+    size_t i = 0;
+
+    // Add one code to the accumulator
+#define PUT_SYMBOL(c) do {                                              \
+        const code_entry e = codes[(c)];                                \
+        if(missing != NULL)                                             \
+            *missing |= e.length - 1;                                   \
+        count += e.length;                                              \
+        bits |= (uint64_t)e.code << (64 - count);                       \
+    } while(0)
+
+    // Store the whole word and keep only the bits of the last partial byte
+#define FLUSH_BITS() do {                                               \
+        store_u64_be(dst, bits);                                        \
+        dst += count >> 3;                                              \
+        bits <<= count & ~7u;                                           \
+        count &= 7;                                                     \
+    } while(0)
+
+    for(; i + 4 <= srcSize; i += 4){    // 7 leftover bits plus 4 codes of up to MAX_CODE_LEN bits fit in 64
+        PUT_SYMBOL(src[i]);
+        PUT_SYMBOL(src[i + 1]);
+        PUT_SYMBOL(src[i + 2]);
+        PUT_SYMBOL(src[i + 3]);
+        FLUSH_BITS();
+    }
+    for(; i < srcSize; i++){
+        PUT_SYMBOL(src[i]);
+        FLUSH_BITS();
+    }
+#undef PUT_SYMBOL
+#undef FLUSH_BITS
+
+    if(count > 0){    // Last partial byte, the rest of it is already zero
+        store_u64_be(dst, bits);
+        dst++;
+    }
+    return (size_t)(dst - start);
+}
+
+size_t encode_buffer(const code_entry codes[], const unsigned char* src, size_t srcSize, unsigned char* dst){
+    return encode_symbols(codes, src, srcSize, dst, NULL);
+}
+
+/*
+Finds the code lengths, bitstreams and checkpoint table of a block payload. A global block takes its code lengths
+from "globalLengths", which is NULL if the file has no global table. Returns 1 if they all fit in the payload.
+*/
+static int parse_block(const unsigned char* payload, size_t payloadSize, size_t rawSize, unsigned char type, const unsigned char* globalLengths, block_layout* layout){
+    size_t tableSize = 0;
+    if((type & BLOCK_TYPE_MASK) == BLOCK_GLOBAL){
+        if(globalLengths == NULL)
+            return 0;
+        memcpy(layout->lengths, globalLengths, ALPHABET_SIZE);
+    }
+    else if((tableSize = read_code_lengths(payload, payloadSize, layout->lengths)) == 0)
+        return 0;
+    size_t remaining = payloadSize - tableSize;
+
+    // The checkpoint table is at the end, one entry per CHECKPOINT_INTERVAL bytes after the first
+    layout->checkpoints = NULL;
+    if(type & BLOCK_FLAG_CHECKPOINTS){
+        size_t checkpointSize = rawSize > 0 ? (rawSize - 1) / CHECKPOINT_INTERVAL * 4 : 0;
+        if(checkpointSize > remaining)
+            return 0;
+        remaining -= checkpointSize;
+        layout->checkpoints = payload + tableSize + remaining;
+    }
+
+    // The bitstreams are in between, found from the jump table when there are 4
+    layout->streams = (type & BLOCK_FLAG_FOUR_STREAMS) ? 4 : 1;
+    const unsigned char* position = payload + tableSize;
+    if(layout->streams == 4){
+        if(remaining < STREAM_JUMP_TABLE_SIZE)
+            return 0;
+        position += STREAM_JUMP_TABLE_SIZE;
+        remaining -= STREAM_JUMP_TABLE_SIZE;
+    }
+    for(int k = 0; k < layout->streams; k++){
+        size_t size = k < layout->streams - 1 ? load_u32_le(payload + tableSize + 4 * k) : remaining;
+        if(size > remaining)
+            return 0;
+        layout->stream[k] = position;
+        layout->streamSize[k] = size;
+        position += size;
+        remaining -= size;
+    }
+    return 1;
+}
+
+//Riley
+/*
+Decodes one block payload using "dt" for its tables. Shared by decode, which keeps the tables on the stack, and the
+library, which keeps them in its context. "globalLengths" is the file's global table, NULL if it has none. With a
+cache, tables built for the same code lengths before are copied instead of built again.
+*/
+static int decode_payload(decode_table* dt, table_cache* cache, const unsigned char* globalLengths, const unsigned char* payload, size_t payloadSize, unsigned char* dst, size_t dstSize, unsigned char type){
+    block_layout layout;
+
+    // Raw and RLE blocks need no tables, only a copy or a fill
+    if((type & BLOCK_TYPE_MASK) == BLOCK_RAW){
+        if(payloadSize != dstSize)
+            return 0;
+        memcpy(dst, payload, dstSize);
+        return 1;
+    }
+    if((type & BLOCK_TYPE_MASK) == BLOCK_RLE){
+        if(payloadSize != 1)
+            return 0;
+        memset(dst, payload[0], dstSize);
+        return 1;
+    }
+    if((type & BLOCK_TYPE_MASK) == BLOCK_ORDER1)
+        return decode_order1(payload, payloadSize, dst, dstSize);
+
+    if(!parse_block(payload, payloadSize, dstSize, type, globalLengths, &layout))
+        return 0;
+
+    // Build the lookup tables from the code lengths alone
+    if(cache != NULL ? !cached_decode_table(cache, layout.lengths, dt) : !build_decode_table(layout.lengths, dt))
+        return 0;
+
+    if(layout.streams == 1)
+        return decode_buffer(dt, layout.stream[0], layout.streamSize[0], dst, dstSize);
+    return decode_buffer_4(dt, layout.stream, layout.streamSize, dst, dstSize);
+}
+
+//Riley
+int decode(const unsigned char* payload, size_t payloadSize, unsigned char* dst, size_t dstSize, unsigned char type){ 
+    decode_table dt;
+    return decode_payload(&dt, NULL, NULL, payload, payloadSize, dst, dstSize, type);
+}
+
+/*
+Stores the checkpoint table of a block at dst: for every CHECKPOINT_INTERVAL bytes into the block, the bit offset of
+that byte's code in the bitstream that holds it. Returns the number of bytes stored.
+*/
+static size_t store_checkpoints(const unsigned char lengths[], const unsigned char* src, size_t srcSize, int streams, unsigned char* dst){
+    size_t segment = streams == 4 ? (srcSize + 3) / 4 : srcSize;
+    size_t nextSegment = segment;
+    size_t nextCheckpoint = CHECKPOINT_INTERVAL;
+    uint32_t bits = 0;    // At most 12 bits for each of 2^28 bytes, so it fits
+    size_t size = 0;
+
+    // Add up code lengths to the next segment start or checkpoint, whichever comes first
+    for(size_t i = 0; i < srcSize;){
+        size_t stop = nextSegment < nextCheckpoint ? nextSegment : nextCheckpoint;
+        stop = stop < srcSize ? stop : srcSize;
+        for(; i < stop; i++)
+            bits += lengths[src[i]];
+        if(i == nextSegment){
+            bits = 0;
+            nextSegment += segment;
+        }
+        if(i == nextCheckpoint && i < srcSize){
+            store_u32_le(dst + size, bits);
+            size += 4;
+            nextCheckpoint += CHECKPOINT_INTERVAL;
+        }
+    }
+    return size;
+}
+
+size_t block_bound(size_t size){
+    // Every block split off adds a header, a code length table, a jump table and up to 4 partly filled bytes
+    size_t blocks = 1 + size / SPLIT_MIN_CHUNK;
+    return blocks * (BLOCK_HEADER_SIZE + CODE_LENGTHS_MAX_SIZE + STREAM_JUMP_TABLE_SIZE + 4) + (size * MAX_CODE_LEN + 7) / 8
+        + size / CHECKPOINT_INTERVAL * 4 + HUF_WRITE_SLACK;
+}
+
+/*
+Writes src as a raw block. Returns the number of bytes written.
+*/
+static size_t store_raw_block(const unsigned char* src, size_t srcSize, unsigned char* dst){
+    store_u32_le(dst, (uint32_t)srcSize);
+    store_u32_le(dst + 4, (uint32_t)srcSize);
+    dst[8] = BLOCK_RAW;
+    memcpy(dst + BLOCK_HEADER_SIZE, src, srcSize);
+    return BLOCK_HEADER_SIZE + srcSize;
+}
+
+/*
+Builds the table, tree and code lengths of a histogram in the arena, replacing whatever the arena held before.
+Returns the table, which has the codes filled in.
+*/
+static table* histogram_to_lengths(huffman_arena* arena, const uint64_t counts[], unsigned char lengths[]){
+    reset_arena(arena);
+    table* valueTable = histogram_to_table(arena, counts);
+    pq* huffmanQueue = table_to_queue(arena, valueTable);
+    uint16_t huffmanTree = huffman_process(huffmanQueue);
+    assign_codes_to_table(huffmanQueue->nodes, huffmanTree, valueTable, lengths);
+    return valueTable;
+}
+
+/*
+Plans an order-1 block in the arena's context workspace. A context gets a table of its own when its characters are
+estimated to cost less that way, code length table included, than with codes made for the whole block; the other
+contexts share one table built from their combined counts. Returns the exact size of the order-1 payload, or 0 if
+memory ran out.
+*/
+static size_t plan_order1_block(const unsigned char* src, size_t srcSize, const uint64_t counts[], huffman_arena* arena){
+    if(arena->contexts == NULL && (arena->contexts = malloc(sizeof(context_workspace))) == NULL)
+        return 0;
+    context_workspace* w = arena->contexts;
+
+    // Only the characters in the block (and 0, before the first) can be contexts, so only their rows are touched
+    int used[ALPHABET_SIZE];
+    for(int x = 0; x < ALPHABET_SIZE; x++){
+        used[x] = x == 0 || counts[x] != 0;
+        if(used[x])
+            memset(w->counts[x], 0, sizeof(w->counts[x]));
+    }
+    unsigned char previous = 0;
+    for(size_t i = 0; i < srcSize; i++){
+        w->counts[previous][src[i]]++;
+        previous = src[i];
+    }
+
+    // Decide which contexts get a table of their own
+    uint64_t shared[ALPHABET_SIZE];
+    int own[ALPHABET_SIZE];
+    int ownCount = 0;
+    int sharedUsed = 0;
+    memset(shared, 0, sizeof(shared));
+    for(int x = 0; x < ALPHABET_SIZE; x++){
+        uint64_t context[ALPHABET_SIZE];
+        uint64_t total = 0;
+        own[x] = 0;
+        if(!used[x])
+            continue;
+        for(int c = 0; c < ALPHABET_SIZE; c++)
+            total += context[c] = w->counts[x][c];
+        if(total == 0)
+            continue;
+        own[x] = estimate_block_bits(context) - 8.0 * BLOCK_HEADER_SIZE < estimate_cross_bits(context, counts);
+        ownCount += own[x];
+        if(!own[x]){
+            sharedUsed = 1;
+            for(int c = 0; c < ALPHABET_SIZE; c++)
+                shared[c] += context[c];
+        }
+    }
+
+    // The shared table, if any contexts use it, is table 0. Unused contexts point at table 0 too.
+    w->tableCount = sharedUsed + ownCount;
+    int next = sharedUsed;
+    for(int x = 0; x < ALPHABET_SIZE; x++)
+        w->tableOf[x] = own[x] ? (unsigned char)next++ : 0;
+
+    // Build every table and add up the exact payload size
+    size_t tableBytes = 1 + ALPHABET_SIZE;
+    uint64_t bits = 0;
+    for(int t = 0; t < w->tableCount; t++){
+        uint64_t histogram[ALPHABET_SIZE];
+        unsigned int codes[ALPHABET_SIZE];
+        int x = 0;
+        if(t == 0 && sharedUsed)
+            memcpy(histogram, shared, sizeof(histogram));
+        else{
+            while(w->tableOf[x] != t || !own[x])
+                x++;
+            for(int c = 0; c < ALPHABET_SIZE; c++)
+                histogram[c] = w->counts[x][c];
+        }
+        histogram_to_lengths(arena, histogram, w->lengths[t]);
+        compute_canonical_codes(w->lengths[t], codes);
+        int present = 0;
+        for(int c = 0; c < ALPHABET_SIZE; c++){
+            w->codes[t][c].code = codes[c];
+            w->codes[t][c].length = w->lengths[t][c];
+            bits += histogram[c] * w->lengths[t][c];
+            present += w->lengths[t][c] != 0;
+        }
+        tableBytes += ALPHABET_SIZE / 8 + (size_t)(present + 1) / 2;
+    }
+    return tableBytes + (size_t)((bits + 7) / 8);
+}
+
+/*
+Order-1 version of encode_buffer: each character is coded with the table of the character before it.
+*/
+static size_t encode_buffer_order1(const context_workspace* w, const unsigned char* src, size_t srcSize, unsigned char* dst){
+    unsigned char* start = dst;
+    uint64_t bits = 0;
+    unsigned int count = 0;
+    unsigned char previous = 0;
+    size_t i = 0;
+
+#define PUT_SYMBOL(c) do {                                              \
+        const code_entry e = w->codes[w->tableOf[previous]][(c)];       \
+        count += e.length;                                              \
+        bits |= (uint64_t)e.code << (64 - count);                       \
+        previous = (c);                                                 \
+    } while(0)
+
+#define FLUSH_BITS() do {                                               \
+        store_u64_be(dst, bits);                                        \
+        dst += count >> 3;                                              \
+        bits <<= count & ~7u;                                           \
+        count &= 7;                                                     \
+    } while(0)
+
+    for(; i + 4 <= srcSize; i += 4){
+        PUT_SYMBOL(src[i]);
+        PUT_SYMBOL(src[i + 1]);
+        PUT_SYMBOL(src[i + 2]);
+        PUT_SYMBOL(src[i + 3]);
+        FLUSH_BITS();
+    }
+    for(; i < srcSize; i++){
+        PUT_SYMBOL(src[i]);
+        FLUSH_BITS();
+    }
+#undef PUT_SYMBOL
+#undef FLUSH_BITS
+
+    if(count > 0){
+        store_u64_be(dst, bits);
+        dst++;
+    }
+    return (size_t)(dst - start);
+}
+
+/*
+Writes the order-1 block planned by plan_order1_block. Returns the number of bytes written.
+*/
+static size_t store_order1_block(const unsigned char* src, size_t srcSize, unsigned char* dst, const context_workspace* w){
+    unsigned char* payload = dst + BLOCK_HEADER_SIZE;
+    size_t size = 0;
+    payload[size++] = (unsigned char)(w->tableCount - 1);
+    memcpy(payload + size, w->tableOf, ALPHABET_SIZE);
+    size += ALPHABET_SIZE;
+    for(int t = 0; t < w->tableCount; t++)
+        size += write_code_lengths(w->lengths[t], payload + size);
+    size += encode_buffer_order1(w, src, srcSize, payload + size);
+
+    store_u32_le(dst, (uint32_t)srcSize);
+    store_u32_le(dst + 4, (uint32_t)size);
+    dst[8] = BLOCK_ORDER1;
+    return BLOCK_HEADER_SIZE + size;
+}
+
+/*
+Like encode, for code lengths that come without a table, such as those found in a table cache: the canonical codes
+are worked out from the lengths.
+*/
+static size_t encode_with_lengths(const unsigned char lengths[], const unsigned char* src, size_t srcSize, unsigned char* dst, int streams){
+    code_entry codes[ALPHABET_SIZE];
+    unsigned int canonical[ALPHABET_SIZE];
+    compute_canonical_codes(lengths, canonical);
+    for(int c = 0; c < ALPHABET_SIZE; c++){
+        codes[c].code = canonical[c];
+        codes[c].length = lengths[c];
+    }
+    return encode_with_codes(codes, lengths, src, srcSize, dst, streams);
+}
+
+/*
+Time at which a stage of a block starts, if statistics are on. Without them the clock is not read.
+*/
+static inline uint64_t stage_start(const huffman_arena* arena){
+    return arena->stageNanos != NULL ? monotonic_nanos() : 0;
+}
+
+/*
+Adds the time since "start" to a stage of the block, if statistics are on.
+*/
+static inline void stage_end(huffman_arena* arena, int stage, uint64_t start){
+    if(arena->stageNanos != NULL)
+        arena->stageNanos[stage] += monotonic_nanos() - start;
+}
+
+/*
+Codes one block whose histogram is already counted, as whichever block type suits it. For a huffman block this
+builds its tree and codes, then writes the block header and payload. Returns the number of bytes written.
+*/
+static size_t encode_block(const unsigned char* src, size_t srcSize, unsigned char* dst, const uint64_t counts[], const compress_options* options, huffman_arena* arena){
+    unsigned char lengths[ALPHABET_SIZE];
+    double bits;
+
+    // A single character is stored once, and data huffman cannot shrink is stored as it is
+    int type = choose_block_type(counts, &bits);
+    if(type == BLOCK_RLE){
+        store_u32_le(dst, (uint32_t)srcSize);
+        store_u32_le(dst + 4, 1);
+        dst[8] = BLOCK_RLE;
+        dst[BLOCK_HEADER_SIZE] = src[0];
+        return BLOCK_HEADER_SIZE + 1;
+    }
+    if(type == BLOCK_RAW)
+        return store_raw_block(src, srcSize, dst);
+
+    // A daemon reuses the code lengths of an earlier block with the same shape of histogram, if they still fit.
+    // Otherwise each block gets its own table, tree and codes, built in the arena left over from the last block.
+    uint64_t start = stage_start(arena);
+    table* valueTable = NULL;
+    int cached = options->cache != NULL && !options->order1 && cached_code_lengths(options->cache, counts, bits, lengths);
+    if(!cached)
+        valueTable = histogram_to_lengths(arena, counts, lengths);
+    if(!cached && options->cache != NULL && !options->order1)
+        store_code_lengths(options->cache, counts, bits, lengths);
+
+    // With -1, order-1 tables are used when their exact size beats the order-0 bitstream and its code lengths by
+    // enough to pay for the slower decoding
+    if(options->order1){
+        uint64_t order0Bits = 0;
+        int present = 0;
+        for(int c = 0; c < ALPHABET_SIZE; c++){
+            order0Bits += counts[c] * lengths[c];
+            present += lengths[c] != 0;
+        }
+        size_t order0Size = ALPHABET_SIZE / 8 + (size_t)(present + 1) / 2 + (size_t)((order0Bits + 7) / 8);
+        size_t order1Size = plan_order1_block(src, srcSize, counts, arena);
+        if(order1Size != 0 && order1Size < order0Size - order0Size / ORDER1_MIN_SAVING && order1Size < srcSize){
+            stage_end(arena, STAGE_TABLES, start);
+            return store_order1_block(src, srcSize, dst, arena->contexts);
+        }
+        valueTable = histogram_to_lengths(arena, counts, lengths);    // The planner built its tables in the arena
+    }
+    stage_end(arena, STAGE_TABLES, start);
+
+    size_t payloadSize = cached ? encode_with_lengths(lengths, src, srcSize, dst + BLOCK_HEADER_SIZE, options->streams)
+        : encode(valueTable, lengths, src, srcSize, dst + BLOCK_HEADER_SIZE, options->streams);
+    if(options->checkpoints)
+        payloadSize += store_checkpoints(lengths, src, srcSize, options->streams, dst + BLOCK_HEADER_SIZE + payloadSize);
+    if(payloadSize >= srcSize)    // The estimate was wrong, but a block never grows past its header
+        return store_raw_block(src, srcSize, dst);
+    store_u32_le(dst, (uint32_t)srcSize);
+    store_u32_le(dst + 4, (uint32_t)payloadSize);
+    dst[8] = BLOCK_HUFFMAN | (options->streams == 4 ? BLOCK_FLAG_FOUR_STREAMS : 0) | (options->checkpoints ? BLOCK_FLAG_CHECKPOINTS : 0);
+    return BLOCK_HEADER_SIZE + payloadSize;
+}
+
+/*
+Bits saved by coding the segment that starts at chunk "first" together with the segment after it.
+*/
+static double merge_saving(const split_workspace* split, uint16_t first){
+    uint64_t merged[ALPHABET_SIZE];
+    uint16_t second = split->next[first];
+    for(int c = 0; c < ALPHABET_SIZE; c++)
+        merged[c] = (uint64_t)split->counts[first][c] + split->counts[second][c];
+    double bits;
+    choose_block_type(merged, &bits);
+    return split->bits[first] + split->bits[second] - bits;
+}
+
+/*
+Cuts src into chunks, smaller at higher efforts, then merges neighbouring segments for as long as a merge saves bits,
+the one that saves most first. Merging from the bottom up finds a shift between two long stretches that a single
+left to right pass would blur. Leaves the segments as a list through next[] from chunk 0 and returns the chunk size.
+*/
+static size_t split_block(split_workspace* split, const unsigned char* src, size_t srcSize, int effort){
+    size_t chunk = SPLIT_CHUNK_SIZE >> (2 * (effort - 1));
+    if(chunk < (srcSize + SPLIT_MAX_CHUNKS - 1) / SPLIT_MAX_CHUNKS)
+        chunk = (srcSize + SPLIT_MAX_CHUNKS - 1) / SPLIT_MAX_CHUNKS;
+    uint16_t chunks = (uint16_t)((srcSize + chunk - 1) / chunk);
+
+    // Every chunk starts as a segment of its own
+    for(uint16_t i = 0; i < chunks; i++){
+        uint64_t counts[ALPHABET_SIZE];
+        size_t start = i * chunk;
+        memset(counts, 0, sizeof(counts));
+        count_frequencies(src + start, srcSize - start < chunk ? srcSize - start : chunk, counts);
+        for(int c = 0; c < ALPHABET_SIZE; c++)
+            split->counts[i][c] = (uint32_t)counts[c];
+        choose_block_type(counts, &split->bits[i]);
+        split->next[i] = (uint16_t)(i + 1);
+        split->previous[i] = i > 0 ? (uint16_t)(i - 1) : NO_NODE;
+    }
+    for(uint16_t i = 0; i + 1 < chunks; i++)
+        split->saving[i] = merge_saving(split, i);
+
+    for(;;){
+        uint16_t best = NO_NODE;
+        for(uint16_t i = 0; i < chunks && split->next[i] < chunks; i = split->next[i])
+            if(split->saving[i] > 0 && (best == NO_NODE || split->saving[i] > split->saving[best]))
+                best = i;
+        if(best == NO_NODE)
+            break;
+
+        // The segment after "best" joins it, and the savings on either side of the merged segment change
+        uint16_t second = split->next[best];
+        for(int c = 0; c < ALPHABET_SIZE; c++)
+            split->counts[best][c] += split->counts[second][c];
+        split->bits[best] += split->bits[second] - split->saving[best];
+        split->next[best] = split->next[second];
+        if(split->next[best] < chunks){
+            split->previous[split->next[best]] = best;
+            split->saving[best] = merge_saving(split, best);
+        }
+        if(split->previous[best] != NO_NODE)
+            split->saving[split->previous[best]] = merge_saving(split, split->previous[best]);
+    }
+    return chunk;
+}
+
+/*
+Codes one block with the file's global table, without counting it first. Returns the number of bytes written, or 0
+if the block has a character the table has no code for (the table was built from a sample that missed it) or does
+not shrink, and so needs to be coded on its own.
+*/
+static size_t encode_global_block(const unsigned char* src, size_t srcSize, unsigned char* dst, const compress_options* options){
+    const unsigned char* lengths = options->globalLengths;
+    code_entry codes[ALPHABET_SIZE];
+    unsigned int canonical[ALPHABET_SIZE];
+    compute_canonical_codes(lengths, canonical);
+    for(int c = 0; c < ALPHABET_SIZE; c++){
+        codes[c].code = canonical[c];
+        codes[c].length = lengths[c];
+    }
+
+    // Laid out like encode(), without the code lengths
+    unsigned char* payload = dst + BLOCK_HEADER_SIZE;
+    uint32_t missing = 0;
+    size_t payloadSize = 0;
+    if(options->streams == 1)
+        payloadSize = encode_symbols(codes, src, srcSize, payload, &missing);
+    else{
+        size_t segment = (srcSize + 3) / 4;
+        payloadSize = STREAM_JUMP_TABLE_SIZE;
+        for(int k = 0; k < 4; k++){
+            size_t start = k * segment < srcSize ? k * segment : srcSize;
+            size_t end = start + segment < srcSize ? start + segment : srcSize;
+            size_t streamSize = encode_symbols(codes, src + start, end - start, payload + payloadSize, &missing);
+            if(k < 3)
+                store_u32_le(payload + 4 * k, (uint32_t)streamSize);
+            payloadSize += streamSize;
+        }
+    }
+    if((missing >> 31) != 0 || payloadSize >= srcSize)
+        return 0;
+
+    if(options->checkpoints)
+        payloadSize += store_checkpoints(lengths, src, srcSize, options->streams, payload + payloadSize);
+    if(payloadSize >= srcSize)
+        return 0;
+    store_u32_le(dst, (uint32_t)srcSize);
+    store_u32_le(dst + 4, (uint32_t)payloadSize);
+    dst[8] = BLOCK_GLOBAL | (options->streams == 4 ? BLOCK_FLAG_FOUR_STREAMS : 0) | (options->checkpoints ? BLOCK_FLAG_CHECKPOINTS : 0);
+    return BLOCK_HEADER_SIZE + payloadSize;
+}
+
+size_t compress_block(const unsigned char* src, size_t srcSize, unsigned char* dst, uint64_t counts[], const compress_options* options, huffman_arena* arena, size_t* blockCount){
+    memset(counts, 0, ALPHABET_SIZE * sizeof(uint64_t));
+
+    // With a global table the block is not counted at all, unless the table turns out not to fit it
+    if(options->globalLengths != NULL){
+        size_t size = encode_global_block(src, srcSize, dst, options);
+        if(size != 0){
+            *blockCount = 1;
+            return size;
+        }
+    }
+
+    // The splitter's state stays with the arena once allocated. Without it, the block is coded whole.
+    if(options->effort > 0 && arena->split == NULL)
+        arena->split = malloc(sizeof(split_workspace));
+    uint64_t start = stage_start(arena);
+    if(options->effort == 0 || arena->split == NULL){
+        count_frequencies(src, srcSize, counts);
+        stage_end(arena, STAGE_HISTOGRAM, start);
+        *blockCount = 1;
+        return encode_block(src, srcSize, dst, counts, options, arena);
+    }
+
+    // Each segment becomes a block, coded from the histogram the splitter already counted
+    split_workspace* split = arena->split;
+    size_t chunk = split_block(split, src, srcSize, options->effort);
+    stage_end(arena, STAGE_HISTOGRAM, start);
+    size_t chunks = (srcSize + chunk - 1) / chunk;
+    size_t size = 0;
+    *blockCount = 0;
+    for(uint16_t i = 0; i < chunks; i = split->next[i]){
+        uint64_t segmentCounts[ALPHABET_SIZE];
+        for(int c = 0; c < ALPHABET_SIZE; c++){
+            segmentCounts[c] = split->counts[i][c];
+            counts[c] += segmentCounts[c];
+        }
+        size_t start = i * chunk;
+        size_t end = split->next[i] * chunk < srcSize ? split->next[i] * chunk : srcSize;
+        size += encode_block(src + start, end - start, dst + size, segmentCounts, options, arena);
+        (*blockCount)++;
+    }
+    return size;
+}
+
+static double entropy_bits(const uint64_t counts[]);
+
+/*
+Adds one written block to a thread's statistics: its type, its characters (from "raw", its original bytes) and, for
+a huffman or global block, the code length each character was coded with.
+*/
+static void add_block_stats(thread_stats* stats, unsigned char type, const unsigned char* raw, size_t rawSize, const unsigned char* payload, size_t payloadSize, const unsigned char* globalLengths){
+    uint64_t counts[ALPHABET_SIZE];
+    memset(counts, 0, sizeof(counts));
+    count_frequencies(raw, rawSize, counts);
+    for(int c = 0; c < ALPHABET_SIZE; c++)
+        stats->counts[c] += counts[c];
+    stats->blockEntropyBits += entropy_bits(counts);
+    stats->typeBlocks[type & BLOCK_TYPE_MASK]++;
+    stats->typeBytes[type & BLOCK_TYPE_MASK] += rawSize;
+
+    block_layout layout;
+    if((type & BLOCK_TYPE_MASK) != BLOCK_HUFFMAN && (type & BLOCK_TYPE_MASK) != BLOCK_GLOBAL)
+        return;
+    if(!parse_block(payload, payloadSize, rawSize, type, globalLengths, &layout))
+        return;
+    for(int c = 0; c < ALPHABET_SIZE; c++){
+        if(counts[c] == 0 || layout.lengths[c] > MAX_CODE_LEN)
+            continue;
+        stats->lengthSymbols[layout.lengths[c]] += counts[c];
+        if(layout.lengths[c] > stats->maxLength)
+            stats->maxLength = layout.lengths[c];
+    }
+}
+
+/*
+Adds the timing of one block of input to the run's records, which are kept in input order. Memory running out only
+stops the records; the report says so.
+*/
+static void record_block(run_stats* stats, uint64_t offset, size_t rawSize, size_t encodedSize, uint64_t nanos, int thread){
+    if(stats->recordCount == stats->recordCapacity){
+        size_t capacity = stats->recordCapacity > 0 ? stats->recordCapacity * 2 : 256;
+        block_record* grown = realloc(stats->records, capacity * sizeof(block_record));
+        if(grown == NULL){
+            stats->failed = 1;
+            return;
+        }
+        stats->records = grown;
+        stats->recordCapacity = capacity;
+    }
+    block_record* record = &stats->records[stats->recordCount++];
+    record->offset = offset;
+    record->rawSize = (uint32_t)rawSize;
+    record->encodedSize = (uint32_t)encodedSize;
+    record->nanos = nanos;
+    record->thread = thread;
+}
+
+/*
+Adds "symbols" coded with a code of "length" bits to a thread's statistics.
+*/
+static void count_code_length(thread_stats* stats, unsigned int length, uint64_t symbols){
+    if(length > STATS_MAX_CODE_LEN)
+        length = STATS_MAX_CODE_LEN;
+    stats->lengthSymbols[length] += symbols;
+    if((int)length > stats->maxLength)
+        stats->maxLength = (int)length;
+}
+
+/*
+Adds the time since "since" to a stage of a run coded as one bitstream, and returns the time now, when the next stage
+starts.
+*/
+static uint64_t lap_stage(run_stats* stats, int stage, uint64_t since){
+    uint64_t now = monotonic_nanos();
+    stats->threads[0].stageNanos[stage] += now - since;
+    return now;
+}
+
+/*
+Fills in the totals of a run coded as one bitstream. Word, adaptive and dictionary files have no blocks or block
+tables, so only the characters, code lengths and stage times of the first thread were counted.
+*/
+static void finish_bitstream_stats(run_stats* stats, int coding, uint64_t originalBytes, uint64_t encodedBytes, uint64_t startNanos){
+    stats->coding = coding;
+    stats->threadCount = 1;
+    stats->originalBytes = originalBytes;
+    stats->encodedBytes = encodedBytes;
+    stats->wallNanos = monotonic_nanos() - startNanos;
+    stats->threads[0].nanos = stats->wallNanos;
+}
+
+//One block of a batch being compressed
+typedef struct compress_job
+{
+    const unsigned char* src;             ///< Bytes of the block
+    size_t srcSize;                       ///< Number of bytes in src
+    unsigned char* dst;                   ///< Compressed block, block_bound(blockSize) bytes
+    size_t dstSize;                       ///< Number of bytes written to dst
+    size_t blockCount;                    ///< Number of blocks written to dst, more than 1 if the block was split
+    uint64_t counts[ALPHABET_SIZE];       ///< Character counts of the block
+    const compress_options* options;      ///< Options shared by every block
+    huffman_arena* arena;                 ///< Table and tree storage, reused by every block of this slot
+    uint64_t nanos;                       ///< With statistics on, time taken to compress the block
+    int thread;                           ///< With statistics on, thread of the pool that compressed it
+} compress_job;
+
+static void compress_task(void* context, size_t index){
+    compress_job* job = (compress_job*)context + index;
+    run_stats* stats = job->options->stats;
+    if(stats == NULL){
+        job->dstSize = compress_block(job->src, job->srcSize, job->dst, job->counts, job->options, job->arena, &job->blockCount);
+        return;
+    }
+
+    // Timed stage by stage into this thread's statistics. Whatever the histogram and tables did not take was
+    // encoding. The blocks written are then looked at again, outside the timing, for their types and code lengths.
+    thread_stats* own = &stats->threads[poolThread];
+    uint64_t analysis = own->stageNanos[STAGE_HISTOGRAM] + own->stageNanos[STAGE_TABLES];
+    uint64_t start = monotonic_nanos();
+    job->arena->stageNanos = own->stageNanos;
+    job->dstSize = compress_block(job->src, job->srcSize, job->dst, job->counts, job->options, job->arena, &job->blockCount);
+    job->arena->stageNanos = NULL;
+    job->nanos = monotonic_nanos() - start;
+    job->thread = poolThread;
+    analysis = own->stageNanos[STAGE_HISTOGRAM] + own->stageNanos[STAGE_TABLES] - analysis;
+    own->stageNanos[STAGE_ENCODE] += job->nanos > analysis ? job->nanos - analysis : 0;
+    own->nanos += job->nanos;
+    own->jobs++;
+
+    size_t at = 0;
+    size_t rawAt = 0;
+    for(size_t b = 0; b < job->blockCount; b++){
+        const unsigned char* header = job->dst + at;
+        add_block_stats(own, header[8], job->src + rawAt, load_u32_le(header), header + BLOCK_HEADER_SIZE, load_u32_le(header + 4), job->options->globalLengths);
+        rawAt += load_u32_le(header);
+        at += BLOCK_HEADER_SIZE + load_u32_le(header + 4);
+    }
+}
+
+/*
+Stores the HUF_HEADER_SIZE byte file header: magic, version, flags, original size.
+*/
+static void store_file_header(unsigned char* dst, uint64_t originalSize, unsigned char flags){
+    memcpy(dst, HUF_MAGIC, HUF_MAGIC_LEN);
+    dst[4] = HUF_FORMAT_VERSION;
+    dst[5] = flags;
+    store_u64_le(dst + 6, originalSize);
+}
+
+/*
+Stores the HUF_FOOTER_SIZE byte footer: index offset, block count, footer magic.
+*/
+static void store_file_footer(unsigned char* dst, uint64_t indexOffset, size_t blockCount){
+    store_u64_le(dst, indexOffset);
+    store_u32_le(dst + 8, (uint32_t)blockCount);
+    memcpy(dst + 12, HUF_FOOTER_MAGIC, 4);
+}
+
+/*
+Writes the file header to a sink.
+*/
+static void write_file_header(output_sink* output, uint64_t originalSize, unsigned char flags){
+    unsigned char header[HUF_HEADER_SIZE];
+    store_file_header(header, originalSize, flags);
+    sink_write(output, header, HUF_HEADER_SIZE);
+}
+
+/*
+Writes the end of blocks marker, an archive's file table (if "table" is not NULL), the index (if "offsets" is not
+NULL), then the footer that points back at the index. "position" is where the marker goes.
+*/
+static void write_file_end(output_sink* output, uint64_t position, const unsigned char* offsets, size_t blockCount, const unsigned char* table, size_t tableSize){
+    unsigned char footer[BLOCK_HEADER_SIZE + HUF_FOOTER_SIZE];
+    memset(footer, 0, BLOCK_HEADER_SIZE);
+    store_file_footer(footer + BLOCK_HEADER_SIZE, offsets != NULL ? position + BLOCK_HEADER_SIZE + tableSize : 0, blockCount);
+    sink_write(output, footer, BLOCK_HEADER_SIZE);
+    if(table != NULL)
+        sink_write(output, table, tableSize);
+    if(offsets != NULL)
+        sink_write(output, offsets, blockCount * 8);
+    sink_write(output, footer + BLOCK_HEADER_SIZE, HUF_FOOTER_SIZE);
+}
+
+//One thread's slice of the input while the global table's histogram is counted
+typedef struct histogram_job
+{
+    const unsigned char* src;             ///< First byte of the slice
+    size_t srcSize;                       ///< Number of bytes in the slice
+    size_t stride;                        ///< Distance between the pieces counted when sampling, 0 to count every byte
+    uint64_t counts[ALPHABET_SIZE];       ///< Character counts of the slice
+} histogram_job;
+
+static void histogram_task(void* context, size_t index){
+    histogram_job* job = (histogram_job*)context + index;
+    if(job->stride == 0){
+        count_frequencies(job->src, job->srcSize, job->counts);
+        return;
+    }
+    for(size_t at = 0; at < job->srcSize; at += job->stride)
+        count_frequencies(job->src + at, job->srcSize - at < SAMPLE_CHUNK_SIZE ? job->srcSize - at : SAMPLE_CHUNK_SIZE, job->counts);
+}
+
+/*
+Counts the histogram the global table is built from, each thread counting a slice of src into a histogram of its
+own, which are then added up. With GLOBAL_SAMPLED only pieces of SAMPLE_CHUNK_SIZE bytes spread evenly through src
+are counted; inputs too small to sample are counted whole. Returns 0 if memory ran out.
+*/
+static int count_global_histogram(thread_pool* pool, int threads, const unsigned char* src, size_t srcSize, int mode, uint64_t counts[]){
+    size_t stride = 0;
+    size_t pieces = srcSize / SAMPLE_CHUNK_SIZE / SAMPLE_EVERY;
+    if(mode == GLOBAL_SAMPLED && pieces > 0)
+        stride = srcSize / (pieces < SAMPLE_MAX_CHUNKS ? pieces : SAMPLE_MAX_CHUNKS);
+
+    // Slices start on a piece when sampling, and on a cache line otherwise
+    size_t unit = stride != 0 ? stride : 64;
+    size_t slice = (srcSize / unit + (size_t)threads - 1) / (size_t)threads * unit;
+    if(slice == 0)
+        slice = srcSize;
+    size_t jobCount = (srcSize + slice - 1) / slice;
+    histogram_job* jobs = calloc(jobCount, sizeof(histogram_job));
+    if(jobs == NULL)
+        return 0;
+    for(size_t i = 0; i < jobCount; i++){
+        jobs[i].src = src + i * slice;
+        jobs[i].srcSize = i + 1 < jobCount ? slice : srcSize - i * slice;
+        jobs[i].stride = stride;
+    }
+
+    pool_run(pool, histogram_task, jobs, jobCount);
+
+    memset(counts, 0, ALPHABET_SIZE * sizeof(uint64_t));
+    for(size_t i = 0; i < jobCount; i++)
+        for(int c = 0; c < ALPHABET_SIZE; c++)
+            counts[c] += jobs[i].counts[c];
+    free(jobs);
+    return 1;
+}
+
+/*
+Writes a compressed job's blocks at "position", adding where each starts to the index at *offsets, which is grown as
+needed. Returns 0 if memory ran out.
+*/
+static int write_indexed_job(output_sink* output, const compress_job* job, uint64_t* position, unsigned char** offsets, size_t* offsetsCapacity, size_t* written){
+    if(*written + job->blockCount > *offsetsCapacity){
+        unsigned char* grown = realloc(*offsets, (*written + job->blockCount) * 2 * 8);
+        if(grown == NULL)
+            return 0;
+        *offsets = grown;
+        *offsetsCapacity = (*written + job->blockCount) * 2;
+    }
+    size_t at = 0;
+    for(size_t b = 0; b < job->blockCount; b++){
+        store_u64_le(*offsets + (*written)++ * 8, *position + at);
+        at += BLOCK_HEADER_SIZE + load_u32_le(job->dst + at + 4);
+    }
+    sink_write(output, job->dst, job->dstSize);
+    *position += job->dstSize;
+    return 1;
+}
+
+int compress_file(const unsigned char* src, size_t srcSize, output_sink* output, const compress_options* options, uint64_t counts[]){
+    uint64_t startNanos = options->stats != NULL ? monotonic_nanos() : 0;
+    uint64_t startWritten = output->written;
+    size_t blockCount = (srcSize + options->blockSize - 1) / options->blockSize;
+    size_t batchSize = (size_t)options->threads * 2;    // Enough blocks to keep every thread busy, in bounded memory
+    if(batchSize > blockCount)
+        batchSize = blockCount > 0 ? blockCount : 1;
+
+    // The index has an entry for every block written, which is more than blockCount when blocks are split
+    size_t written = 0;
+    size_t offsetsCapacity = blockCount + 1;
+    thread_pool* pool = create_pool(options->threads);
+    compress_job* jobs = calloc(batchSize, sizeof(compress_job));
+    unsigned char* offsets = malloc(offsetsCapacity * 8);
+    int ok = pool != NULL && jobs != NULL && offsets != NULL;
+    for(size_t i = 0; ok && i < batchSize; i++){
+        jobs[i].dst = malloc(block_bound(options->blockSize));
+        jobs[i].arena = create_arena(ALPHABET_SIZE);
+        ok = jobs[i].dst != NULL && jobs[i].arena != NULL;
+    }
+
+    // With -g or -G the whole file is counted (or sampled) first, and blocks share one table built from that. Input
+    // with fewer than 2 distinct characters is left to RLE blocks.
+    compress_options blockOptions = *options;
+    unsigned char globalLengths[ALPHABET_SIZE];
+    int present = 0;
+    blockOptions.globalLengths = NULL;
+    memset(counts, 0, ALPHABET_SIZE * sizeof(uint64_t));
+    if(ok && options->globalTable != 0 && srcSize > 0){
+        jobs[0].arena->stageNanos = options->stats != NULL ? options->stats->threads[poolThread].stageNanos : NULL;
+        uint64_t start = stage_start(jobs[0].arena);
+        ok = count_global_histogram(pool, options->threads, src, srcSize, options->globalTable, counts);
+        stage_end(jobs[0].arena, STAGE_HISTOGRAM, start);
+        for(int c = 0; ok && c < ALPHABET_SIZE; c++)
+            present += counts[c] != 0;
+        if(present > 1){
+            start = stage_start(jobs[0].arena);
+            histogram_to_lengths(jobs[0].arena, counts, globalLengths);
+            stage_end(jobs[0].arena, STAGE_TABLES, start);
+            blockOptions.globalLengths = globalLengths;
+        }
+        jobs[0].arena->stageNanos = NULL;
+    }
+
+    write_file_header(output, srcSize, blockOptions.globalLengths != NULL ? HUF_FLAG_GLOBAL_TABLE : 0);
+    uint64_t position = HUF_HEADER_SIZE;
+    if(blockOptions.globalLengths != NULL){
+        unsigned char lengthTable[CODE_LENGTHS_MAX_SIZE];
+        size_t tableSize = write_code_lengths(globalLengths, lengthTable);
+        sink_write(output, lengthTable, tableSize);
+        position += tableSize;
+    }
+
+    for(size_t first = 0; ok && first < blockCount; first += batchSize){
+        size_t batch = blockCount - first < batchSize ? blockCount - first : batchSize;
+        for(size_t i = 0; i < batch; i++){
+            size_t start = (first + i) * options->blockSize;
+            jobs[i].src = src + start;
+            jobs[i].options = &blockOptions;
+            jobs[i].srcSize = srcSize - start < options->blockSize ? srcSize - start : options->blockSize;
+        }
+
+        pool_run(pool, compress_task, jobs, batch);
+
+        // Written in order, remembering where each block starts for the index
+        for(size_t i = 0; ok && i < batch; i++){
+            ok = write_indexed_job(output, &jobs[i], &position, &offsets, &offsetsCapacity, &written);
+            for(int c = 0; options->globalTable == 0 && c < ALPHABET_SIZE; c++)    // Else counted already
+                counts[c] += jobs[i].counts[c];
+            if(options->stats != NULL)
+                record_block(options->stats, (uint64_t)(first + i) * options->blockSize, jobs[i].srcSize, jobs[i].dstSize, jobs[i].nanos, jobs[i].thread);
+        }
+    }
+
+    if(ok)
+        write_file_end(output, position, offsets, written, NULL, 0);
+    if(options->stats != NULL){
+        options->stats->originalBytes = srcSize;
+        options->stats->encodedBytes = output->written - startWritten;
+        options->stats->wallNanos = monotonic_nanos() - startNanos;
+    }
+
+    for(size_t i = 0; jobs != NULL && i < batchSize; i++){
+        free(jobs[i].dst);
+        if(jobs[i].arena != NULL)
+            free_arena(jobs[i].arena);
+    }
+    free(jobs);
+    free(offsets);
+    if(pool != NULL)
+        destroy_pool(pool);
+    return ok;
+}
+
+/*
+Reads until "size" bytes are in dst or the input ends. Returns the number of bytes read, or -1 if reading failed.
+*/
+static ssize_t read_full(int fd, unsigned char* dst, size_t size){
+    size_t total = 0;
+    while(total < size){
+        ssize_t got = read(fd, dst + total, size - total);
+        if(got < 0)
+            return -1;
+        if(got == 0)
+            break;
+        total += (size_t)got;
+    }
+    return (ssize_t)total;
+}
+
+int compress_stream(int fd, output_sink* output, const compress_options* options, const stream_io* io){
+    uint64_t startNanos = options->stats != NULL ? monotonic_nanos() : 0;
+    uint64_t startWritten = output->written;
+    size_t batchSize = (size_t)options->threads * 2;
+    size_t windowSize = batchSize * options->blockSize;    // Each buffer of the reader's ring holds one batch
+
+    thread_pool* pool = create_pool(options->threads);
+    compress_job* jobs = calloc(batchSize, sizeof(compress_job));
+    io_pipe* input = open_reader(fd, windowSize, READ_SLOTS, 0, io);
+    int ok = pool != NULL && jobs != NULL && input != NULL;
+    for(size_t i = 0; ok && i < batchSize; i++){
+        jobs[i].dst = malloc(block_bound(options->blockSize));
+        jobs[i].arena = create_arena(ALPHABET_SIZE);
+        ok = jobs[i].dst != NULL && jobs[i].arena != NULL;
+    }
+
+    // The original size is not known yet, so the header says there is no index
+    write_file_header(output, 0, HUF_FLAG_NO_INDEX);
+    uint64_t position = HUF_HEADER_SIZE;
+    uint64_t original = 0;
+    size_t blockCount = 0;
+
+    // Take the window the reader filled, compress it as a batch of blocks while the reader fills the next, write
+    // them, repeat. A window that is not filled is the last.
+    int last = 0;
+    while(ok && !last){
+        size_t got;
+        const unsigned char* window = pipe_acquire(input, &got);
+        if(window == NULL){
+            ok = 0;
+            break;
+        }
+        last = got < windowSize;
+        size_t batch = (got + options->blockSize - 1) / options->blockSize;
+        for(size_t i = 0; i < batch; i++){
+            size_t start = i * options->blockSize;
+            jobs[i].src = window + start;
+            jobs[i].options = options;
+            jobs[i].srcSize = got - start < options->blockSize ? got - start : options->blockSize;
+        }
+
+        pool_run(pool, compress_task, jobs, batch);
+        pipe_release(input);
+
+        for(size_t i = 0; i < batch; i++){
+            if(options->stats != NULL)
+                record_block(options->stats, original, jobs[i].srcSize, jobs[i].dstSize, jobs[i].nanos, jobs[i].thread);
+            sink_write(output, jobs[i].dst, jobs[i].dstSize);
+            position += jobs[i].dstSize;
+            blockCount += jobs[i].blockCount;
+            original += jobs[i].srcSize;
+        }
+    }
+
+    if(ok)
+        write_file_end(output, position, NULL, blockCount, NULL, 0);
+    if(options->stats != NULL){
+        options->stats->originalBytes = original;
+        options->stats->encodedBytes = output->written - startWritten;
+        options->stats->wallNanos = monotonic_nanos() - startNanos;
+    }
+
+    for(size_t i = 0; jobs != NULL && i < batchSize; i++){
+        free(jobs[i].dst);
+        if(jobs[i].arena != NULL)
+            free_arena(jobs[i].arena);
+    }
+    free(jobs);
+    if(input != NULL)
+        close_reader(input);
+    if(pool != NULL)
+        destroy_pool(pool);
+    return ok;
+}
+
+//One block being decompressed
+typedef struct decompress_job
+{
+    const unsigned char* payload;         ///< Block payload
+    size_t payloadSize;                   ///< Number of bytes in payload
+    unsigned char* dst;                   ///< Where the block goes in the output
+    size_t dstSize;                       ///< Number of bytes in the original block
+    unsigned char type;                   ///< Block type from the block header
+    const unsigned char* globalLengths;   ///< Code lengths of the file's global table, NULL if it has none
+    int ok;                               ///< Set if the block decoded
+    run_stats* stats;                     ///< Where the block adds up its statistics, NULL if nobody asked
+    uint64_t nanos;                       ///< With statistics on, time taken to decode the block
+    int thread;                           ///< With statistics on, thread of the pool that decoded it
+} decompress_job;
+
+static void decompress_task(void* context, size_t index){
+    decompress_job* job = (decompress_job*)context + index;
+    decode_table dt;
+    if(job->stats == NULL){
+        job->ok = decode_payload(&dt, NULL, job->globalLengths, job->payload, job->payloadSize, job->dst, job->dstSize, job->type);
+        return;
+    }
+
+    thread_stats* own = &job->stats->threads[poolThread];
+    uint64_t start = monotonic_nanos();
+    job->ok = decode_payload(&dt, NULL, job->globalLengths, job->payload, job->payloadSize, job->dst, job->dstSize, job->type);
+    job->nanos = monotonic_nanos() - start;
+    job->thread = poolThread;
+    own->stageNanos[STAGE_DECODE] += job->nanos;
+    own->nanos += job->nanos;
+    own->jobs++;
+    if(job->ok)
+        add_block_stats(own, job->type, job->dst, job->dstSize, job->payload, job->payloadSize, job->globalLengths);
+}
+
+/*
+Reads the global code length table that follows the header of a file with HUF_FLAG_GLOBAL_TABLE into "lengths".
+"srcSize" is where the blocks must end. Returns the offset of the first block, HUF_HEADER_SIZE for a file without
+the table, or 0 if the table is invalid.
+*/
+static size_t load_global_table(const unsigned char* src, size_t srcSize, unsigned char lengths[]){
+    if((src[5] & HUF_FLAG_GLOBAL_TABLE) == 0)
+        return HUF_HEADER_SIZE;
+    size_t tableSize = read_code_lengths(src + HUF_HEADER_SIZE, srcSize - HUF_HEADER_SIZE, lengths);
+    return tableSize != 0 ? HUF_HEADER_SIZE + tableSize : 0;
+}
+
+int decompress_file(const unsigned char* src, size_t srcSize, output_sink* output, int threads, run_stats* stats){
+    // Check the header and footer before trusting anything in them
+    if(srcSize < HUF_HEADER_SIZE + BLOCK_HEADER_SIZE + HUF_FOOTER_SIZE)
+        return 0;
+    if(memcmp(src, HUF_MAGIC, HUF_MAGIC_LEN) != 0 || src[4] != HUF_FORMAT_VERSION || (src[5] & (HUF_FLAG_ADAPTIVE | HUF_FLAG_WORDS)))
+        return 0;
+    const unsigned char* footer = src + srcSize - HUF_FOOTER_SIZE;
+    if(memcmp(footer + 12, HUF_FOOTER_MAGIC, 4) != 0)
+        return 0;
+    int noIndex = (src[5] & HUF_FLAG_NO_INDEX) != 0;
+    uint64_t originalSize = load_u64_le(src + 6);
+    uint64_t indexOffset = load_u64_le(footer);
+    size_t blockCount = load_u32_le(footer + 8);
+    uint64_t blocksEnd = indexOffset;    // Blocks, and the end of blocks marker, come before this offset
+    if(noIndex){
+        // Streamed: the blocks are found one after another instead of through the index
+        if(indexOffset != 0 || originalSize != 0)
+            return 0;
+        blocksEnd = srcSize - HUF_FOOTER_SIZE;
+        originalSize = SIZE_MAX - HUF_WRITE_SLACK;    // Only a limit until the blocks have been added up
+    }
+    else if(indexOffset < HUF_HEADER_SIZE + BLOCK_HEADER_SIZE || indexOffset > srcSize - HUF_FOOTER_SIZE
+        || (srcSize - HUF_FOOTER_SIZE - indexOffset) / 8 != blockCount || (srcSize - HUF_FOOTER_SIZE - indexOffset) % 8 != 0)
+        return 0;
+    if(originalSize > SIZE_MAX - HUF_WRITE_SLACK || blockCount > (srcSize - HUF_HEADER_SIZE) / BLOCK_HEADER_SIZE)
+        return 0;
+    unsigned char globalLengths[ALPHABET_SIZE];
+    size_t blocksStart = load_global_table(src, blocksEnd, globalLengths);
+    if(blocksStart == 0 || blocksStart > blocksEnd - BLOCK_HEADER_SIZE)
+        return 0;
+
+    decompress_job* jobs = malloc((blockCount > 0 ? blockCount : 1) * sizeof(decompress_job));
+    thread_pool* pool = create_pool(threads);
+    int ok = jobs != NULL && pool != NULL;
+
+    // Find every block, through the index or by walking from the header
+    uint64_t rawOffset = 0;
+    uint64_t offset = blocksStart;
+    for(size_t i = 0; ok && i < blockCount; i++){
+        if(!noIndex)
+            offset = load_u64_le(src + indexOffset + i * 8);
+        if(offset < blocksStart || offset > blocksEnd - BLOCK_HEADER_SIZE){
+            ok = 0;
+            break;
+        }
+        uint32_t rawSize = load_u32_le(src + offset);
+        uint32_t payloadSize = load_u32_le(src + offset + 4);
+        unsigned char type = src[offset + 8];
+        if(rawSize == 0 || payloadSize > blocksEnd - offset - BLOCK_HEADER_SIZE || rawSize > originalSize - rawOffset
+            || (type & BLOCK_TYPE_MASK) > BLOCK_GLOBAL){
+            ok = 0;
+            break;
+        }
+        jobs[i].payload = src + offset + BLOCK_HEADER_SIZE;
+        jobs[i].payloadSize = payloadSize;
+        jobs[i].dstSize = rawSize;
+        jobs[i].type = type;
+        jobs[i].globalLengths = blocksStart != HUF_HEADER_SIZE ? globalLengths : NULL;
+        jobs[i].stats = stats;
+        rawOffset += rawSize;
+        offset += BLOCK_HEADER_SIZE + payloadSize;
+    }
+    if(noIndex)
+        originalSize = rawOffset;
+    ok = ok && rawOffset == originalSize;
+
+    // Give every block its place in the output
+    unsigned char* dst = ok ? sink_reserve(output, (size_t)originalSize) : NULL;
+    ok = ok && dst != NULL;
+    rawOffset = 0;
+    for(size_t i = 0; ok && i < blockCount; i++){
+        jobs[i].dst = dst + rawOffset;
+        rawOffset += jobs[i].dstSize;
+    }
+
+    uint64_t startNanos = stats != NULL ? monotonic_nanos() : 0;
+    if(ok){
+        pool_run(pool, decompress_task, jobs, blockCount);
+        for(size_t i = 0; i < blockCount; i++)
+            ok = ok && jobs[i].ok;
+    }
+    if(ok)
+        sink_commit(output, (size_t)originalSize);
+    for(size_t i = 0; ok && stats != NULL && i < blockCount; i++)
+        record_block(stats, (uint64_t)(jobs[i].dst - dst), jobs[i].dstSize, BLOCK_HEADER_SIZE + jobs[i].payloadSize, jobs[i].nanos, jobs[i].thread);
+    if(ok && stats != NULL){
+        stats->originalBytes = originalSize;
+        stats->encodedBytes = srcSize;
+        stats->wallNanos = monotonic_nanos() - startNanos;
+    }
+
+    free(jobs);
+    if(pool != NULL)
+        destroy_pool(pool);
+    return ok;
+}
+
+int decompress_stream(int fd, output_sink* output, int threads, const stream_io* io, run_stats* stats){
+    unsigned char header[HUF_HEADER_SIZE];
+    if(read_full(fd, header, HUF_HEADER_SIZE) != HUF_HEADER_SIZE)
+        return 0;
+    if(memcmp(header, HUF_MAGIC, HUF_MAGIC_LEN) != 0 || header[4] != HUF_FORMAT_VERSION)
+        return 0;
+    if(header[5] & HUF_FLAG_ADAPTIVE)
+        return decompress_adaptive(fd, output, stats);
+    if(header[5] & HUF_FLAG_WORDS)
+        return decompress_words(fd, header, output, stats);
+    uint64_t startNanos = stats != NULL ? monotonic_nanos() : 0;
+    uint64_t consumed = HUF_HEADER_SIZE;    // Bytes of the encoded file read, for the statistics
+
+    // Everything after the header comes through a reader thread, which reads ahead while blocks are decoded
+    io_pipe* input = open_reader(fd, PIPE_CHUNK_SIZE, PIPE_MAX_SLOTS, 1, io);
+    if(input == NULL)
+        return 0;
+
+    // The global table's bitmap says how many nibbles of code lengths follow it
+    unsigned char lengthTable[CODE_LENGTHS_MAX_SIZE];
+    unsigned char globalLengths[ALPHABET_SIZE];
+    int ok = 1;
+    if(header[5] & HUF_FLAG_GLOBAL_TABLE){
+        size_t present = 0;
+        ok = pipe_read(input, lengthTable, ALPHABET_SIZE / 8) == ALPHABET_SIZE / 8;
+        for(int i = 0; ok && i < ALPHABET_SIZE / 8; i++)
+            present += (size_t)__builtin_popcount(lengthTable[i]);
+        size_t nibbleBytes = (present + 1) / 2;
+        ok = ok && pipe_read(input, lengthTable + ALPHABET_SIZE / 8, nibbleBytes) == (ssize_t)nibbleBytes
+            && read_code_lengths(lengthTable, ALPHABET_SIZE / 8 + nibbleBytes, globalLengths) != 0;
+        consumed += ALPHABET_SIZE / 8 + nibbleBytes;
+    }
+
+    size_t batchSize = (size_t)threads * 2;
+    thread_pool* pool = create_pool(threads);
+    decompress_job* jobs = calloc(batchSize, sizeof(decompress_job));
+    unsigned char** payloads = calloc(batchSize, sizeof(unsigned char*));    // Grown to the largest payload seen
+    size_t* capacities = calloc(batchSize, sizeof(size_t));
+    ok = ok && pool != NULL && jobs != NULL && payloads != NULL && capacities != NULL;
+
+    // Read a batch of blocks up to the end of blocks marker, decode it straight into the sink, repeat
+    uint64_t total = 0;
+    size_t blockCount = 0;
+    int end = 0;
+    while(ok && !end){
+        size_t batch = 0;
+        size_t batchRaw = 0;
+        while(ok && batch < batchSize){
+            unsigned char blockHeader[BLOCK_HEADER_SIZE];
+            if(pipe_read(input, blockHeader, BLOCK_HEADER_SIZE) != BLOCK_HEADER_SIZE){
+                ok = 0;
+                break;
+            }
+            uint32_t rawSize = load_u32_le(blockHeader);
+            uint32_t payloadSize = load_u32_le(blockHeader + 4);
+            unsigned char type = blockHeader[8];
+            consumed += BLOCK_HEADER_SIZE;
+            if(rawSize == 0 && payloadSize == 0 && type == 0){
+                end = 1;
+                break;
+            }
+            if(rawSize == 0 || rawSize > MAX_BLOCK_SIZE || payloadSize > block_bound(rawSize)
+                || (type & BLOCK_TYPE_MASK) > BLOCK_GLOBAL){
+                ok = 0;
+                break;
+            }
+            if(payloadSize > capacities[batch]){
+                unsigned char* grown = realloc(payloads[batch], payloadSize);
+                if(grown == NULL){
+                    ok = 0;
+                    break;
+                }
+                payloads[batch] = grown;
+                capacities[batch] = payloadSize;
+            }
+            if(pipe_read(input, payloads[batch], payloadSize) != (ssize_t)payloadSize){
+                ok = 0;
+                break;
+            }
+            jobs[batch].payload = payloads[batch];
+            jobs[batch].payloadSize = payloadSize;
+            jobs[batch].dstSize = rawSize;
+            jobs[batch].type = type;
+            jobs[batch].globalLengths = (header[5] & HUF_FLAG_GLOBAL_TABLE) ? globalLengths : NULL;
+            jobs[batch].stats = stats;
+            consumed += payloadSize;
+            batchRaw += rawSize;
+            batch++;
+        }
+        if(!ok || batch == 0)
+            continue;
+
+        unsigned char* dst = sink_reserve(output, batchRaw);
+        if(dst == NULL){
+            ok = 0;
+            break;
+        }
+        for(size_t i = 0; i < batch; i++){
+            jobs[i].dst = dst;
+            dst += jobs[i].dstSize;
+        }
+        pool_run(pool, decompress_task, jobs, batch);
+        for(size_t i = 0; i < batch; i++){
+            ok = ok && jobs[i].ok;
+            if(ok && stats != NULL)
+                record_block(stats, total + (uint64_t)(jobs[i].dst - jobs[0].dst), jobs[i].dstSize, BLOCK_HEADER_SIZE + jobs[i].payloadSize, jobs[i].nanos, jobs[i].thread);
+        }
+        if(ok)
+            sink_commit(output, batchRaw);
+        total += batchRaw;
+        blockCount += batch;
+    }
+
+    // Whatever follows the marker is the index, if any, and the footer, which must be the last 16 bytes
+    unsigned char tail[HUF_FOOTER_SIZE];
+    size_t tailSize = 0;
+    while(ok){
+        unsigned char chunk[4096];
+        ssize_t got = pipe_read(input, chunk, sizeof(chunk));
+        if(got < 0){
+            ok = 0;
+            break;
+        }
+        size_t keep = (size_t)got >= HUF_FOOTER_SIZE ? 0 : (tailSize < HUF_FOOTER_SIZE - (size_t)got ? tailSize : HUF_FOOTER_SIZE - (size_t)got);
+        size_t take = (size_t)got < HUF_FOOTER_SIZE ? (size_t)got : HUF_FOOTER_SIZE;
+        memmove(tail, tail + tailSize - keep, keep);
+        memcpy(tail + keep, chunk + got - take, take);
+        tailSize = keep + take;
+        consumed += (uint64_t)got;
+        if((size_t)got < sizeof(chunk))
+            break;
+    }
+    ok = ok && tailSize == HUF_FOOTER_SIZE && memcmp(tail + 12, HUF_FOOTER_MAGIC, 4) == 0 && load_u32_le(tail + 8) == blockCount;
+    ok = ok && ((header[5] & HUF_FLAG_NO_INDEX) || load_u64_le(header + 6) == total);
+    if(ok && stats != NULL){
+        stats->originalBytes = total;
+        stats->encodedBytes = consumed;
+        stats->wallNanos = monotonic_nanos() - startNanos;
+    }
+
+    for(size_t i = 0; payloads != NULL && i < batchSize; i++)
+        free(payloads[i]);
+    free(payloads);
+    free(capacities);
+    free(jobs);
+    close_reader(input);
+    if(pool != NULL)
+        destroy_pool(pool);
+    return ok;
+}
+
+/*
+Checks the header and footer of an encoded file held in memory. Returns 1 if its blocks can be walked.
+*/
+static int check_block_file(const unsigned char* src, size_t srcSize){
+    if(srcSize < HUF_HEADER_SIZE + BLOCK_HEADER_SIZE + HUF_FOOTER_SIZE)
+        return 0;
+    if(memcmp(src, HUF_MAGIC, HUF_MAGIC_LEN) != 0 || src[4] != HUF_FORMAT_VERSION || (src[5] & (HUF_FLAG_ADAPTIVE | HUF_FLAG_WORDS)))
+        return 0;
+    return memcmp(src + srcSize - HUF_FOOTER_SIZE + 12, HUF_FOOTER_MAGIC, 4) == 0;
+}
+
+/*
+Decodes bytes [offset, offset + length) of the original file into dst, or into "output" a block at a time when it
+is not NULL. Blocks are walked by their headers, which are all that is read of the blocks before the range. Returns
+the number of bytes decoded, which is less than length if the file ends first, or HUFFMAN_ERROR.
+*/
+static size_t decode_range(decode_table* dt, const unsigned char* src, size_t srcSize, uint64_t offset, size_t length, unsigned char* dst, output_sink* output){
+    if(!check_block_file(src, srcSize))
+        return HUFFMAN_ERROR;
+
+    size_t end = srcSize - HUF_FOOTER_SIZE;
+    unsigned char globalLengths[ALPHABET_SIZE];
+    size_t position = load_global_table(src, end, globalLengths);
+    if(position == 0)
+        return HUFFMAN_ERROR;
+    const unsigned char* global = position != HUF_HEADER_SIZE ? globalLengths : NULL;
+    uint64_t blockStart = 0;
+    size_t produced = 0;
+    while(produced < length){
+        if(end - position < BLOCK_HEADER_SIZE)
+            return HUFFMAN_ERROR;
+        uint32_t rawSize = load_u32_le(src + position);
+        uint32_t payloadSize = load_u32_le(src + position + 4);
+        unsigned char type = src[position + 8];
+        position += BLOCK_HEADER_SIZE;
+        if(rawSize == 0 && payloadSize == 0 && type == 0)
+            break;
+        if(rawSize == 0 || payloadSize > end - position || (type & BLOCK_TYPE_MASK) > BLOCK_GLOBAL)
+            return HUFFMAN_ERROR;
+
+        // Only blocks that overlap the rest of the range are decoded
+        uint64_t first = offset + produced;
+        if(blockStart + rawSize > first){
+            size_t from = (size_t)(first - blockStart);
+            size_t to = length - produced < rawSize - from ? from + (length - produced) : rawSize;
+            unsigned char* target = output != NULL ? sink_reserve(output, to - from) : dst + produced;
+            if(target == NULL || !decode_block_range(dt, global, src + position, payloadSize, rawSize, type, from, to, target))
+                return HUFFMAN_ERROR;
+            if(output != NULL)
+                sink_commit(output, to - from);
+            produced += to - from;
+        }
+        blockStart += rawSize;
+        position += payloadSize;
+    }
+    return produced;
+}
+
+size_t decompress_range(const unsigned char* src, size_t srcSize, uint64_t offset, uint64_t length, output_sink* output){
+    decode_table dt;
+    return decode_range(&dt, src, srcSize, offset, length < SIZE_MAX ? (size_t)length : SIZE_MAX - 1, NULL, output);
+}
+
+void adaptive_reset(adaptive_model* model){
+    for(int i = 0; i < ADAPTIVE_SYMBOLS; i++)
+        model->leaf[i] = NO_NODE;
+    model->nodes[ADAPTIVE_ROOT].weight = 0;
+    model->nodes[ADAPTIVE_ROOT].parent = NO_NODE;
+    model->nodes[ADAPTIVE_ROOT].left = NO_NODE;
+    model->nodes[ADAPTIVE_ROOT].right = NO_NODE;
+    model->nodes[ADAPTIVE_ROOT].symbol = ADAPTIVE_NYT;
+    model->nyt = ADAPTIVE_ROOT;
+}
+
+/*
+Points whatever refers to the contents of node "number" back at it: the parent links of its children, or the leaf
+table entry of its symbol.
+*/
+static void adaptive_relink(adaptive_model* model, uint16_t number){
+    adaptive_node* node = &model->nodes[number];
+    if(node->symbol == ADAPTIVE_INTERNAL){
+        model->nodes[node->left].parent = number;
+        model->nodes[node->right].parent = number;
+    }
+    else if(node->symbol == ADAPTIVE_NYT)
+        model->nyt = number;
+    else
+        model->leaf[node->symbol] = number;
+}
+
+/*
+Swaps the subtrees at node numbers a and b. Each number keeps its place under its parent, so only the moved
+contents need relinking.
+*/
+static void adaptive_swap(adaptive_model* model, uint16_t a, uint16_t b){
+    adaptive_node swap = model->nodes[a];
+    uint16_t parentA = model->nodes[a].parent;
+    uint16_t parentB = model->nodes[b].parent;
+    model->nodes[a] = model->nodes[b];
+    model->nodes[b] = swap;
+    model->nodes[a].parent = parentA;
+    model->nodes[b].parent = parentB;
+    adaptive_relink(model, a);
+    adaptive_relink(model, b);
+}
+
+void adaptive_update(adaptive_model* model, int symbol){
+    adaptive_node* nodes = model->nodes;
+    uint16_t q = model->leaf[symbol];
+
+    // New symbol: the NYT leaf becomes an internal node over a new NYT leaf (left) and the symbol's leaf (right),
+    // numbered just below it
+    if(q == NO_NODE){
+        uint16_t parent = model->nyt;
+        uint16_t nyt = parent - 2;
+        uint16_t leaf = parent - 1;
+        nodes[nyt].weight = 0;
+        nodes[nyt].parent = parent;
+        nodes[nyt].left = NO_NODE;
+        nodes[nyt].right = NO_NODE;
+        nodes[nyt].symbol = ADAPTIVE_NYT;
+        nodes[leaf] = nodes[nyt];
+        nodes[leaf].symbol = (int16_t)symbol;
+        nodes[parent].left = nyt;
+        nodes[parent].right = leaf;
+        nodes[parent].symbol = ADAPTIVE_INTERNAL;
+        model->nyt = nyt;
+        model->leaf[symbol] = leaf;
+        q = leaf;
+    }
+
+    // Walk up to the root. Before each increment the node trades places with the highest numbered node of the same
+    // weight (unless that is its parent), which keeps weights in number order once it goes up by one.
+    while(q != NO_NODE){
+        uint16_t leader = q;
+        while(leader < ADAPTIVE_ROOT && nodes[leader + 1].weight == nodes[q].weight)
+            leader++;
+        if(leader != q && leader != nodes[q].parent){
+            adaptive_swap(model, q, leader);
+            q = leader;
+        }
+        nodes[q].weight++;
+        q = nodes[q].parent;
+    }
+
+    // Both sides start over at the same point, long before a weight could overflow
+    if(nodes[ADAPTIVE_ROOT].weight >= ADAPTIVE_MAX_WEIGHT)
+        adaptive_reset(model);
+}
+
+//Bits waiting to be written to a sink, most significant bit first
+typedef struct bit_writer
+{
+    output_sink* output;                  ///< Where whole bytes go
+    uint64_t bits;                        ///< Pending bits in the low "count" bits
+    int count;                            ///< Number of pending bits, less than 8 between calls
+} bit_writer;
+
+static void put_bits(bit_writer* writer, uint32_t value, int count){
+    writer->bits = (writer->bits << count) | value;
+    writer->count += count;
+    while(writer->count >= 8){
+        unsigned char byte = (unsigned char)(writer->bits >> (writer->count - 8));
+        sink_write(writer->output, &byte, 1);
+        writer->count -= 8;
+    }
+}
+
+/*
+Sends one symbol with the current tree, then updates the tree. Codes are found by walking from the leaf up to the
+root, so the bits are collected first and sent root first. Returns the number of bits sent.
+*/
+static int adaptive_encode_symbol(adaptive_model* model, bit_writer* writer, int symbol){
+    unsigned char path[ADAPTIVE_NODES];
+    int depth = 0;
+    uint16_t node = model->leaf[symbol] != NO_NODE ? model->leaf[symbol] : model->nyt;
+
+    for(uint16_t parent = model->nodes[node].parent; parent != NO_NODE; node = parent, parent = model->nodes[node].parent)
+        path[depth++] = model->nodes[parent].right == node;
+    int bits = depth;
+    while(depth > 0)
+        put_bits(writer, path[--depth], 1);
+    if(model->leaf[symbol] == NO_NODE){
+        put_bits(writer, (uint32_t)symbol, ADAPTIVE_SYMBOL_BITS);
+        bits += ADAPTIVE_SYMBOL_BITS;
+    }
+    adaptive_update(model, symbol);
+    return bits;
+}
+
+int compress_adaptive(int fd, output_sink* output, run_stats* stats){
+    adaptive_model* model = malloc(sizeof(adaptive_model));
+    unsigned char* buffer = malloc(ADAPTIVE_READ_SIZE);
+    bit_writer writer = {output, 0, 0};
+    int ok = model != NULL && buffer != NULL;
+    uint64_t startNanos = stats != NULL ? monotonic_nanos() : 0;
+    uint64_t startWritten = output->written;
+    uint64_t original = 0;
+
+    write_file_header(output, 0, HUF_FLAG_ADAPTIVE);
+    if(ok)
+        adaptive_reset(model);
+    while(ok){
+        ssize_t got = read(fd, buffer, ADAPTIVE_READ_SIZE);
+        if(got <= 0){
+            ok = got == 0;
+            break;
+        }
+        original += (uint64_t)got;
+        if(stats == NULL){
+            for(ssize_t i = 0; i < got; i++)
+                adaptive_encode_symbol(model, &writer, buffer[i]);
+        }
+        else{
+            count_frequencies(buffer, (size_t)got, stats->threads[0].counts);
+            for(ssize_t i = 0; i < got; i++)
+                count_code_length(&stats->threads[0], (unsigned int)adaptive_encode_symbol(model, &writer, buffer[i]), 1);
+        }
+
+        // A short read means the input has nothing more for now, so send everything coded so far
+        if(got < ADAPTIVE_READ_SIZE){
+            adaptive_encode_symbol(model, &writer, ADAPTIVE_FLUSH);
+            put_bits(&writer, 0, (8 - writer.count) % 8);
+            sink_flush(output);
+        }
+    }
+    if(ok){
+        adaptive_encode_symbol(model, &writer, ADAPTIVE_END);
+        put_bits(&writer, 0, (8 - writer.count) % 8);
+    }
+
+    // Coding and updating the tree cannot be told apart, so all of it is encoding
+    if(ok && stats != NULL){
+        lap_stage(stats, STAGE_ENCODE, startNanos);
+        finish_bitstream_stats(stats, CODING_ADAPTIVE, original, output->written - startWritten, startNanos);
+    }
+
+    free(model);
+    free(buffer);
+    return ok;
+}
+
+//Bits read from a file descriptor, most significant bit first
+typedef struct bit_reader
+{
+    int fd;                               ///< Where bytes come from
+    output_sink* output;                  ///< Flushed before any read that may have to wait
+    unsigned char buffer[ADAPTIVE_READ_SIZE]; ///< Bytes read but not used yet
+    size_t size;                          ///< Number of bytes in buffer
+    size_t position;                      ///< Next byte of buffer
+    uint64_t total;                       ///< Bytes read from fd so far
+    unsigned int byte;                    ///< Byte being read
+    int count;                            ///< Bits of byte not used yet
+} bit_reader;
+
+/*
+Returns the next bit, or -1 if the input ended or failed.
+*/
+static int get_bit(bit_reader* reader){
+    if(reader->count == 0){
+        if(reader->position == reader->size){
+            sink_flush(reader->output);
+            ssize_t got = read(reader->fd, reader->buffer, ADAPTIVE_READ_SIZE);
+            if(got <= 0)
+                return -1;
+            reader->size = (size_t)got;
+            reader->position = 0;
+            reader->total += (uint64_t)got;
+        }
+        reader->byte = reader->buffer[reader->position++];
+        reader->count = 8;
+    }
+    reader->count--;
+    return (reader->byte >> reader->count) & 1;
+}
+
+int decompress_adaptive(int fd, output_sink* output, run_stats* stats){
+    adaptive_model* model = malloc(sizeof(adaptive_model));
+    bit_reader* reader = malloc(sizeof(bit_reader));
+    if(model == NULL || reader == NULL){
+        free(model);
+        free(reader);
+        return 0;
+    }
+    adaptive_reset(model);
+    reader->fd = fd;
+    reader->output = output;
+    reader->size = 0;
+    reader->position = 0;
+    reader->total = 0;
+    reader->count = 0;
+    uint64_t startNanos = stats != NULL ? monotonic_nanos() : 0;
+    uint64_t original = 0;
+
+    int ok = 1;
+    for(;;){
+        // Follow the bits down from the root to a leaf
+        uint16_t node = ADAPTIVE_ROOT;
+        int bit = 0;
+        unsigned int length = 0;
+        while(model->nodes[node].symbol == ADAPTIVE_INTERNAL && (bit = get_bit(reader)) >= 0){
+            node = bit ? model->nodes[node].right : model->nodes[node].left;
+            length++;
+        }
+        int symbol = model->nodes[node].symbol;
+        if(symbol == ADAPTIVE_NYT){
+            length += ADAPTIVE_SYMBOL_BITS;
+            symbol = 0;
+            for(int i = 0; i < ADAPTIVE_SYMBOL_BITS && bit >= 0; i++)
+                if((bit = get_bit(reader)) >= 0)
+                    symbol = (symbol << 1) | bit;
+            if(symbol >= ADAPTIVE_SYMBOLS || (bit >= 0 && model->leaf[symbol] != NO_NODE))
+                bit = -1;
+        }
+        if(bit < 0){
+            ok = 0;
+            break;
+        }
+
+        adaptive_update(model, symbol);
+        if(symbol == ADAPTIVE_END)
+            break;
+        if(symbol == ADAPTIVE_FLUSH)
+            reader->count = 0;    // The rest of the byte is padding
+        else{
+            unsigned char character = (unsigned char)symbol;
+            sink_write(output, &character, 1);
+            original++;
+            if(stats != NULL){
+                stats->threads[0].counts[character]++;
+                count_code_length(&stats->threads[0], length, 1);
+            }
+        }
+    }
+    if(ok && stats != NULL){
+        lap_stage(stats, STAGE_DECODE, startNanos);
+        finish_bitstream_stats(stats, CODING_ADAPTIVE, original, HUF_HEADER_SIZE + reader->total, startNanos);
+    }
+
+    free(model);
+    free(reader);
+    return ok;
+}
+
+//Library interface, documented in huffman.h-----------------------------------------------------------------------------
+
+/*
+Returns the context's scratch buffer, grown to at least "size" bytes, or NULL if memory ran out.
+*/
+static unsigned char* context_scratch(huffman_context* ctx, size_t size){
+    if(ctx->scratchSize < size){
+        unsigned char* grown = realloc(ctx->scratch, size);
+        if(grown == NULL)
+            return NULL;
+        ctx->scratch = grown;
+        ctx->scratchSize = size;
+    }
+    return ctx->scratch;
+}
+
+huffman_context* huffman_create_context(void){
+    huffman_context* ctx = malloc(sizeof(huffman_context));
+    if(ctx == NULL)
+        return NULL;
+    ctx->options.threads = 1;
+    ctx->options.blockSize = DEFAULT_BLOCK_SIZE;
+    ctx->options.streams = 1;
+    ctx->options.checkpoints = 0;
+    ctx->options.effort = DEFAULT_EFFORT;
+    ctx->options.order1 = 0;
+    ctx->options.globalTable = 0;
+    ctx->options.globalLengths = NULL;
+    ctx->options.cache = NULL;
+    ctx->options.stats = NULL;
+    ctx->arena = create_arena(ALPHABET_SIZE);
+    ctx->scratch = NULL;
+    ctx->scratchSize = 0;
+    if(ctx->arena == NULL){
+        free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+void huffman_free_context(huffman_context* ctx){
+    if(ctx == NULL)
+        return;
+    free_arena(ctx->arena);
+    free(ctx->scratch);
+    free(ctx);
+}
+
+size_t huffman_compress_bound(size_t srcSize){
+    size_t blocks = (srcSize + DEFAULT_BLOCK_SIZE - 1) / DEFAULT_BLOCK_SIZE;
+    return HUF_HEADER_SIZE + srcSize + blocks * (block_bound(DEFAULT_BLOCK_SIZE) - DEFAULT_BLOCK_SIZE) + BLOCK_HEADER_SIZE + HUF_FOOTER_SIZE;
+}
+
+size_t huffman_compress(huffman_context* ctx, const void* src, size_t srcSize, void* dst, size_t dstCapacity){
+    const unsigned char* in = src;
+    unsigned char* out = dst;
+    size_t blockSize = ctx->options.blockSize;
+    size_t blockCount = 0;
+
+    // Same layout as compress_stream: the buffer is written in one pass, so it has no index
+    if(dstCapacity < HUF_HEADER_SIZE)
+        return HUFFMAN_ERROR;
+    store_file_header(out, 0, HUF_FLAG_NO_INDEX);
+    size_t position = HUF_HEADER_SIZE;
+
+    for(size_t start = 0; start < srcSize; start += blockSize){
+        size_t size = srcSize - start < blockSize ? srcSize - start : blockSize;
+
+        // Encode straight into dst when the worst case fits, otherwise into the scratch block and copy
+        unsigned char* target = out + position;
+        if(dstCapacity - position < block_bound(size)){
+            if((target = context_scratch(ctx, block_bound(blockSize))) == NULL)
+                return HUFFMAN_ERROR;
+        }
+        size_t blocks;
+        size_t written = compress_block(in + start, size, target, ctx->counts, &ctx->options, ctx->arena, &blocks);
+        if(target == ctx->scratch){
+            if(written > dstCapacity - position)
+                return HUFFMAN_ERROR;
+            memcpy(out + position, target, written);
+        }
+        position += written;
+        blockCount += blocks;
+    }
+
+    if(dstCapacity - position < BLOCK_HEADER_SIZE + HUF_FOOTER_SIZE)
+        return HUFFMAN_ERROR;
+    memset(out + position, 0, BLOCK_HEADER_SIZE);
+    store_file_footer(out + position + BLOCK_HEADER_SIZE, 0, blockCount);
+    return position + BLOCK_HEADER_SIZE + HUF_FOOTER_SIZE;
+}
+
+/*
+Walks the blocks of a compressed buffer from the front, decoding each one into dst when "ctx" is not NULL, or only
+adding up their sizes when it is. Returns the decompressed size, or HUFFMAN_ERROR.
+*/
+static size_t walk_blocks(huffman_context* ctx, const unsigned char* src, size_t srcSize, unsigned char* dst, size_t dstCapacity){
+    if(!check_block_file(src, srcSize))
+        return HUFFMAN_ERROR;
+    const unsigned char* footer = src + srcSize - HUF_FOOTER_SIZE;
+
+    // Blocks are back to back up to the end of blocks marker, with or without an index after them
+    size_t end = srcSize - HUF_FOOTER_SIZE;
+    unsigned char globalLengths[ALPHABET_SIZE];
+    size_t offset = load_global_table(src, end, globalLengths);
+    if(offset == 0)
+        return HUFFMAN_ERROR;
+    const unsigned char* global = offset != HUF_HEADER_SIZE ? globalLengths : NULL;
+    size_t produced = 0;
+    size_t blockCount = 0;
+    for(;;){
+        if(end - offset < BLOCK_HEADER_SIZE)
+            return HUFFMAN_ERROR;
+        uint32_t rawSize = load_u32_le(src + offset);
+        uint32_t payloadSize = load_u32_le(src + offset + 4);
+        unsigned char type = src[offset + 8];
+        offset += BLOCK_HEADER_SIZE;
+        if(rawSize == 0 && payloadSize == 0 && type == 0)
+            break;
+        if(rawSize == 0 || payloadSize > end - offset || rawSize > dstCapacity - produced
+            || (type & BLOCK_TYPE_MASK) > BLOCK_GLOBAL)
+            return HUFFMAN_ERROR;
+        if(ctx != NULL && !decode_payload(&ctx->decodeTable, ctx->options.cache, global, src + offset, payloadSize, dst + produced, rawSize, type))
+            return HUFFMAN_ERROR;
+        offset += payloadSize;
+        produced += rawSize;
+        blockCount++;
+    }
+
+    if(load_u32_le(footer + 8) != blockCount)
+        return HUFFMAN_ERROR;
+    if(!(src[5] & HUF_FLAG_NO_INDEX) && load_u64_le(src + 6) != produced)
+        return HUFFMAN_ERROR;
+    return produced;
+}
+
+size_t huffman_decompressed_size(const void* src, size_t srcSize){
+    return walk_blocks(NULL, src, srcSize, NULL, SIZE_MAX);
+}
+
+size_t huffman_decompress(huffman_context* ctx, const void* src, size_t srcSize, void* dst, size_t dstCapacity){
+    return walk_blocks(ctx, src, srcSize, dst, dstCapacity);
+}
+
+void huffman_set_checkpoints(huffman_context* ctx, int enabled){
+    ctx->options.checkpoints = enabled != 0;
+}
+
+void huffman_set_effort(huffman_context* ctx, int effort){
+    ctx->options.effort = effort < 0 ? 0 : effort > MAX_EFFORT ? MAX_EFFORT : effort;
+}
+
+void huffman_set_order1(huffman_context* ctx, int enabled){
+    ctx->options.order1 = enabled != 0;
+}
+
+size_t huffman_decompress_range(huffman_context* ctx, const void* src, size_t srcSize, size_t offset, void* dst, size_t length){
+    return decode_range(&ctx->decodeTable, src, srcSize, offset, length, dst, NULL);
+}
+
+/*
+Stores "value" as a varint at dst. Returns the number of bytes stored, at most VARINT_MAX_SIZE.
+*/
+static size_t store_varint(unsigned char* dst, uint64_t value){
+    size_t size = 0;
+    while(value >= 0x80){
+        dst[size++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    dst[size++] = (unsigned char)value;
+    return size;
+}
+
+/*
+Loads a varint from the "available" bytes at src into *value. Returns the number of bytes used, 0 if it is cut short
+or too long.
+*/
+static size_t load_varint(const unsigned char* src, size_t available, uint64_t* value){
+    *value = 0;
+    for(size_t i = 0; i < available && i < VARINT_MAX_SIZE; i++){
+        *value |= (uint64_t)(src[i] & 0x7F) << (7 * i);
+        if(!(src[i] & 0x80))
+            return i + 1;
+    }
+    return 0;
+}
+
+size_t store_dictionary(const uint64_t counts[], uint32_t id, unsigned char* dst){
+    uint64_t weights[ALPHABET_SIZE];
+    unsigned char lengths[ALPHABET_SIZE];
+
+    huffman_arena* arena = create_arena(ALPHABET_SIZE);
+    if(arena == NULL)
+        return 0;
+
+    // Every character counts at least once, so characters the samples missed still get a (long) code
+    for(int c = 0; c < ALPHABET_SIZE; c++)
+        weights[c] = counts[c] + 1;
+
+    // Same table, tree and code lengths as a block would get
+    table* valueTable = histogram_to_table(arena, weights);
+    pq* huffmanQueue = table_to_queue(arena, valueTable);
+    uint16_t huffmanTree = huffman_process(huffmanQueue);
+    assign_codes_to_table(huffmanQueue->nodes, huffmanTree, valueTable, lengths);
+    free_arena(arena);
+
+    memcpy(dst, DICT_MAGIC, 4);
+    dst[4] = DICT_VERSION;
+    store_u32_le(dst + 5, id);
+    return DICT_HEADER_SIZE + write_code_lengths(lengths, dst + DICT_HEADER_SIZE);
+}
+
+size_t huffman_train_dictionary(const void* samples, size_t samplesSize, uint32_t id, void* dst, size_t dstCapacity){
+    uint64_t counts[ALPHABET_SIZE];
+
+    if(dstCapacity < HUFFMAN_DICTIONARY_MAX_SIZE)
+        return HUFFMAN_ERROR;
+    memset(counts, 0, sizeof(counts));
+    count_frequencies(samples, samplesSize, counts);
+    size_t size = store_dictionary(counts, id, dst);
+    return size != 0 ? size : HUFFMAN_ERROR;
+}
+
+huffman_dictionary* huffman_load_dictionary(const void* src, size_t srcSize){
+    const unsigned char* in = src;
+    unsigned char lengths[ALPHABET_SIZE];
+    unsigned int codes[ALPHABET_SIZE];
+
+    if(srcSize < DICT_HEADER_SIZE || memcmp(in, DICT_MAGIC, 4) != 0 || in[4] != DICT_VERSION)
+        return NULL;
+    if(read_code_lengths(in + DICT_HEADER_SIZE, srcSize - DICT_HEADER_SIZE, lengths) == 0)
+        return NULL;
+    for(int c = 0; c < ALPHABET_SIZE; c++)
+        if(lengths[c] == 0)    // A record may hold any character
+            return NULL;
+
+    huffman_dictionary* dict = malloc(sizeof(huffman_dictionary));
+    if(dict == NULL)
+        return NULL;
+    if(!build_decode_table(lengths, &dict->decodeTable)){
+        free(dict);
+        return NULL;
+    }
+    compute_canonical_codes(lengths, codes);
+    for(int c = 0; c < ALPHABET_SIZE; c++){
+        dict->codes[c].code = codes[c];
+        dict->codes[c].length = lengths[c];
+    }
+    dict->id = load_u32_le(in + 5);
+    return dict;
+}
+
+void huffman_free_dictionary(huffman_dictionary* dict){
+    free(dict);
+}
+
+uint32_t huffman_dictionary_id(const huffman_dictionary* dict){
+    return dict->id;
+}
+
+size_t huffman_dictionary_bound(size_t srcSize){
+    return 2 * VARINT_MAX_SIZE + (srcSize * MAX_CODE_LEN + 7) / 8 + HUF_WRITE_SLACK;
+}
+
+size_t huffman_frame_dictionary_id(const void* src, size_t srcSize){
+    uint64_t id;
+    if(load_varint(src, srcSize, &id) == 0 || id > UINT32_MAX)
+        return HUFFMAN_ERROR;
+    return (size_t)id;
+}
+
+size_t huffman_compress_with_dictionary(huffman_context* ctx, const huffman_dictionary* dict, const void* src, size_t srcSize, void* dst, size_t dstCapacity){
+    unsigned char header[2 * VARINT_MAX_SIZE];
+    size_t headerSize = store_varint(header, dict->id);
+    headerSize += store_varint(header + headerSize, srcSize);
+
+    // Straight into dst when the worst case fits, otherwise into the scratch buffer and copy
+    size_t bound = headerSize + (srcSize * MAX_CODE_LEN + 7) / 8 + HUF_WRITE_SLACK;
+    unsigned char* target = dstCapacity >= bound ? dst : context_scratch(ctx, bound);
+    if(target == NULL)
+        return HUFFMAN_ERROR;
+    memcpy(target, header, headerSize);
+    size_t size = headerSize + encode_buffer(dict->codes, src, srcSize, target + headerSize);
+    if(target != dst){
+        if(size > dstCapacity)
+            return HUFFMAN_ERROR;
+        memcpy(dst, target, size);
+    }
+    return size;
+}
+
+size_t huffman_decompress_with_dictionary(const huffman_dictionary* dict, const void* src, size_t srcSize, void* dst, size_t dstCapacity){
+    const unsigned char* in = src;
+    uint64_t id;
+    uint64_t rawSize;
+
+    size_t used = load_varint(in, srcSize, &id);
+    if(used == 0 || id != dict->id)
+        return HUFFMAN_ERROR;
+    size_t lengthSize = load_varint(in + used, srcSize - used, &rawSize);
+    if(lengthSize == 0 || rawSize > dstCapacity)
+        return HUFFMAN_ERROR;
+    used += lengthSize;
+    if(!decode_buffer(&dict->decodeTable, in + used, srcSize - used, dst, (size_t)rawSize))
+        return HUFFMAN_ERROR;
+    return (size_t)rawSize;
+}
+
+//Word mode-------------------------------------------------------------------------------------------------------------
+
+/*
+1 for the bytes words are made of: letters, digits and every byte of a UTF-8 sequence.
+*/
+static inline int is_word_byte(unsigned char c){
+    return (unsigned char)((c | 0x20) - 'a') < 26 || (unsigned char)(c - '0') < 10 || c >= 0x80;
+}
+
+/*
+Length of the token at src: the run of word bytes or of other bytes that starts there, at most WORD_MAX_LENGTH. Its
+FNV-1a hash is worked out on the way and goes in *hash.
+*/
+static size_t next_token(const unsigned char* src, size_t size, uint32_t* hash){
+    int word = is_word_byte(src[0]);
+    size_t limit = size < WORD_MAX_LENGTH ? size : WORD_MAX_LENGTH;
+    uint32_t h = (2166136261u ^ src[0]) * 16777619u;
+    size_t length = 1;
+    while(length < limit && is_word_byte(src[length]) == word){
+        h = (h ^ src[length]) * 16777619u;
+        length++;
+    }
+    *hash = h;
+    return length;
+}
+
+/*
+Replaces the hash table with one of "slotCount" slots (a power of 2) holding every token. Returns 0 if memory ran out.
+*/
+static int rehash_words(word_dictionary* dict, size_t slotCount){
+    uint32_t* slots = calloc(slotCount, sizeof(uint32_t));
+    if(slots == NULL)
+        return 0;
+    free(dict->slots);
+    dict->slots = slots;
+    dict->slotMask = slotCount - 1;
+    for(size_t i = 0; i < dict->count; i++){
+        size_t slot = dict->tokens[i].hash & dict->slotMask;
+        while(slots[slot] != 0)
+            slot = (slot + 1) & dict->slotMask;
+        slots[slot] = (uint32_t)i + 1;
+    }
+    return 1;
+}
+
+/*
+Finds a token, with the hash from next_token, in the dictionary. With "add" set, a token that is not there yet is
+added with a count of 0. Returns the token's number, or -1 if it was not found or could not be added.
+*/
+static long find_word(word_dictionary* dict, const unsigned char* text, size_t length, uint32_t hash, int add){
+    size_t slot = hash & dict->slotMask;
+    for(; dict->slots[slot] != 0; slot = (slot + 1) & dict->slotMask){
+        const word_token* t = &dict->tokens[dict->slots[slot] - 1];
+        if(t->hash == hash && t->length == length && memcmp(t->text, text, length) == 0)
+            return (long)dict->slots[slot] - 1;
+    }
+    if(!add || dict->count == WORD_MAX_TOKENS)
+        return -1;
+
+    if(dict->count == dict->capacity){
+        size_t capacity = dict->capacity == 0 ? WORD_MIN_SLOTS : dict->capacity * 2;
+        word_token* grown = realloc(dict->tokens, capacity * sizeof(word_token));
+        if(grown == NULL)
+            return -1;
+        dict->tokens = grown;
+        dict->capacity = capacity;
+    }
+    word_token* t = &dict->tokens[dict->count];
+    t->text = text;
+    t->length = (uint32_t)length;
+    t->hash = hash;
+    t->count = 0;
+    t->code = 0;
+    t->codeLength = 0;
+    dict->slots[slot] = (uint32_t)++dict->count;
+
+    // Probes stay short as long as the table is at most half full
+    if(2 * dict->count > dict->slotMask && !rehash_words(dict, 2 * (dict->slotMask + 1)))
+        return -1;
+    return (long)dict->count - 1;
+}
+
+void minimum_redundancy_lengths(uint64_t weights[], size_t n){
+    uint64_t* a = weights;
+    if(n == 0)
+        return;
+    if(n == 1){
+        a[0] = 1;
+        return;
+    }
+
+    // First pass, left to right: each internal node goes in the next free place, and the two smallest leaves or
+    // internal nodes it combines are replaced by a pointer to it
+    size_t root = 0;
+    size_t leaf = 2;
+    a[0] += a[1];
+    for(size_t next = 1; next < n - 1; next++){
+        if(leaf >= n || a[root] < a[leaf]){
+            a[next] = a[root];
+            a[root++] = next;
+        }
+        else
+            a[next] = a[leaf++];
+        if(leaf >= n || (root < next && a[root] < a[leaf])){
+            a[next] += a[root];
+            a[root++] = next;
+        }
+        else
+            a[next] += a[leaf++];
+    }
+
+    // Second pass, right to left: parent pointers become depths of the internal nodes
+    a[n - 2] = 0;
+    for(size_t next = n - 2; next-- > 0;)
+        a[next] = a[a[next]] + 1;
+
+    // Third pass, right to left: the internal nodes at each depth give the number of leaves at the next one
+    size_t available = 1;
+    size_t used = 0;
+    uint64_t depth = 0;
+    size_t internal = n - 1;    // One past the next internal node to look at
+    size_t next = n;            // One past the next leaf to set
+    while(available > 0){
+        while(internal > 0 && a[internal - 1] == depth){
+            used++;
+            internal--;
+        }
+        while(available > used){
+            a[--next] = depth;
+            available--;
+        }
+        available = 2 * used;
+        depth++;
+        used = 0;
+    }
+}
+
+/*
+Caps code lengths (longest first, as minimum_redundancy_lengths leaves them) at "maxLength": the long codes are cut to
+maxLength, then codes are lengthened one at a time from the longest level below maxLength until the Kraft sum fits.
+*/
+static void limit_word_lengths(uint64_t lengths[], size_t n, int maxLength){
+    uint64_t lengthCount[WORD_MAX_CODE_LEN + 1];
+    if(n == 0 || lengths[0] <= (uint64_t)maxLength)
+        return;
+
+    memset(lengthCount, 0, sizeof(lengthCount));
+    uint64_t total = 0;
+    for(size_t i = 0; i < n; i++){
+        int length = lengths[i] < (uint64_t)maxLength ? (int)lengths[i] : maxLength;
+        lengthCount[length]++;
+        total += (uint64_t)1 << (maxLength - length);
+    }
+    while(total > ((uint64_t)1 << maxLength)){
+        lengthCount[maxLength]--;
+        for(int length = maxLength - 1; length > 0; length--){
+            if(lengthCount[length] != 0){
+                lengthCount[length]--;
+                lengthCount[length + 1] += 2;
+                break;
+            }
+        }
+        total--;
+    }
+
+    // Longest codes to the rarest tokens, which come first
+    size_t i = 0;
+    for(int length = maxLength; length > 0; length--)
+        for(uint64_t k = 0; k < lengthCount[length]; k++)
+            lengths[i++] = (uint64_t)length;
+}
+
+// qsort comparisons for word tokens: by count, then in canonical order (code length, then bytes)
+static int compare_word_counts(const void* a, const void* b){
+    const word_token* x = a;
+    const word_token* y = b;
+    return x->count < y->count ? -1 : x->count > y->count;
+}
+
+static int compare_word_codes(const void* a, const void* b){
+    const word_token* x = a;
+    const word_token* y = b;
+    if(x->codeLength != y->codeLength)
+        return x->codeLength < y->codeLength ? -1 : 1;
+    int order = memcmp(x->text, y->text, x->length < y->length ? x->length : y->length);
+    return order != 0 ? order : (int)x->length - (int)y->length;
+}
+
+/*
+Gives every token its code length and canonical code, leaving the tokens in canonical order. Returns 0 if memory ran
+out.
+*/
+static int assign_word_codes(word_dictionary* dict){
+    size_t n = dict->count;
+    if(n == 0)
+        return 1;
+    uint64_t* weights = malloc(n * sizeof(uint64_t));
+    if(weights == NULL)
+        return 0;
+
+    qsort(dict->tokens, n, sizeof(word_token), compare_word_counts);
+    for(size_t i = 0; i < n; i++)
+        weights[i] = dict->tokens[i].count;
+    minimum_redundancy_lengths(weights, n);
+    limit_word_lengths(weights, n, WORD_MAX_CODE_LEN);
+    for(size_t i = 0; i < n; i++)
+        dict->tokens[i].codeLength = (uint32_t)weights[i];
+    free(weights);
+
+    // Canonical codes: shorter codes first, each one more than the last, shifted left when the length grows
+    qsort(dict->tokens, n, sizeof(word_token), compare_word_codes);
+    uint32_t code = 0;
+    uint32_t length = dict->tokens[0].codeLength;
+    for(size_t i = 0; i < n; i++){
+        code <<= dict->tokens[i].codeLength - length;
+        length = dict->tokens[i].codeLength;
+        dict->tokens[i].code = code++;
+    }
+    return rehash_words(dict, dict->slotMask + 1);
+}
+
+/*
+Writes the token dictionary: the number of tokens, how many have each code length, then the tokens in canonical
+order, each as the length of the prefix it shares with the token before it and the bytes after that prefix.
+*/
+static void write_word_dictionary(const word_dictionary* dict, output_sink* output){
+    unsigned char entry[2 * VARINT_MAX_SIZE + WORD_MAX_LENGTH];
+    uint64_t lengthCount[WORD_MAX_CODE_LEN + 1];
+
+    memset(lengthCount, 0, sizeof(lengthCount));
+    for(size_t i = 0; i < dict->count; i++)
+        lengthCount[dict->tokens[i].codeLength]++;
+    sink_write(output, entry, store_varint(entry, dict->count));
+    for(int length = 1; length <= WORD_MAX_CODE_LEN; length++)
+        sink_write(output, entry, store_varint(entry, lengthCount[length]));
+
+    for(size_t i = 0; i < dict->count; i++){
+        const word_token* t = &dict->tokens[i];
+        size_t shared = 0;
+        if(i > 0){
+            const word_token* previous = &dict->tokens[i - 1];
+            while(shared < t->length && shared < previous->length && t->text[shared] == previous->text[shared])
+                shared++;
+        }
+        size_t size = store_varint(entry, shared);
+        size += store_varint(entry + size, t->length - shared);
+        memcpy(entry + size, t->text + shared, t->length - shared);
+        sink_write(output, entry, size + t->length - shared);
+    }
+}
+
+int compress_words(const unsigned char* src, size_t srcSize, output_sink* output, run_stats* stats){
+    word_dictionary dict;
+    memset(&dict, 0, sizeof(dict));
+    int ok = rehash_words(&dict, WORD_MIN_SLOTS);
+    uint64_t startNanos = stats != NULL ? monotonic_nanos() : 0;
+    uint64_t lap = startNanos;
+    uint64_t startWritten = output->written;
+
+    // First pass: count every distinct token
+    for(size_t i = 0; ok && i < srcSize;){
+        uint32_t hash;
+        size_t length = next_token(src + i, srcSize - i, &hash);
+        long token = find_word(&dict, src + i, length, hash, 1);
+        ok = token >= 0;
+        if(ok)
+            dict.tokens[token].count++;
+        i += length;
+    }
+    if(ok && stats != NULL){
+        count_frequencies(src, srcSize, stats->threads[0].counts);
+        lap = lap_stage(stats, STAGE_HISTOGRAM, lap);
+    }
+    ok = ok && assign_word_codes(&dict);
+    if(ok && stats != NULL){
+        for(size_t i = 0; i < dict.count; i++)
+            count_code_length(&stats->threads[0], dict.tokens[i].codeLength, dict.tokens[i].count);
+        lap = lap_stage(stats, STAGE_TABLES, lap);
+    }
+
+    // Second pass: the same tokens, looked up again for their codes and packed as in encode_buffer
+    if(ok){
+        write_file_header(output, srcSize, HUF_FLAG_WORDS);
+        write_word_dictionary(&dict, output);
+
+        unsigned char* start = sink_reserve(output, WORD_ENCODE_CHUNK + HUF_WRITE_SLACK);
+        unsigned char* dst = start;
+        uint64_t bits = 0;
+        unsigned int count = 0;
+        for(size_t i = 0; i < srcSize;){
+            uint32_t hash;
+            size_t length = next_token(src + i, srcSize - i, &hash);
+            const word_token* t = &dict.tokens[find_word(&dict, src + i, length, hash, 0)];
+            count += t->codeLength;
+            bits |= (uint64_t)t->code << (64 - count);
+            store_u64_be(dst, bits);
+            dst += count >> 3;
+            bits <<= count & ~7u;
+            count &= 7;
+            i += length;
+            if(dst - start >= WORD_ENCODE_CHUNK){
+                sink_commit(output, (size_t)(dst - start));
+                start = dst = sink_reserve(output, WORD_ENCODE_CHUNK + HUF_WRITE_SLACK);
+            }
+        }
+        if(count > 0){
+            store_u64_be(dst, bits);
+            dst++;
+        }
+        sink_commit(output, (size_t)(dst - start));
+    }
+    if(ok && stats != NULL){
+        lap_stage(stats, STAGE_ENCODE, lap);
+        finish_bitstream_stats(stats, CODING_WORDS, srcSize, output->written - startWritten, startNanos);
+    }
+
+    free(dict.tokens);
+    free(dict.slots);
+    return ok;
+}
+
+/*
+Reads the token dictionary at src into the decoder and builds its decode tables. The decoder's offset and text must
+be NULL to begin with, and are freed by the caller whether or not this succeeds. Returns the number of bytes used,
+0 if the dictionary is invalid or memory ran out.
+*/
+static size_t load_word_dictionary(word_decoder* decoder, const unsigned char* src, size_t srcSize){
+    uint64_t tokenCount;
+    uint64_t lengthCount[WORD_MAX_CODE_LEN + 1];
+    uint64_t total = 0;
+    uint64_t kraftSum = 0;
+
+    size_t used = load_varint(src, srcSize, &tokenCount);
+    if(used == 0 || tokenCount > WORD_MAX_TOKENS)
+        return 0;
+    for(int length = 1; length <= WORD_MAX_CODE_LEN; length++){
+        size_t size = load_varint(src + used, srcSize - used, &lengthCount[length]);
+        if(size == 0 || lengthCount[length] > tokenCount)
+            return 0;
+        used += size;
+        total += lengthCount[length];
+        kraftSum += lengthCount[length] << (WORD_MAX_CODE_LEN - length);
+    }
+    if(total != tokenCount || kraftSum > ((uint64_t)1 << WORD_MAX_CODE_LEN))
+        return 0;
+
+    // Tokens, each rebuilt from the end of the one before it. The text grows as it fills.
+    size_t capacity = WORD_MIN_SLOTS;
+    size_t textSize = 0;
+    size_t previous = 0;
+    decoder->offset = malloc(((size_t)tokenCount + 1) * sizeof(uint32_t));
+    decoder->text = malloc(capacity);
+    if(decoder->offset == NULL || decoder->text == NULL)
+        return 0;
+    for(size_t i = 0; i < tokenCount; i++){
+        uint64_t shared;
+        uint64_t rest;
+        size_t size = load_varint(src + used, srcSize - used, &shared);
+        if(size == 0)
+            return 0;
+        used += size;
+        size = load_varint(src + used, srcSize - used, &rest);
+        if(size == 0 || shared > (i > 0 ? textSize - previous : 0) || rest > WORD_MAX_LENGTH || shared + rest == 0
+            || shared + rest > WORD_MAX_LENGTH || rest > srcSize - used - size)
+            return 0;
+        used += size;
+        if(textSize + WORD_MAX_LENGTH + WORD_COPY_SIZE > capacity){
+            unsigned char* grown = realloc(decoder->text, capacity * 2);
+            if(grown == NULL)
+                return 0;
+            decoder->text = grown;
+            capacity *= 2;
+        }
+        memmove(decoder->text + textSize, decoder->text + previous, (size_t)shared);
+        memcpy(decoder->text + textSize + shared, src + used, (size_t)rest);
+        used += (size_t)rest;
+        decoder->offset[i] = (uint32_t)textSize;
+        previous = textSize;
+        textSize += (size_t)(shared + rest);
+    }
+    decoder->offset[tokenCount] = (uint32_t)textSize;
+    memset(decoder->text + textSize, 0, WORD_COPY_SIZE);
+
+    // Slow path: where the codes of each length start and end, as in build_decode_table
+    uint32_t code = 0;
+    uint32_t index = 0;
+    decoder->maxLength = 0;
+    for(int length = 1; length <= WORD_MAX_CODE_LEN; length++){
+        decoder->firstCode[length] = code;
+        decoder->firstIndex[length] = index;
+        code += (uint32_t)lengthCount[length];
+        index += (uint32_t)lengthCount[length];
+        decoder->limit[length] = (uint64_t)code << (32 - length);
+        code <<= 1;
+        if(lengthCount[length] != 0)
+            decoder->maxLength = length;
+    }
+
+    // Fast path: every code that fits in the table fills the entries it prefixes
+    memset(decoder->fast, 0, sizeof(decoder->fast));
+    for(int length = 1; length <= WORD_TABLE_BITS; length++){
+        int shift = WORD_TABLE_BITS - length;
+        for(uint32_t k = 0; k < lengthCount[length]; k++){
+            uint32_t first = (decoder->firstCode[length] + k) << shift;
+            for(uint32_t j = first; j < first + (1u << shift); j++){
+                decoder->fast[j].token = decoder->firstIndex[length] + k;
+                decoder->fast[j].bits = (uint32_t)length;
+            }
+        }
+    }
+    return used;
+}
+
+/*
+Slow path of decode_words for codes longer than the fast table. Returns the token, or -1 if the bits are not a code.
+The code length goes in *bits.
+*/
+static long decode_word_slow(const word_decoder* decoder, uint64_t window, unsigned int* bits){
+    uint64_t top = window >> 32;
+    for(int length = 1; length <= decoder->maxLength; length++){
+        if(top < decoder->limit[length]){
+            *bits = (unsigned int)length;
+            return (long)decoder->firstIndex[length] + (long)(top >> (32 - length)) - (long)decoder->firstCode[length];
+        }
+    }
+    return -1;
+}
+
+/*
+Decodes a word bitstream into dstSize bytes at dst, which needs WORD_COPY_SIZE spare bytes after them. Each lookup
+gives a whole token, and tokens up to WORD_COPY_SIZE bytes long are copied with one fixed size move. The tokens
+decoded with each code length are added to lengthTokens, unless it is NULL.
+*/
+static int decode_words(const word_decoder* decoder, const unsigned char* src, size_t srcSize, unsigned char* dst, size_t dstSize, uint64_t lengthTokens[]){
+    unsigned char* dstEnd = dst + dstSize;
+    uint64_t bitPos = 0;
+    unsigned int bits = 0;
+
+    while(dst < dstEnd){
+        // Past the last 8 bytes, the window is padded with zero bytes
+        uint64_t window = (bitPos >> 3) + 8 <= srcSize ? load_u64_be(src + (bitPos >> 3)) : load_u64_be_padded(src, srcSize, bitPos >> 3);
+        window <<= bitPos & 7;
+        for(int lookups = 0; lookups < 2 && dst < dstEnd; lookups++){    // 2 codes use at most 56 of the 57 bits
+            const word_entry e = decoder->fast[window >> (64 - WORD_TABLE_BITS)];
+            long token = e.token;
+            bits = e.bits;
+            if(bits == 0 && (token = decode_word_slow(decoder, window, &bits)) < 0)
+                return 0;
+            const unsigned char* text = decoder->text + decoder->offset[token];
+            size_t length = decoder->offset[token + 1] - decoder->offset[token];
+            if(length > (size_t)(dstEnd - dst))
+                return 0;
+            memcpy(dst, text, length <= WORD_COPY_SIZE ? WORD_COPY_SIZE : length);
+            dst += length;
+            window <<= bits;
+            bitPos += bits;
+            if(lengthTokens != NULL)
+                lengthTokens[bits]++;
+        }
+    }
+    return bitPos <= (uint64_t)srcSize * 8;
+}
+
+int decompress_words(int fd, const unsigned char header[], output_sink* output, run_stats* stats){
+    uint64_t originalSize = load_u64_le(header + 6);
+    uint64_t startNanos = stats != NULL ? monotonic_nanos() : 0;
+    word_decoder* decoder = malloc(sizeof(word_decoder));
+    input_span in;
+    if(decoder == NULL || !read_input(fd, &in)){
+        free(decoder);
+        return 0;
+    }
+    decoder->offset = NULL;
+    decoder->text = NULL;
+
+    // The whole original is decoded into the sink's buffer, with room for the last token's fixed size move. Every
+    // code is at least a bit and no token is longer than WORD_MAX_LENGTH, so a larger original size is a lie that
+    // must not be allocated.
+    size_t used = load_word_dictionary(decoder, in.data, in.size);
+    int ok = used != 0 && originalSize <= SIZE_MAX - WORD_COPY_SIZE;
+    if(ok && originalSize / WORD_MAX_LENGTH > (uint64_t)(in.size - used) * 8){
+        fprintf(stderr, "ERROR --> The word file claims %llu bytes, more than its %zu bytes of codes can hold.\n",
+            (unsigned long long)originalSize, in.size - used);
+        ok = 0;
+    }
+    if(ok && originalSize > 0){
+        unsigned char* dst = sink_reserve(output, (size_t)originalSize + WORD_COPY_SIZE);
+        ok = dst != NULL && decode_words(decoder, in.data + used, in.size - used, dst, (size_t)originalSize,
+            stats != NULL ? stats->threads[0].lengthSymbols : NULL);
+
+        // Reading, the dictionary and the tokens are all decoding; the characters are counted afterwards, untimed
+        if(ok && stats != NULL){
+            lap_stage(stats, STAGE_DECODE, startNanos);
+            count_frequencies(dst, (size_t)originalSize, stats->threads[0].counts);
+        }
+        if(ok)
+            sink_commit(output, (size_t)originalSize);
+    }
+    if(ok && stats != NULL){
+        stats->threads[0].maxLength = decoder->maxLength;
+        finish_bitstream_stats(stats, CODING_WORDS, originalSize, HUF_HEADER_SIZE + in.size, startNanos);
+    }
+
+    free(decoder->offset);
+    free(decoder->text);
+    free(decoder);
+    close_input(&in);
+    return ok;
+}
+
+/*
+build_decode_table without the second pass: every fast entry resolves a single character. Order-1 blocks use these,
+since the character after a code is looked up in another table.
+*/
+static int build_single_decode_table(const unsigned char lengths[], decode_table* dt){
+    unsigned int codes[ALPHABET_SIZE];
+    uint32_t lengthCount[MAX_CODE_LEN + 1];
+    uint64_t kraftSum = 0;
+
+    // Canonical codes are a valid prefix code as long as the lengths satisfy the Kraft inequality
+    memset(lengthCount, 0, sizeof(lengthCount));
+    dt->maxLength = 0;
+    for(int i = 0; i < ALPHABET_SIZE; i++){
+        if(lengths[i] == 0)
+            continue;
+        if(lengths[i] > MAX_CODE_LEN)
+            return 0;
+        kraftSum += (uint64_t)1 << (MAX_CODE_LEN - lengths[i]);
+        lengthCount[lengths[i]]++;
+        if(lengths[i] > dt->maxLength)
+            dt->maxLength = lengths[i];
+    }
+    if(kraftSum > ((uint64_t)1 << MAX_CODE_LEN))
+        return 0;
+    compute_canonical_codes(lengths, codes);
+
+    // Slow path: characters sorted by code, and where the codes of each length start and end
+    uint32_t index = 0;
+    uint32_t code = 0;
+    for(int length = 1; length <= MAX_CODE_LEN; length++){
+        dt->firstCode[length] = code;
+        dt->firstIndex[length] = index;
+        for(int i = 0; i < ALPHABET_SIZE; i++)
+            if(lengths[i] == length)
+                dt->sorted[index++] = (unsigned char)i;
+        code += lengthCount[length];
+        dt->limit[length] = (uint64_t)code << (32 - length);
+        code <<= 1;
+    }
+
+    // Fast path: the single character every short code resolves to
+    memset(dt->fast, 0, sizeof(dt->fast));
+    for(int i = 0; i < ALPHABET_SIZE; i++){
+        if(lengths[i] == 0 || lengths[i] > DECODE_TABLE_BITS)
+            continue;
+        int shift = DECODE_TABLE_BITS - lengths[i];
+        for(uint32_t j = codes[i] << shift; j < ((codes[i] + 1) << shift); j++){
+            dt->fast[j].symbols[0] = (unsigned char)i;
+            dt->fast[j].count = 1;
+            dt->fast[j].bits = lengths[i];
+        }
+    }
+    return 1;
+}
+
+int build_decode_table(const unsigned char lengths[], decode_table* dt){
+    if(!build_single_decode_table(lengths, dt))
+        return 0;
+
+    // Then add a second character wherever the bits left over hold another whole code. The lookups go to a copy
+    // of the single character table since entries are changed as we go.
+    decode_entry single[1 << DECODE_TABLE_BITS];
+    memcpy(single, dt->fast, sizeof(single));
+    for(uint32_t j = 0; j < (1u << DECODE_TABLE_BITS); j++){
+        decode_entry* e = &dt->fast[j];
+        if(e->count != 1)
+            continue;
+        const decode_entry* next = &single[(j << e->bits) & ((1u << DECODE_TABLE_BITS) - 1)];
+        if(next->count == 1 && next->bits <= DECODE_TABLE_BITS - e->bits){
+            e->symbols[1] = next->symbols[0];
+            e->count = 2;
+            e->bits += next->bits;
+        }
+    }
+    return 1;
+}
+
+/*
+Slow path of decode_buffer for codes that are longer than the fast table. "window" holds the next bits of the
+stream, left aligned. Returns the character, or -1 if the bits are not a code. The code length goes in *bits.
+*/
+static int decode_slow(const decode_table* dt, uint64_t window, unsigned int* bits){
+    uint64_t top = window >> 32;
+    for(int length = 1; length <= dt->maxLength; length++){
+        if(top < dt->limit[length]){
+            *bits = (unsigned int)length;
+            return dt->sorted[dt->firstIndex[length] + (uint32_t)(top >> (32 - length)) - dt->firstCode[length]];
+        }
+    }
+    return -1;
+}
+
+/*
+Decodes one bitstream from bit *bitPos of src until dst reaches dstEnd, leaving *bitPos after the last code.
+Shared by decode_buffer, the tails of decode_buffer_4 and decode_block_range.
+*/
+static int decode_stream(const decode_table* dt, const unsigned char* src, size_t srcSize, uint64_t* bitPosition, unsigned char* dst, unsigned char* dstEnd){
+    const uint64_t srcBits = (uint64_t)srcSize * 8;
+    uint64_t bitPos = *bitPosition;
+    const decode_entry* fast = dt->fast;
+    unsigned int bits = 0;
+    int symbol;
+
+    // Fast loop: a window of at least 57 bits is loaded straight from src, so it needs 8 readable bytes. Each lookup
+    // writes two characters, so it also needs room for 4 lookups in dst.
+    while(dstEnd - dst >= 8 && (bitPos >> 3) + 8 <= srcSize){
+        uint64_t window = load_u64_be(src + (bitPos >> 3)) << (bitPos & 7);
+        unsigned int used = 0;
+        int lookups = 0;
+        for(; lookups < 4; lookups++){    // 4 lookups use at most 44 of the 57 bits
+            const decode_entry e = fast[window >> (64 - DECODE_TABLE_BITS)];
+            if(e.count == 0)
+                break;
+            dst[0] = e.symbols[0];
+            dst[1] = e.symbols[1];
+            dst += e.count;
+            window <<= e.bits;
+            used += e.bits;
+        }
+        if(lookups == 0){    // Code longer than the fast table
+            if((symbol = decode_slow(dt, window, &bits)) < 0)
+                return 0;
+            *dst++ = (unsigned char)symbol;
+            used = bits;
+        }
+        bitPos += used;
+    }
+
+    // Tail: one character at a time through the slow path, with the window padded with zero bytes past the end of src
+    while(dst < dstEnd){
+        uint64_t window = load_u64_be_padded(src, srcSize, bitPos >> 3) << (bitPos & 7);
+        if((symbol = decode_slow(dt, window, &bits)) < 0)
+            return 0;
+        *dst++ = (unsigned char)symbol;
+        bitPos += bits;
+    }
+
+    *bitPosition = bitPos;
+    return bitPos <= srcBits;    // Running past the end of src means the stream was cut short
+}
+
+int decode_buffer(const decode_table* dt, const unsigned char* src, size_t srcSize, unsigned char* dst, size_t dstSize){
+    uint64_t bitPos = 0;
+    return decode_stream(dt, src, srcSize, &bitPos, dst, dst + dstSize);
+}
+
+int decode_buffer_4(const decode_table* dt, const unsigned char* const src[], const size_t srcSize[], unsigned char* dst, size_t dstSize){
+    const decode_entry* fast = dt->fast;
+    unsigned char* out[4];
+    unsigned char* end[4];
+    uint64_t bitPos[4] = {0, 0, 0, 0};
+    size_t segment = (dstSize + 3) / 4;
+    unsigned int bits = 0;
+
+    for(int k = 0; k < 4; k++){
+        out[k] = dst + (k * segment < dstSize ? k * segment : dstSize);
+        end[k] = dst + ((k + 1) * segment < dstSize ? (k + 1) * segment : dstSize);
+    }
+
+    // One lookup on one stream. Codes longer than the fast table go through the slow path without leaving the loop.
+#define DECODE_STEP(k) do {                                                         \
+        const decode_entry e = fast[window##k >> (64 - DECODE_TABLE_BITS)];         \
+        if(e.count != 0){                                                           \
+            out##k[0] = e.symbols[0];                                               \
+            out##k[1] = e.symbols[1];                                               \
+            out##k += e.count;                                                      \
+            window##k <<= e.bits;                                                   \
+            used##k += e.bits;                                                      \
+        }                                                                           \
+        else{                                                                       \
+            int symbol = decode_slow(dt, window##k, &bits);                         \
+            if(symbol < 0)                                                          \
+                return 0;                                                           \
+            *out##k++ = (unsigned char)symbol;                                      \
+            window##k <<= bits;                                                     \
+            used##k += bits;                                                        \
+        }                                                                           \
+    } while(0)
+
+    unsigned char* out0 = out[0];
+    unsigned char* out1 = out[1];
+    unsigned char* out2 = out[2];
+    unsigned char* out3 = out[3];
+
+    // Fast loop: same rules as the single stream loop, for all 4 streams at once. 4 lookups per stream use at most
+    // 48 of the 57 bits in each window.
+    while(end[0] - out0 >= 8 && end[1] - out1 >= 8 && end[2] - out2 >= 8 && end[3] - out3 >= 8
+        && (bitPos[0] >> 3) + 8 <= srcSize[0] && (bitPos[1] >> 3) + 8 <= srcSize[1]
+        && (bitPos[2] >> 3) + 8 <= srcSize[2] && (bitPos[3] >> 3) + 8 <= srcSize[3]){
+        uint64_t window0 = load_u64_be(src[0] + (bitPos[0] >> 3)) << (bitPos[0] & 7);
+        uint64_t window1 = load_u64_be(src[1] + (bitPos[1] >> 3)) << (bitPos[1] & 7);
+        uint64_t window2 = load_u64_be(src[2] + (bitPos[2] >> 3)) << (bitPos[2] & 7);
+        uint64_t window3 = load_u64_be(src[3] + (bitPos[3] >> 3)) << (bitPos[3] & 7);
+        unsigned int used0 = 0, used1 = 0, used2 = 0, used3 = 0;
+        for(int round = 0; round < 4; round++){
+            DECODE_STEP(0);
+            DECODE_STEP(1);
+            DECODE_STEP(2);
+            DECODE_STEP(3);
+        }
+        bitPos[0] += used0;
+        bitPos[1] += used1;
+        bitPos[2] += used2;
+        bitPos[3] += used3;
+    }
+#undef DECODE_STEP
+
+    // Each stream finishes its own segment
+    out[0] = out0;
+    out[1] = out1;
+    out[2] = out2;
+    out[3] = out3;
+    for(int k = 0; k < 4; k++)
+        if(!decode_stream(dt, src[k], srcSize[k], &bitPos[k], out[k], end[k]))
+            return 0;
+    return 1;
+}
+
+/*
+Reads the context map and code tables of an order-1 payload and builds a decode table for each code table. Returns 1
+if the payload is valid; the tables are then allocated and must be freed.
+*/
+static int load_order1_block(const unsigned char* payload, size_t payloadSize, order1_layout* layout){
+    if(payloadSize < 1 + ALPHABET_SIZE)
+        return 0;
+    layout->tableCount = payload[0] + 1;
+    memcpy(layout->tableOf, payload + 1, ALPHABET_SIZE);
+    for(int x = 0; x < ALPHABET_SIZE; x++)
+        if(layout->tableOf[x] >= layout->tableCount)
+            return 0;
+
+    layout->tables = malloc((size_t)layout->tableCount * sizeof(decode_table));
+    if(layout->tables == NULL)
+        return 0;
+    size_t used = 1 + ALPHABET_SIZE;
+    for(int t = 0; t < layout->tableCount; t++){
+        unsigned char lengths[ALPHABET_SIZE];
+        size_t tableSize = read_code_lengths(payload + used, payloadSize - used, lengths);
+        if(tableSize == 0 || !build_single_decode_table(lengths, &layout->tables[t])){
+            free(layout->tables);
+            return 0;
+        }
+        used += tableSize;
+    }
+    layout->stream = payload + used;
+    layout->streamSize = payloadSize - used;
+    return 1;
+}
+
+/*
+Order-1 version of decode_stream: decodes from bit *bitPosition until dst reaches dstEnd, looking up every code in
+the table of the character before it, which is kept in *previous between calls.
+*/
+static int decode_stream_order1(const order1_layout* layout, uint64_t* bitPosition, unsigned char* previous, unsigned char* dst, unsigned char* dstEnd){
+    const unsigned char* src = layout->stream;
+    const size_t srcSize = layout->streamSize;
+    uint64_t bitPos = *bitPosition;
+    unsigned char last = *previous;
+    unsigned int bits = 0;
+    int symbol;
+
+    // One lookup, through the slow path of the same table if the code is longer than the fast table
+#define DECODE_STEP() do {                                                          \
+        const decode_table* dt = &layout->tables[layout->tableOf[last]];            \
+        const decode_entry e = dt->fast[window >> (64 - DECODE_TABLE_BITS)];        \
+        if(e.count != 0){                                                           \
+            last = e.symbols[0];                                                    \
+            bits = e.bits;                                                          \
+        }                                                                           \
+        else{                                                                       \
+            if((symbol = decode_slow(dt, window, &bits)) < 0)                       \
+                return 0;                                                           \
+            last = (unsigned char)symbol;                                           \
+        }                                                                           \
+        *dst++ = last;                                                              \
+        window <<= bits;                                                            \
+        used += bits;                                                               \
+    } while(0)
+
+    // Fast loop: 4 codes of up to MAX_CODE_LEN bits per window of at least 57 bits
+    while(dstEnd - dst >= 4 && (bitPos >> 3) + 8 <= srcSize){
+        uint64_t window = load_u64_be(src + (bitPos >> 3)) << (bitPos & 7);
+        unsigned int used = 0;
+        DECODE_STEP();
+        DECODE_STEP();
+        DECODE_STEP();
+        DECODE_STEP();
+        bitPos += used;
+    }
+
+    // Tail: the window is padded with zero bytes past the end of src
+    while(dst < dstEnd){
+        uint64_t window = load_u64_be_padded(src, srcSize, bitPos >> 3) << (bitPos & 7);
+        unsigned int used = 0;
+        DECODE_STEP();
+        bitPos += used;
+    }
+#undef DECODE_STEP
+
+    *bitPosition = bitPos;
+    *previous = last;
+    return bitPos <= (uint64_t)srcSize * 8;
+}
+
+int decode_order1(const unsigned char* payload, size_t payloadSize, unsigned char* dst, size_t dstSize){
+    order1_layout layout;
+    uint64_t bitPos = 0;
+    unsigned char previous = 0;
+
+    if(!load_order1_block(payload, payloadSize, &layout))
+        return 0;
+    int result = decode_stream_order1(&layout, &bitPos, &previous, dst, dst + dstSize);
+    free(layout.tables);
+    return result;
+}
+
+/*
+decode_block_range for order-1 blocks, which have no checkpoints: the bytes before the range are decoded and dropped.
+*/
+static int decode_order1_range(const unsigned char* payload, size_t payloadSize, size_t from, size_t to, unsigned char* dst){
+    order1_layout layout;
+    unsigned char skipped[RANGE_SKIP_SIZE];
+    uint64_t bitPos = 0;
+    unsigned char previous = 0;
+    size_t position = 0;
+    int result = 1;
+
+    if(!load_order1_block(payload, payloadSize, &layout))
+        return 0;
+    while(result && position < from){
+        size_t size = from - position < RANGE_SKIP_SIZE ? from - position : RANGE_SKIP_SIZE;
+        result = decode_stream_order1(&layout, &bitPos, &previous, skipped, skipped + size);
+        position += size;
+    }
+    if(result)
+        result = decode_stream_order1(&layout, &bitPos, &previous, dst, dst + (to - from));
+    free(layout.tables);
+    return result;
+}
+
+int decode_block_range(decode_table* dt, const unsigned char* globalLengths, const unsigned char* payload, size_t payloadSize, size_t rawSize, unsigned char type, size_t from, size_t to, unsigned char* dst){
+    block_layout layout;
+    unsigned char skipped[RANGE_SKIP_SIZE];
+
+    // Any byte of a raw or RLE block is found directly
+    if((type & BLOCK_TYPE_MASK) == BLOCK_RAW && payloadSize == rawSize){
+        memcpy(dst, payload + from, to - from);
+        return 1;
+    }
+    if((type & BLOCK_TYPE_MASK) == BLOCK_RLE && payloadSize == 1){
+        memset(dst, payload[0], to - from);
+        return 1;
+    }
+    if((type & BLOCK_TYPE_MASK) == BLOCK_ORDER1)
+        return decode_order1_range(payload, payloadSize, from, to, dst);
+    if((type & BLOCK_TYPE_MASK) != BLOCK_HUFFMAN && (type & BLOCK_TYPE_MASK) != BLOCK_GLOBAL)
+        return 0;
+
+    if(!parse_block(payload, payloadSize, rawSize, type, globalLengths, &layout) || !build_decode_table(layout.lengths, dt))
+        return 0;
+
+    // With 4 bitstreams the range can run over from one segment into the next, so it is decoded a segment at a time
+    size_t segment = layout.streams == 4 ? (rawSize + 3) / 4 : rawSize;
+    while(from < to){
+        size_t k = from / segment;
+        size_t segmentEnd = (k + 1) * segment < rawSize ? (k + 1) * segment : rawSize;
+        size_t stop = to < segmentEnd ? to : segmentEnd;
+
+        // Start at the segment, or at the last checkpoint before "from" if it is inside this segment
+        size_t position = k * segment;
+        uint64_t bitPos = 0;
+        size_t checkpoint = from / CHECKPOINT_INTERVAL;
+        if(layout.checkpoints != NULL && checkpoint > 0 && checkpoint * CHECKPOINT_INTERVAL > position){
+            position = checkpoint * CHECKPOINT_INTERVAL;
+            bitPos = load_u32_le(layout.checkpoints + 4 * (checkpoint - 1));
+        }
+
+        // Decode and drop the bytes before the range, then decode the range itself
+        while(position < from){
+            size_t size = from - position < RANGE_SKIP_SIZE ? from - position : RANGE_SKIP_SIZE;
+            if(!decode_stream(dt, layout.stream[k], layout.streamSize[k], &bitPos, skipped, skipped + size))
+                return 0;
+            position += size;
+        }
+        if(!decode_stream(dt, layout.stream[k], layout.streamSize[k], &bitPos, dst, dst + (stop - from)))
+            return 0;
+        dst += stop - from;
+        from = stop;
+    }
+    return 1;
+}
+
+/*
+Records the depth and frequency of every leaf below "node". Depths are kept as ints since an unlimited tree can be
+much deeper than MAX_CODE_LEN.
+*/
+static void collect_leaf_depths(const tree_node nodes[], uint16_t node, int depth, int depths[], uint64_t weights[])
+{
+    if(nodes[node].left == NO_NODE && nodes[node].right == NO_NODE)
+    {
+        depths[(unsigned char)nodes[node].value] = depth;
+        weights[(unsigned char)nodes[node].value] = nodes[node].frequency;
+        return;
+    }
+    collect_leaf_depths(nodes, nodes[node].left, depth + 1, depths, weights);
+    collect_leaf_depths(nodes, nodes[node].right, depth + 1, depths, weights);
+}
+
+//Shailendra
+void assign_codes_to_table(const tree_node nodes[], uint16_t huffman_root, table* t, unsigned char lengths[])
+{
+    int depths[ALPHABET_SIZE];
+    uint64_t weights[ALPHABET_SIZE];
+    unsigned int codes[ALPHABET_SIZE];
+    int maxDepth = 0;
+
+    memset(depths, 0, sizeof(depths));
+    memset(weights, 0, sizeof(weights));
+    memset(lengths, 0, ALPHABET_SIZE);
+
+    //A single character still needs a one bit code
+    if(nodes[huffman_root].left == NO_NODE && nodes[huffman_root].right == NO_NODE)
+    {
+        lengths[(unsigned char)nodes[huffman_root].value] = 1;
+    }
+    else
+    {
+        collect_leaf_depths(nodes, huffman_root, 0, depths, weights);
+        for(int i = 0; i < ALPHABET_SIZE; i++)
+        {
+            lengths[i] = (unsigned char)(depths[i] > MAX_CODE_LEN ? MAX_CODE_LEN : depths[i]);
+            if(depths[i] > maxDepth)
+            {
+                maxDepth = depths[i];
+            }
+        }
+
+        //Tree is too deep, so work out the best lengths that fit in MAX_CODE_LEN instead
+        if(maxDepth > MAX_CODE_LEN)
+        {
+            limit_code_lengths(weights, lengths, MAX_CODE_LEN);
+        }
+    }
+
+    compute_canonical_codes(lengths, codes);
+
+    //Every table node is updated directly from the arrays, no searching needed
+    for(int i = 0; i < t->count; i++)
+    {
+        t->nodes[i].length = lengths[(unsigned char)t->nodes[i].value];
+        t->nodes[i].code = codes[(unsigned char)t->nodes[i].value];
+    }
+}
+
+//Tatiana
+table* convert_to_table(huffman_arena* arena, const unsigned char* src, size_t size) {
+    uint64_t counts[ALPHABET_SIZE];
+
+    //assuming input.txt is already opened and in memory
+    memset(counts, 0, sizeof(counts));
+    count_frequencies(src, size, counts);
+
+    return histogram_to_table(arena, counts);
+}
+
+void count_frequencies(const unsigned char* src, size_t size, uint64_t counts[]) {
+    uint32_t sub[4][ALPHABET_SIZE];
+
+    while (size > 0) {
+        //32 bit counters are enough for one chunk, and take half the cache of 64 bit ones
+        size_t chunk = size < HISTOGRAM_CHUNK ? size : HISTOGRAM_CHUNK;
+        size_t i = 0;
+        memset(sub, 0, sizeof(sub));
+
+        for (; i + 8 <= chunk; i += 8) {
+            uint64_t word;
+            memcpy(&word, src + i, 8); //one load for 8 bytes, split with shifts
+            sub[0][word & 0xFF]++;
+            sub[1][(word >> 8) & 0xFF]++;
+            sub[2][(word >> 16) & 0xFF]++;
+            sub[3][(word >> 24) & 0xFF]++;
+            sub[0][(word >> 32) & 0xFF]++;
+            sub[1][(word >> 40) & 0xFF]++;
+            sub[2][(word >> 48) & 0xFF]++;
+            sub[3][word >> 56]++;
+        }
+        for (; i < chunk; i++) {
+            sub[0][src[i]]++;
+        }
+
+        for (int c = 0; c < ALPHABET_SIZE; c++) {
+            counts[c] += (uint64_t)sub[0][c] + sub[1][c] + sub[2][c] + sub[3][c];
+        }
+        src += chunk;
+        size -= chunk;
+    }
+}
+
+//log2(1 + i / 2^LOG2_TABLE_BITS) for every i, filled in once by fill_log2_table
+static double log2Table[(1 << LOG2_TABLE_BITS) + 1];
+static pthread_once_t log2TableOnce = PTHREAD_ONCE_INIT;
+
+/*
+Fills log2Table one bit at a time: squaring x doubles its log2, so the next bit is 1 whenever the square reaches 2.
+This keeps the program free of the math library.
+*/
+static void fill_log2_table(void) {
+    for (int i = 0; i <= (1 << LOG2_TABLE_BITS); i++) {
+        double x = 1.0 + (double)i / (1 << LOG2_TABLE_BITS);
+        double result = 0.0;
+        if (x >= 2.0) {
+            x /= 2.0;
+            result = 1.0;
+        }
+        for (double bit = 0.5; bit > 1e-12; bit /= 2) {
+            x *= x;
+            if (x >= 2.0) {
+                x /= 2.0;
+                result += bit;
+            }
+        }
+        log2Table[i] = result;
+    }
+}
+
+/*
+log2 of x (x > 0): the position of its top bit plus the log2 of the rest, interpolated between table entries. Good
+to a few millionths, plenty for estimating sizes.
+*/
+static double fast_log2(uint64_t x) {
+    int exponent = 63 - __builtin_clzll(x);
+    uint64_t fraction = exponent >= 32 ? (x >> (exponent - 32)) & 0xFFFFFFFFu : (x << (32 - exponent)) & 0xFFFFFFFFu;
+    uint32_t index = (uint32_t)(fraction >> (32 - LOG2_TABLE_BITS));
+    double weight = (double)(fraction & ((1u << (32 - LOG2_TABLE_BITS)) - 1)) / (1u << (32 - LOG2_TABLE_BITS));
+    return exponent + log2Table[index] + (log2Table[index + 1] - log2Table[index]) * weight;
+}
+
+int choose_block_type(const uint64_t counts[], double* bits) {
+    uint64_t total = 0;
+    int unique = 0;
+    for (int c = 0; c < ALPHABET_SIZE; c++) {
+        total += counts[c];
+        unique += counts[c] != 0;
+    }
+
+    double rawBits = 8.0 * (BLOCK_HEADER_SIZE + total);
+    if (unique == 1) {
+        *bits = 8.0 * (BLOCK_HEADER_SIZE + 1);
+        return BLOCK_RLE;
+    }
+    *bits = estimate_block_bits(counts);
+    if (*bits > rawBits - rawBits / RAW_MIN_SAVING) {
+        *bits = rawBits;
+        return BLOCK_RAW;
+    }
+    return BLOCK_HUFFMAN;
+}
+
+static double entropy_bits(const uint64_t counts[]) {
+    uint64_t total = 0;
+    double sum = 0.0;
+
+    pthread_once(&log2TableOnce, fill_log2_table);
+
+    //Entropy in bits is total * log2(total) - the sum of count * log2(count)
+    for (int c = 0; c < ALPHABET_SIZE; c++) {
+        if (counts[c] != 0) {
+            total += counts[c];
+            sum += (double)counts[c] * fast_log2(counts[c]);
+        }
+    }
+    return total > 0 ? (double)total * fast_log2(total) - sum : 0.0;
+}
+
+double estimate_block_bits(const uint64_t counts[]) {
+    uint64_t total = 0;
+    int unique = 0;
+
+    for (int c = 0; c < ALPHABET_SIZE; c++) {
+        total += counts[c];
+        unique += counts[c] != 0;
+    }
+    double bits = entropy_bits(counts);
+    if (bits < (double)total) {
+        bits = (double)total;
+    }
+    return bits + 8.0 * (BLOCK_HEADER_SIZE + ALPHABET_SIZE / 8 + (unique + 1) / 2);
+}
+
+double estimate_cross_bits(const uint64_t counts[], const uint64_t model[]) {
+    uint64_t total = 0;
+    double sum = 0.0;
+
+    pthread_once(&log2TableOnce, fill_log2_table);
+
+    //Each character costs log2(model total / model count) bits
+    for (int c = 0; c < ALPHABET_SIZE; c++) {
+        total += model[c];
+    }
+    double bits = 0.0;
+    for (int c = 0; c < ALPHABET_SIZE; c++) {
+        if (counts[c] != 0) {
+            bits += (double)counts[c] * (fast_log2(total) - fast_log2(model[c]));
+            sum += (double)counts[c];
+        }
+    }
+    return bits < sum ? sum : bits;
+}
+
+table* histogram_to_table(huffman_arena* arena, const uint64_t counts[]) {
+    table *t = create_table(arena);
+
+    //Nodes are added in character order
+    for (int c = 0; c < ALPHABET_SIZE; c++) {
+        if (counts[c] != 0) {
+            create_table_node(t, (char)c, counts[c]);
+        }
+    }
+
+    return t;
+}
+
+//Tatiana
+table_node* search_for_table_node(char character, table *t) {
+    for (int i = 0; i < t->count; i++) {
+        if (t->nodes[i].value == character) {
+            return &t->nodes[i];
+        }
+    }
+
+    return NULL;
+}
+
+//Adam
+pq* new_pq (huffman_arena* arena){ //empties the arena's priority queue
+    pq* pq1 = &arena->queue;
+    pq1->nodes = arena->treeNodes;
+    pq1->leafHead = 0;
+    pq1->leafCount = 0;
+    pq1->combinedHead = 0;
+    pq1->nodeCount = 0;
+    return pq1;
+}
+
+// qsort wrapper around node_compare for the leaf queue
+static int compare_leaf_nodes(const void* a, const void* b) {
+    return node_compare((const tree_node*)a, (const tree_node*)b);
+}
+
+//Christine
+pq* table_to_queue(huffman_arena* arena, table* t) {
+  
+  pq *queue = new_pq(arena);             // Empties the arena's pq, which has room for the whole tree
+
+  // Goes through the length of the table (table_count)
+  for (int i = 0; i < t->count; i++) {
+
+    // Makes a new leaf in the pq's node storage, using the table node's value / freq
+    tree_node *tree = &queue->nodes[queue->nodeCount++];
+    tree->value = t->nodes[i].value;
+    tree->frequency = t->nodes[i].frequency;
+    tree->left = NO_NODE;
+    tree->right = NO_NODE;
+    // Yeet it into the distance
+    queue->leafCount++;
+  }
+
+  // One sort up front instead of one sorted insert per node. The leaves are sorted in place, and the combined
+  // nodes will start right after them.
+  qsort(queue->nodes, (size_t)queue->leafCount, sizeof(tree_node), compare_leaf_nodes);
+  queue->combinedHead = queue->leafCount;
+
+  return queue;
+}
+
+void benchmark_tree_build(void)
+{
+    uint64_t seed = 88172645463325252ULL;
+
+    //One arena for every build, as when compressing blocks
+    huffman_arena* arena = create_arena(MAX_ARENA_LEAVES);
+    if(arena == NULL)
+    {
+        return;
+    }
+
+    printf("%10s %10s %14s %14s\n", "Alphabet", "Builds", "us/build", "ns/symbol");
+    for(int size = 2; size <= MAX_ARENA_LEAVES; size *= 2)
+    {
+        //Table with random frequencies, spread over a wide range like real character counts
+        reset_arena(arena);
+        table* t = create_table(arena);
+        for(int i = 0; i < size; i++)
+        {
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+            create_table_node(t, (char)i, 1 + seed % 1000000);
+        }
+
+        //Repeat small builds so every size runs for a similar amount of time
+        int builds = 1 + (4 * 1024 * 1024) / (size * 16);
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(int b = 0; b < builds; b++)
+        {
+            pq* queue = table_to_queue(arena, t);
+            huffman_process(queue);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+        printf("%10d %10d %14.2f %14.2f\n", size, builds, seconds / builds * 1e6, seconds / builds / size * 1e9);
+    }
+
+    free_arena(arena);
+}
+
+/*
+Monotonic wall clock time in seconds.
+*/
+static double wall_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+/*
+Fills "dst" with "size" bytes of generated input of one kind: 0 English text, 1 skewed bytes, 2 uniform random
+bytes, 3 long runs of a single byte. The same kind and size always give the same bytes.
+*/
+static void generate_corpus(int kind, unsigned char* dst, size_t size)
+{
+    static const char* const words[] = {
+        "the", "of", "and", "to", "a", "in", "that", "is", "was", "he", "for", "it", "with", "as", "his", "on", "be",
+        "at", "by", "had", "not", "are", "but", "from", "or", "have", "an", "they", "which", "one", "you", "were",
+        "her", "all", "she", "there", "would", "their", "we", "him", "been", "has", "when", "who", "will", "more",
+        "no", "if", "out", "so", "said", "what", "up", "its", "about", "into", "than", "them", "can", "only", "other",
+        "time", "could", "these", "two", "may", "then", "do", "first", "any", "my", "now", "such", "like", "our",
+        "over", "man", "me", "even", "most", "made", "after", "also", "did", "many", "before", "must", "through",
+        "back", "years", "where", "much", "your", "way", "well", "down", "should", "because", "each", "just", "those",
+        "people", "how", "too", "little", "state", "good", "very", "make", "world", "still", "own", "see", "men",
+        "work", "long", "get", "here", "between", "both", "life", "being", "under", "never", "day", "same", "another",
+        "know", "while", "last", "might", "great", "old", "year", "off", "come", "since", "against", "go", "came",
+        "right", "used", "take", "three", "Jean", "Valjean", "Marius", "Cosette", "Javert", "Paris", "barricade"};
+    static const char* const separators[] = {" ", " ", " ", " ", " ", " ", " ", " ", " ", " ", ", ", ", ", ". ", ".\n", "; ", "\n\n"};
+    const uint64_t wordCount = sizeof(words) / sizeof(words[0]);
+    uint64_t seed = 88172645463325252ULL ^ ((uint64_t)(kind + 1) * 0x9E3779B97F4A7C15ULL);
+    size_t i = 0;
+
+    while(i < size)
+    {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+
+        if(kind == 0)
+        {
+            //The product of two uniform numbers favours the common words at the front of the list
+            uint64_t word = (((seed & 0xFFFF) * ((seed >> 16) & 0xFFFF)) * wordCount) >> 32;
+            const char* separator = separators[(seed >> 40) & 15];
+            for(const char* c = words[word]; *c != '\0' && i < size; c++)
+            {
+                dst[i++] = (unsigned char)*c;
+            }
+            for(const char* c = separator; *c != '\0' && i < size; c++)
+            {
+                dst[i++] = (unsigned char)*c;
+            }
+        }
+        else if(kind == 1)
+        {
+            //Geometric: each character is half as likely as the one before it
+            dst[i++] = (unsigned char)('a' + __builtin_ctzll(seed | (1ULL << 40)));
+        }
+        else if(kind == 2)
+        {
+            size_t take = size - i < 8 ? size - i : 8;
+            memcpy(dst + i, &seed, take);
+            i += take;
+        }
+        else
+        {
+            //Runs of up to 64 KiB of one character
+            size_t run = 1 + (size_t)((seed >> 8) & 0xFFFF);
+            for(; run > 0 && i < size; run--)
+            {
+                dst[i++] = (unsigned char)seed;
+            }
+        }
+    }
+}
+
+void benchmark_stages(size_t maxSize)
+{
+    static const char* const corpusNames[BENCH_CORPUS_KINDS] = {"english", "skewed", "uniform", "runs"};
+    size_t maxBlocks = (maxSize + DEFAULT_BLOCK_SIZE - 1) / DEFAULT_BLOCK_SIZE;
+    size_t blockBound = block_bound(DEFAULT_BLOCK_SIZE);
+
+    unsigned char* src = malloc(maxSize);
+    unsigned char* decoded = malloc(maxSize);
+    unsigned char* compressed = malloc(maxBlocks * blockBound);
+    size_t* payloadSizes = malloc(maxBlocks * sizeof(size_t));
+    huffman_arena* arena = create_arena(ALPHABET_SIZE);
+    if(src == NULL || decoded == NULL || compressed == NULL || payloadSizes == NULL || arena == NULL)
+    {
+        printf("ERROR --> Not enough memory for a %zu byte benchmark.\n", maxSize);
+        free(src);
+        free(decoded);
+        free(compressed);
+        free(payloadSizes);
+        if(arena != NULL)
+        {
+            free_arena(arena);
+        }
+        return;
+    }
+
+    //The benchmark runs on this thread alone, so the counters need no atomics
+    countAllocations = 1;
+
+    //Runs "statement" as part of stage "stage", adding its time and allocations to the stage's totals
+#define TIMED_STAGE(stage, statement) do {                                          \
+        size_t allocationsBefore = allocationCount;                                 \
+        double startTime = wall_seconds();                                          \
+        statement;                                                                  \
+        seconds[stage] += wall_seconds() - startTime;                               \
+        allocations[stage] += allocationCount - allocationsBefore;                  \
+    } while(0)
+
+    //Order-1 coding is timed whole, from histogram to block, next to its ratio and decode speed. Every block is coded
+    //with order-1 tables, even where -1 would pick raw, RLE or order-0, so these columns compare with the ones before.
+
+    printf("%-8s %10s %7s %10s %10s %10s %10s %10s %7s %10s %10s  %s\n", "Corpus", "Bytes", "Ratio", "histogram", "tree",
+        "codes", "encode", "decode", "-1 ratio", "-1 encode", "-1 decode", "allocs/block");
+    printf("%-8s %10s %7s %10s %10s %10s %10s %10s %7s %10s %10s  %s\n", "", "", "", "MB/s", "MB/s", "MB/s", "MB/s", "MB/s",
+        "", "MB/s", "MB/s", "h/t/c/e/d");
+    for(int kind = 0; kind < BENCH_CORPUS_KINDS; kind++)
+    {
+        //1 KiB, 16 KiB, 256 KiB, 4 MiB, 64 MiB, 1 GiB
+        for(size_t size = 1024; size <= maxSize; size *= 16)
+        {
+            double seconds[BENCH_STAGES] = {0};
+            size_t allocations[BENCH_STAGES] = {0};
+            size_t blocks = (size + DEFAULT_BLOCK_SIZE - 1) / DEFAULT_BLOCK_SIZE;
+            size_t repeats = 1 + (16u << 20) / size;    //Small inputs are repeated to about 16 MiB of work
+            uint64_t fileSize = 0;
+            int ok = 1;
+
+            generate_corpus(kind, src, size);
+            for(size_t r = 0; r < repeats; r++)
+            {
+                //Same blocks, stages and block layout as compress_file, but one stage at a time
+                fileSize = HUF_HEADER_SIZE + BLOCK_HEADER_SIZE + blocks * 8 + HUF_FOOTER_SIZE;
+                for(size_t b = 0; b < blocks; b++)
+                {
+                    const unsigned char* block = src + b * DEFAULT_BLOCK_SIZE;
+                    size_t blockSize = size - b * DEFAULT_BLOCK_SIZE < DEFAULT_BLOCK_SIZE ? size - b * DEFAULT_BLOCK_SIZE : DEFAULT_BLOCK_SIZE;
+                    uint64_t counts[ALPHABET_SIZE];
+                    unsigned char lengths[ALPHABET_SIZE];
+                    table* valueTable = NULL;
+                    pq* huffmanQueue = NULL;
+                    uint16_t huffmanTree = NO_NODE;
+
+                    TIMED_STAGE(0, memset(counts, 0, sizeof(counts)); count_frequencies(block, blockSize, counts));
+                    TIMED_STAGE(1, reset_arena(arena); valueTable = histogram_to_table(arena, counts);
+                        huffmanQueue = table_to_queue(arena, valueTable); huffmanTree = huffman_process(huffmanQueue));
+                    TIMED_STAGE(2, assign_codes_to_table(huffmanQueue->nodes, huffmanTree, valueTable, lengths));
+                    TIMED_STAGE(3, payloadSizes[b] = encode(valueTable, lengths, block, blockSize, compressed + b * blockBound, 1));
+                    fileSize += BLOCK_HEADER_SIZE + payloadSizes[b];
+                }
+                for(size_t b = 0; b < blocks; b++)
+                {
+                    unsigned char* block = decoded + b * DEFAULT_BLOCK_SIZE;
+                    size_t blockSize = size - b * DEFAULT_BLOCK_SIZE < DEFAULT_BLOCK_SIZE ? size - b * DEFAULT_BLOCK_SIZE : DEFAULT_BLOCK_SIZE;
+                    TIMED_STAGE(4, ok = decode(compressed + b * blockBound, payloadSizes[b], block, blockSize, BLOCK_HUFFMAN) && ok);
+                }
+            }
+            ok = ok && memcmp(src, decoded, size) == 0;
+
+            double order1Seconds[2] = {0.0, 0.0};
+            uint64_t order1FileSize = 0;
+            for(size_t r = 0; r < repeats; r++)
+            {
+                order1FileSize = HUF_HEADER_SIZE + BLOCK_HEADER_SIZE + blocks * 8 + HUF_FOOTER_SIZE;
+                double startTime = wall_seconds();
+                for(size_t b = 0; b < blocks; b++)
+                {
+                    const unsigned char* block = src + b * DEFAULT_BLOCK_SIZE;
+                    size_t blockSize = size - b * DEFAULT_BLOCK_SIZE < DEFAULT_BLOCK_SIZE ? size - b * DEFAULT_BLOCK_SIZE : DEFAULT_BLOCK_SIZE;
+                    uint64_t counts[ALPHABET_SIZE];
+                    memset(counts, 0, sizeof(counts));
+                    count_frequencies(block, blockSize, counts);
+                    reset_arena(arena);
+                    payloadSizes[b] = plan_order1_block(block, blockSize, counts, arena) == 0 ? 0
+                        : store_order1_block(block, blockSize, compressed + b * blockBound, arena->contexts);
+                    ok = payloadSizes[b] != 0 && ok;
+                    order1FileSize += payloadSizes[b];
+                }
+                order1Seconds[0] += wall_seconds() - startTime;
+                startTime = wall_seconds();
+                for(size_t b = 0; b < blocks; b++)
+                {
+                    const unsigned char* header = compressed + b * blockBound;
+                    ok = decode(header + BLOCK_HEADER_SIZE, load_u32_le(header + 4), decoded + b * DEFAULT_BLOCK_SIZE,
+                        load_u32_le(header), header[8]) && ok;
+                }
+                order1Seconds[1] += wall_seconds() - startTime;
+            }
+            ok = ok && memcmp(src, decoded, size) == 0;
+
+            double megabytes = (double)size * (double)repeats / 1e6;
+            printf("%-8s %10zu %7.3f", corpusNames[kind], size, (double)size / (double)fileSize);
+            for(int stage = 0; stage < BENCH_STAGES; stage++)
+            {
+                printf(" %10.1f", seconds[stage] > 0 ? megabytes / seconds[stage] : 0.0);
+            }
+            printf(" %7.3f", (double)size / (double)order1FileSize);
+            for(int stage = 0; stage < 2; stage++)
+            {
+                printf(" %10.1f", order1Seconds[stage] > 0 ? megabytes / order1Seconds[stage] : 0.0);
+            }
+            printf("  ");
+            for(int stage = 0; stage < BENCH_STAGES; stage++)
+            {
+                printf("%s%g", stage > 0 ? "/" : "", (double)allocations[stage] / (double)(repeats * blocks));
+            }
+            printf("%s\n", ok ? "" : "  DECODE FAILED");
+        }
+    }
+#undef TIMED_STAGE
+    countAllocations = 0;
+
+    free(src);
+    free(decoded);
+    free(compressed);
+    free(payloadSizes);
+    free_arena(arena);
+}
+
+int train_dictionary_file(const char* path, uint32_t id, char* const samples[], int sampleCount)
+{
+    unsigned char dictionary[HUFFMAN_DICTIONARY_MAX_SIZE];
+    uint64_t counts[ALPHABET_SIZE];
+
+    //The samples are trained on as if they were one file
+    memset(counts, 0, sizeof(counts));
+    for(int i = 0; i < sampleCount; i++)
+    {
+        input_span sample;
+        if(!open_input(samples[i], &sample))
+        {
+            return 0;
+        }
+        count_frequencies(sample.data, sample.size, counts);
+        close_input(&sample);
+    }
+
+    size_t size = store_dictionary(counts, id, dictionary);
+    output_sink* output = open_sink(path);
+    if(size == 0 || output == NULL)
+    {
+        if(output != NULL)
+        {
+            close_sink(output);
+        }
+        return 0;
+    }
+    sink_write(output, dictionary, size);
+    return close_sink(output);
+}
+
+int dictionary_stream(int mode, const char* dictionaryPath, const char* inputPath, run_stats* stats)
+{
+    input_span dictionaryFile;
+    input_span input;
+    uint64_t startNanos = stats != NULL ? monotonic_nanos() : 0;
+    uint64_t lap = startNanos;
+    if(!open_input(dictionaryPath, &dictionaryFile))
+    {
+        return 0;
+    }
+    huffman_dictionary* dict = huffman_load_dictionary(dictionaryFile.data, dictionaryFile.size);
+    close_input(&dictionaryFile);
+    if(dict == NULL || !open_input(inputPath != NULL ? inputPath : "/dev/stdin", &input))
+    {
+        huffman_free_dictionary(dict);
+        return 0;
+    }
+    if(stats != NULL)
+    {
+        //Loading the dictionary builds its decode table, which is part of decoding
+        lap = lap_stage(stats, mode == 'c' ? STAGE_TABLES : STAGE_DECODE, lap);
+    }
+
+    //The whole record is coded at once, so find out how big the result can be first
+    size_t capacity;
+    if(mode == 'c')
+    {
+        capacity = huffman_dictionary_bound(input.size);
+    }
+    else
+    {
+        uint64_t rawSize;
+        size_t used = load_varint(input.data, input.size, &rawSize);
+        capacity = used != 0 && load_varint(input.data + used, input.size - used, &rawSize) != 0 ? (size_t)rawSize : 0;
+    }
+
+    huffman_context* ctx = huffman_create_context();
+    output_sink* output = open_sink_fd(STDOUT_FILENO);
+    unsigned char* dst = output != NULL ? sink_reserve(output, capacity) : NULL;
+    size_t size = HUFFMAN_ERROR;
+    if(ctx != NULL && dst != NULL)
+    {
+        size = mode == 'c' ? huffman_compress_with_dictionary(ctx, dict, input.data, input.size, dst, capacity)
+                           : huffman_decompress_with_dictionary(dict, input.data, input.size, dst, capacity);
+    }
+    if(size != HUFFMAN_ERROR && stats != NULL)
+    {
+        //Every character is coded with the dictionary's code for it
+        thread_stats* own = &stats->threads[0];
+        lap_stage(stats, mode == 'c' ? STAGE_ENCODE : STAGE_DECODE, lap);
+        count_frequencies(mode == 'c' ? input.data : dst, mode == 'c' ? input.size : size, own->counts);
+        for(int c = 0; c < ALPHABET_SIZE; c++)
+        {
+            if(own->counts[c] != 0)
+            {
+                count_code_length(own, dict->codes[c].length, own->counts[c]);
+            }
+        }
+        finish_bitstream_stats(stats, CODING_DICTIONARY, mode == 'c' ? input.size : size, mode == 'c' ? size : input.size, startNanos);
+    }
+    if(size != HUFFMAN_ERROR)
+    {
+        sink_commit(output, size);
+    }
+
+    int ok = size != HUFFMAN_ERROR;
+    if(output != NULL)
+    {
+        ok = close_sink(output) && ok;
+    }
+    huffman_free_context(ctx);
+    huffman_free_dictionary(dict);
+    close_input(&input);
+    return ok;
+}
+
+void compute_canonical_codes(const unsigned char lengths[], unsigned int codes[])
+{
+    unsigned int lengthCount[MAX_CODE_LEN + 1];
+    unsigned int nextCode[MAX_CODE_LEN + 1];
+    unsigned int code = 0;
+
+    //Count how many codes there are of each length
+    memset(lengthCount, 0, sizeof(lengthCount));
+    for(int i = 0; i < ALPHABET_SIZE; i++)
+    {
+        lengthCount[lengths[i]]++;
+    }
+    lengthCount[0] = 0;
+
+    //First code of each length follows on from the last code of the previous length
+    for(int length = 1; length <= MAX_CODE_LEN; length++)
+    {
+        code = (code + lengthCount[length - 1]) << 1;
+        nextCode[length] = code;
+    }
+
+    //Hand out codes in character order within each length
+    for(int i = 0; i < ALPHABET_SIZE; i++)
+    {
+        codes[i] = 0;
+        if(lengths[i] != 0)
+        {
+            codes[i] = nextCode[lengths[i]]++;
+        }
+    }
+}
+
+/*
+Sorts characters by weight, lightest first, for package-merge. Ties go to the lower character.
+*/
+static int compare_weighted_symbols(const void* a, const void* b)
+{
+    const uint64_t* x = a;
+    const uint64_t* y = b;
+    if(x[0] != y[0])
+    {
+        return x[0] < y[0] ? -1 : 1;
+    }
+    return x[1] < y[1] ? -1 : (x[1] > y[1]);
+}
+
+void limit_code_lengths(const uint64_t weights[], unsigned char lengths[], int maxLength)
+{
+    uint64_t leaves[ALPHABET_SIZE][2];    //Weight and character of each used character
+    uint64_t listA[2 * ALPHABET_SIZE];
+    uint64_t listB[2 * ALPHABET_SIZE];
+    unsigned char isLeaf[MAX_CODE_LEN][2 * ALPHABET_SIZE];
+    int listSize[MAX_CODE_LEN];
+    int n = 0;
+
+    memset(lengths, 0, ALPHABET_SIZE);
+    for(int i = 0; i < ALPHABET_SIZE; i++)
+    {
+        if(weights[i] != 0)
+        {
+            leaves[n][0] = weights[i];
+            leaves[n][1] = (uint64_t)i;
+            n++;
+        }
+    }
+    if(n < 2)
+    {
+        if(n == 1)
+        {
+            lengths[leaves[0][1]] = 1;
+        }
+        return;
+    }
+    qsort(leaves, (size_t)n, sizeof(leaves[0]), compare_weighted_symbols);
+
+    //Level 0 is just the leaves. Each following level merges the leaves with the pairs ("packages") of the level
+    //before it. Only whether each item is a leaf is remembered, which is enough to count the leaves used below.
+    uint64_t* previous = listA;
+    uint64_t* current = listB;
+    for(int i = 0; i < n; i++)
+    {
+        previous[i] = leaves[i][0];
+        isLeaf[0][i] = 1;
+    }
+    listSize[0] = n;
+
+    for(int level = 1; level < maxLength; level++)
+    {
+        int packages = listSize[level - 1] / 2;
+        int leaf = 0;
+        int package = 0;
+        int size = 0;
+        while(leaf < n || package < packages)
+        {
+            uint64_t packageWeight = package < packages ? previous[2 * package] + previous[2 * package + 1] : 0;
+            if(package >= packages || (leaf < n && leaves[leaf][0] <= packageWeight))
+            {
+                current[size] = leaves[leaf++][0];
+                isLeaf[level][size++] = 1;
+            }
+            else
+            {
+                current[size] = packageWeight;
+                isLeaf[level][size++] = 0;
+                package++;
+            }
+        }
+        listSize[level] = size;
+        uint64_t* swap = previous;
+        previous = current;
+        current = swap;
+    }
+
+    //The first 2n - 2 items of the last level make up the solution. Going back down, every leaf among the selected
+    //items adds one bit to that character's code, and every package selects two items of the level below.
+    int selected = 2 * n - 2;
+    for(int level = maxLength - 1; level >= 0; level--)
+    {
+        int leavesUsed = 0;
+        for(int i = 0; i < selected; i++)
+        {
+            leavesUsed += isLeaf[level][i];
+        }
+        for(int i = 0; i < leavesUsed; i++)
+        {
+            lengths[leaves[i][1]]++;
+        }
+        selected = 2 * (selected - leavesUsed);
+    }
+}
+
+size_t write_code_lengths(const unsigned char lengths[], unsigned char* out)
+{
+    size_t size = ALPHABET_SIZE / 8;
+    int present = 0;
+
+    memset(out, 0, ALPHABET_SIZE / 8);
+    for(int i = 0; i < ALPHABET_SIZE; i++)
+    {
+        if(lengths[i] == 0)
+        {
+            continue;
+        }
+        out[i >> 3] |= (unsigned char)(1 << (i & 7));
+        if(present % 2 == 0)
+        {
+            out[size++] = lengths[i];
+        }
+        else
+        {
+            out[size - 1] |= (unsigned char)(lengths[i] << 4);
+        }
+        present++;
+    }
+    return size;
+}
+
+size_t read_code_lengths(const unsigned char* in, size_t available, unsigned char lengths[])
+{
+    size_t size = ALPHABET_SIZE / 8;
+    int present = 0;
+
+    if(available < size)
+    {
+        return 0;
+    }
+    for(int i = 0; i < ALPHABET_SIZE; i++)
+    {
+        lengths[i] = 0;
+        if(!(in[i >> 3] & (1 << (i & 7))))
+        {
+            continue;
+        }
+        if(present % 2 == 0 && size++ >= available)
+        {
+            return 0;
+        }
+        lengths[i] = (present % 2 == 0) ? (in[size - 1] & 0x0F) : (in[size - 1] >> 4);
+        if(lengths[i] == 0)
+        {
+            return 0;
+        }
+        present++;
+    }
+    return size;
+}
+
+int open_input(const char* path, input_span* in)
+{
+    struct stat info;
+    int fd = open(path, O_RDONLY);
+
+    memset(in, 0, sizeof(*in));
+    if(fd < 0)
+    {
+        return 0;
+    }
+    if(fstat(fd, &info) != 0)
+    {
+        close(fd);
+        return 0;
+    }
+
+    //Regular files are mapped, so counting and encoding read the page cache directly with no copies
+    if(S_ISREG(info.st_mode) && info.st_size > 0)
+    {
+        void* mapping = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapping != MAP_FAILED)
+        {
+            madvise(mapping, (size_t)info.st_size, MADV_SEQUENTIAL);
+            close(fd);
+            in->mapping = mapping;
+            in->data = mapping;
+            in->size = (size_t)info.st_size;
+            return 1;
+        }
+    }
+
+    //Anything else is read into a buffer
+    int ok = read_input(fd, in);
+    close(fd);
+    return ok;
+}
+
+int read_input(int fd, input_span* in)
+{
+    //Read once into a buffer that doubles as it fills
+    size_t capacity = READ_CHUNK_SIZE;
+    memset(in, 0, sizeof(*in));
+    in->buffer = malloc(capacity);
+    while(in->buffer != NULL)
+    {
+        if(in->size == capacity)
+        {
+            unsigned char* grown = realloc(in->buffer, capacity * 2);
+            if(grown == NULL)
+            {
+                break;
+            }
+            in->buffer = grown;
+            capacity *= 2;
+        }
+
+        ssize_t got = read(fd, in->buffer + in->size, capacity - in->size);
+        if(got == 0)
+        {
+            in->data = in->buffer;
+            return 1;
+        }
+        if(got < 0)
+        {
+            break;
+        }
+        in->size += (size_t)got;
+    }
+
+    free(in->buffer);
+    memset(in, 0, sizeof(*in));
+    return 0;
+}
+
+void close_input(input_span* in)
+{
+    if(in->mapping != NULL)
+    {
+        munmap(in->mapping, in->size);
+    }
+    free(in->buffer);
+    memset(in, 0, sizeof(*in));
+}
+
+output_sink* open_sink(const char* path)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+    {
+        return NULL;
+    }
+
+    output_sink* sink = open_sink_fd(fd);
+    if(sink == NULL)
+    {
+        close(fd);
+    }
+    return sink;
+}
+
+output_sink* open_sink_fd(int fd)
+{
+    output_sink* sink = malloc(sizeof(output_sink));
+    if(sink == NULL)
+    {
+        return NULL;
+    }
+
+    sink->fd = fd;
+    sink->buffer = malloc(SINK_BUFFER_SIZE);
+    sink->used = 0;
+    sink->capacity = SINK_BUFFER_SIZE;
+    sink->written = 0;
+    sink->failed = 0;
+    sink->pipe = NULL;
+    if(sink->buffer == NULL)
+    {
+        free(sink);
+        return NULL;
+    }
+    return sink;
+}
+
+/*
+Writes "size" bytes to a file. Returns 0 if any write does not go through.
+*/
+static int write_all(int fd, const unsigned char* data, size_t size)
+{
+    while(size > 0)
+    {
+        ssize_t result = write(fd, data, size);
+        if(result <= 0)
+        {
+            return 0;
+        }
+        data += result;
+        size -= (size_t)result;
+    }
+    return 1;
+}
+
+/*
+Writes "size" bytes to the sink's file, marking the sink as failed if any write does not go through.
+*/
+static void sink_write_all(output_sink* sink, const unsigned char* data, size_t size)
+{
+    if(!sink->failed && !write_all(sink->fd, data, size))
+    {
+        sink->failed = 1;
+    }
+}
+
+static unsigned char* pipe_push(io_pipe* writer, size_t size, size_t* capacity);
+
+void sink_flush(output_sink* sink)
+{
+    //With a writer thread the buffer is handed over whole, and the next free one of its ring is filled instead
+    if(sink->pipe != NULL)
+    {
+        if(sink->used > 0)
+        {
+            sink->buffer = pipe_push(sink->pipe, sink->used, &sink->capacity);
+        }
+        sink->used = 0;
+        return;
+    }
+    sink_write_all(sink, sink->buffer, sink->used);
+    sink->used = 0;
+}
+
+unsigned char* sink_reserve(output_sink* sink, size_t size)
+{
+    if(sink->used + size > sink->capacity)
+    {
+        sink_flush(sink);
+    }
+
+    //Bigger than the whole buffer, so grow it to fit
+    if(size > sink->capacity)
+    {
+        unsigned char* grown = realloc(sink->buffer, size);
+        if(grown == NULL)
+        {
+            return NULL;
+        }
+        sink->buffer = grown;
+        sink->capacity = size;
+        if(sink->pipe != NULL)
+        {
+            sink->pipe->buffers[sink->pipe->head] = grown;
+            sink->pipe->capacities[sink->pipe->head] = size;
+        }
+    }
+    return sink->buffer + sink->used;
+}
+
+void sink_commit(output_sink* sink, size_t size)
+{
+    sink->used += size;
+    sink->written += size;
+}
+
+void sink_write(output_sink* sink, const void* data, size_t size)
+{
+    sink->written += size;
+
+    //With a writer thread everything goes through its ring, in order, a buffer at a time
+    while(sink->pipe != NULL && size > sink->capacity - sink->used)
+    {
+        size_t take = sink->capacity - sink->used;
+        memcpy(sink->buffer + sink->used, data, take);
+        sink->used += take;
+        data = (const unsigned char*)data + take;
+        size -= take;
+        sink_flush(sink);
+    }
+
+    //Large writes skip the buffer
+    if(size >= sink->capacity && sink->pipe == NULL)
+    {
+        sink_flush(sink);
+        sink_write_all(sink, data, size);
+        return;
+    }
+
+    unsigned char* dst = sink_reserve(sink, size);
+    memcpy(dst, data, size);
+    sink->used += size;
+}
+
+static int close_writer(io_pipe* writer);
+
+int close_sink(output_sink* sink)
+{
+    sink_flush(sink);
+    if(sink->pipe != NULL)
+    {
+        //The buffers belong to the writer's ring
+        sink->failed |= !close_writer(sink->pipe);
+        sink->buffer = NULL;
+    }
+    int ok = !sink->failed && close(sink->fd) == 0;
+    free(sink->buffer);
+    free(sink);
+    return ok;
+}
+
+#ifdef HAVE_IO_URING
+/*
+Unmaps and closes an io_uring and frees it.
+*/
+static void close_ring(io_ring* ring)
+{
+    if(ring->sqRing != NULL)
+    {
+        munmap(ring->sqRing, ring->sqRingSize);
+    }
+    if(ring->cqRing != NULL)
+    {
+        munmap(ring->cqRing, ring->cqRingSize);
+    }
+    if(ring->sqes != NULL)
+    {
+        munmap(ring->sqes, ring->sqesSize);
+    }
+    close(ring->fd);
+    free(ring);
+}
+
+/*
+Maps a region of an io_uring. Returns NULL if it cannot be mapped.
+*/
+static void* map_ring(int fd, size_t size, off_t offset)
+{
+    void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+    return mapping != MAP_FAILED ? mapping : NULL;
+}
+
+/*
+Sets up an io_uring with room for URING_DEPTH requests. Returns NULL if the kernel has no io_uring, does not allow
+it, or cannot read and write at the file's current position, so the caller falls back to read and write.
+*/
+static io_ring* open_ring(void)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int)syscall(__NR_io_uring_setup, URING_DEPTH, &params);
+    if(fd < 0)
+    {
+        return NULL;
+    }
+    io_ring* ring = calloc(1, sizeof(io_ring));
+    if(ring == NULL || !(params.features & IORING_FEAT_RW_CUR_POS))
+    {
+        free(ring);
+        close(fd);
+        return NULL;
+    }
+
+    ring->fd = fd;
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqRing = map_ring(fd, ring->sqRingSize, IORING_OFF_SQ_RING);
+    ring->cqRing = map_ring(fd, ring->cqRingSize, IORING_OFF_CQ_RING);
+    ring->sqes = map_ring(fd, ring->sqesSize, IORING_OFF_SQES);
+    if(ring->sqRing == NULL || ring->cqRing == NULL || ring->sqes == NULL)
+    {
+        close_ring(ring);
+        return NULL;
+    }
+    ring->sqTail = (unsigned*)(ring->sqRing + params.sq_off.tail);
+    ring->sqMask = (unsigned*)(ring->sqRing + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned*)(ring->sqRing + params.sq_off.array);
+    ring->cqHead = (unsigned*)(ring->cqRing + params.cq_off.head);
+    ring->cqTail = (unsigned*)(ring->cqRing + params.cq_off.tail);
+    ring->cqMask = (unsigned*)(ring->cqRing + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(ring->cqRing + params.cq_off.cqes);
+    return ring;
+}
+
+/*
+Queues "count" reads or writes (IORING_OP_READ or IORING_OP_WRITE) of a file at its current position, linked so
+they run in order, and waits for all of them. results[i] gets what read or write would have returned for request i,
+as a negative errno on failure; a request after one that came up short is cancelled (-ECANCELED). Returns 0 if the
+ring itself failed.
+*/
+static int ring_transfer(io_ring* ring, int opcode, int fd, unsigned char* const buffers[], const size_t sizes[], int count, ssize_t results[])
+{
+    unsigned tail = *ring->sqTail;
+    for(int i = 0; i < count; i++)
+    {
+        unsigned index = tail & *ring->sqMask;
+        struct io_uring_sqe* sqe = &ring->sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = (unsigned char)opcode;
+        sqe->fd = fd;
+        sqe->off = (uint64_t)-1;    //The current position, which advances like it does for read and write
+        sqe->addr = (uint64_t)(uintptr_t)buffers[i];
+        sqe->len = (uint32_t)sizes[i];
+        sqe->flags = i + 1 < count ? IOSQE_IO_LINK : 0;
+        sqe->user_data = (uint64_t)i;
+        ring->sqArray[index] = index;
+        tail++;
+    }
+    __atomic_store_n(ring->sqTail, tail, __ATOMIC_RELEASE);
+
+    int submitted = 0;
+    int completed = 0;
+    while(completed < count)
+    {
+        long entered = syscall(__NR_io_uring_enter, ring->fd, count - submitted, count - completed, IORING_ENTER_GETEVENTS, NULL, 0);
+        if(entered < 0 && errno != EINTR)
+        {
+            return 0;
+        }
+        if(entered > 0)
+        {
+            submitted += (int)entered;
+        }
+
+        unsigned head = *ring->cqHead;
+        unsigned cqTail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+        for(; head != cqTail; head++)
+        {
+            const struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cqMask];
+            results[cqe->user_data] = cqe->res;
+            completed++;
+        }
+        __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+    }
+    return 1;
+}
+#endif
+
+/*
+Fills a buffer of a reader's ring from its file, through io_uring if it has one: the buffer is cut into up to
+URING_DEPTH pieces that are all read in one go. Returns the number of bytes read, less than "capacity" only at the
+end of the file, or -1 if reading failed. A partial reader reads once, and returns 0 only at the end of the file.
+*/
+static ssize_t pipe_fill(io_pipe* reader, unsigned char* buffer, size_t capacity)
+{
+#ifdef HAVE_IO_URING
+    if(reader->ring != NULL && reader->partial)
+    {
+        unsigned char* pieces[1] = { buffer };
+        size_t sizes[1] = { capacity < URING_MAX_PIECE ? capacity : URING_MAX_PIECE };
+        ssize_t results[1];
+        if(!ring_transfer(reader->ring, IORING_OP_READ, reader->fd, pieces, sizes, 1, results))
+        {
+            return -1;
+        }
+        return results[0] >= 0 ? results[0] : -1;
+    }
+    if(reader->ring != NULL)
+    {
+        size_t total = 0;
+        while(total < capacity)
+        {
+            unsigned char* pieces[URING_DEPTH];
+            size_t sizes[URING_DEPTH];
+            ssize_t results[URING_DEPTH];
+            size_t piece = (capacity - total + URING_DEPTH - 1) / URING_DEPTH;
+            piece = piece < URING_MAX_PIECE ? piece : URING_MAX_PIECE;
+            int count = 0;
+            for(size_t at = total; count < URING_DEPTH && at < capacity; at += piece, count++)
+            {
+                pieces[count] = buffer + at;
+                sizes[count] = capacity - at < piece ? capacity - at : piece;
+            }
+            if(!ring_transfer(reader->ring, IORING_OP_READ, reader->fd, pieces, sizes, count, results))
+            {
+                return -1;
+            }
+
+            //A short read (from a pipe, say) cancels the reads after it, which are tried again on the next round
+            for(int i = 0; i < count; i++)
+            {
+                if(results[i] == -ECANCELED)
+                {
+                    break;
+                }
+                if(results[i] < 0)
+                {
+                    return -1;
+                }
+                if(results[i] == 0)
+                {
+                    return (ssize_t)total;
+                }
+                if(pieces[i] != buffer + total)
+                {
+                    memmove(buffer + total, pieces[i], (size_t)results[i]);
+                }
+                total += (size_t)results[i];
+            }
+        }
+        return (ssize_t)total;
+    }
+#endif
+    if(reader->partial)
+    {
+        ssize_t got;
+        while((got = read(reader->fd, buffer, capacity)) < 0 && errno == EINTR)
+        {
+        }
+        return got;
+    }
+    return read_full(reader->fd, buffer, capacity);
+}
+
+/*
+Writes "count" buffers of a writer's ring, starting at "first", to its file, through io_uring if it has one. Whatever
+io_uring reports as not written (after a short or cancelled write) is written with write. Returns 0 if a write failed,
+or if io_uring itself failed part way: some of the linked writes may have landed by then, so none is written again.
+*/
+static int pipe_drain(io_pipe* writer, int first, int count)
+{
+    int written = 0;    //Buffers written whole
+    size_t partial = 0;    //Bytes of the next buffer already written
+#ifdef HAVE_IO_URING
+    if(writer->ring != NULL)
+    {
+        unsigned char* buffers[URING_DEPTH];
+        size_t sizes[URING_DEPTH];
+        ssize_t results[URING_DEPTH];
+        for(int i = 0; i < count; i++)
+        {
+            buffers[i] = writer->buffers[(first + i) % writer->slots];
+            sizes[i] = writer->sizes[(first + i) % writer->slots];
+        }
+        if(!ring_transfer(writer->ring, IORING_OP_WRITE, writer->fd, buffers, sizes, count, results))
+        {
+            return 0;
+        }
+        for(; written < count && results[written] == (ssize_t)sizes[written]; written++)
+        {
+        }
+        if(written < count && results[written] > 0)
+        {
+            partial = (size_t)results[written];
+        }
+    }
+#endif
+    for(; written < count; written++)
+    {
+        int slot = (first + written) % writer->slots;
+        if(!write_all(writer->fd, writer->buffers[slot] + partial, writer->sizes[slot] - partial))
+        {
+            return 0;
+        }
+        partial = 0;
+    }
+    return 1;
+}
+
+/*
+Reader thread: fills free buffers of the ring until the file ends, reading fails or the reader is stopped.
+*/
+static void* reader_thread(void* argument)
+{
+    io_pipe* reader = argument;
+    for(;;)
+    {
+        uint64_t start = monotonic_nanos();
+        pthread_mutex_lock(&reader->lock);
+        while(!reader->stop && reader->full == reader->slots)
+        {
+            pthread_cond_wait(&reader->changed, &reader->lock);
+        }
+        int slot = reader->head;
+        int stop = reader->stop;
+        reader->reading = !stop;
+        pthread_mutex_unlock(&reader->lock);
+        if(stop)
+        {
+            break;
+        }
+
+        uint64_t filling = monotonic_nanos();
+        ssize_t got = pipe_fill(reader, reader->buffers[slot], reader->capacities[slot]);
+        uint64_t filled = monotonic_nanos();
+
+        //A failed read adds no buffer, and a buffer that is not full is the last (for a partial reader, an empty one)
+        pthread_mutex_lock(&reader->lock);
+        reader->reading = 0;
+        reader->stats->readWait += filling - start;
+        reader->stats->readBusy += filled - filling;
+        if(got < 0)
+        {
+            reader->failed = 1;
+        }
+        else if(got > 0 || !reader->partial)
+        {
+            reader->sizes[slot] = (size_t)got;
+            reader->head = (reader->head + 1) % reader->slots;
+            reader->full++;
+        }
+        reader->done = got < 0 || (reader->partial ? got == 0 : (size_t)got < reader->capacities[slot]);
+        int done = reader->done;
+        pthread_cond_broadcast(&reader->changed);
+        pthread_mutex_unlock(&reader->lock);
+        if(done)
+        {
+            break;
+        }
+    }
+    return NULL;
+}
+
+/*
+Writer thread: writes full buffers of the ring, up to URING_DEPTH at a time, until the sink is closed. After a write
+fails the rest are dropped, so the coder is never left waiting.
+*/
+static void* writer_thread(void* argument)
+{
+    io_pipe* writer = argument;
+    int ok = 1;
+    for(;;)
+    {
+        uint64_t start = monotonic_nanos();
+        pthread_mutex_lock(&writer->lock);
+        while(writer->full == 0 && !writer->done)
+        {
+            pthread_cond_wait(&writer->changed, &writer->lock);
+        }
+        int first = writer->tail;
+        int count = writer->full < URING_DEPTH ? writer->full : URING_DEPTH;
+        pthread_mutex_unlock(&writer->lock);
+        if(count == 0)
+        {
+            break;
+        }
+
+        //Without io_uring one buffer at a time, so each is free again as soon as it is written
+        uint64_t writing = monotonic_nanos();
+        count = writer->ring != NULL ? count : 1;
+        ok = ok && pipe_drain(writer, first, count);
+        writer->stats->writeWait += writing - start;
+        writer->stats->writeBusy += monotonic_nanos() - writing;
+
+        pthread_mutex_lock(&writer->lock);
+        writer->tail = (writer->tail + count) % writer->slots;
+        writer->full -= count;
+        writer->failed = !ok;
+        pthread_cond_broadcast(&writer->changed);
+        pthread_mutex_unlock(&writer->lock);
+    }
+    return NULL;
+}
+
+/*
+Frees a pipe's buffers, ring and locks, and the pipe.
+*/
+static void free_pipe(io_pipe* pipe)
+{
+    for(int i = 0; i < pipe->slots; i++)
+    {
+        free(pipe->buffers[i]);
+    }
+#ifdef HAVE_IO_URING
+    if(pipe->ring != NULL)
+    {
+        close_ring(pipe->ring);
+    }
+#endif
+    pthread_mutex_destroy(&pipe->lock);
+    pthread_cond_destroy(&pipe->changed);
+    free(pipe);
+}
+
+/*
+Creates a ring of "slots" buffers of "capacity" bytes and starts "thread" on it. "partial" is only used by readers. Returns NULL if memory ran out or
+the thread could not be started.
+*/
+static io_pipe* open_pipe(int fd, size_t capacity, int slots, int partial, const stream_io* io, void* (*thread)(void*))
+{
+    io_pipe* pipe = calloc(1, sizeof(io_pipe));
+    if(pipe == NULL)
+    {
+        return NULL;
+    }
+    pipe->fd = fd;
+    pipe->slots = slots;
+    pipe->partial = partial;
+    pipe->stats = io != NULL && io->stats != NULL ? io->stats : &pipe->ownStats;
+    pthread_mutex_init(&pipe->lock, NULL);
+    pthread_cond_init(&pipe->changed, NULL);
+    int ok = 1;
+    for(int i = 0; i < slots; i++)
+    {
+        pipe->buffers[i] = malloc(capacity);
+        pipe->capacities[i] = capacity;
+        ok = ok && pipe->buffers[i] != NULL;
+    }
+#ifdef HAVE_IO_URING
+    if(io != NULL && io->uring)
+    {
+        pipe->ring = open_ring();
+    }
+#endif
+    pipe->stats->uring |= pipe->ring != NULL;
+    if(!ok || pthread_create(&pipe->thread, NULL, thread, pipe) != 0)
+    {
+        free_pipe(pipe);
+        return NULL;
+    }
+    return pipe;
+}
+
+output_sink* open_sink_pipelined(int fd, const stream_io* io)
+{
+    output_sink* sink = open_sink_fd(fd);
+    if(sink == NULL)
+    {
+        return NULL;
+    }
+
+    //The sink fills the buffer at the head of the writer's ring instead of its own
+    sink->pipe = open_pipe(fd, SINK_BUFFER_SIZE, WRITE_SLOTS, 0, io, writer_thread);
+    if(sink->pipe != NULL)
+    {
+        free(sink->buffer);
+        sink->buffer = sink->pipe->buffers[0];
+        sink->capacity = sink->pipe->capacities[0];
+        sink->pipe->stats->outputSlots = WRITE_SLOTS;
+    }
+    return sink;
+}
+
+/*
+Hands the buffer at the head of a writer's ring, holding "size" bytes, to the writer thread, then waits for the next
+buffer to be free. Returns that buffer, with its size in *capacity.
+*/
+static unsigned char* pipe_push(io_pipe* writer, size_t size, size_t* capacity)
+{
+    pthread_mutex_lock(&writer->lock);
+    writer->sizes[writer->head] = size;
+    writer->head = (writer->head + 1) % writer->slots;
+    writer->full++;
+    writer->stats->outputFull += (uint64_t)writer->full;
+    writer->stats->outputSamples++;
+    pthread_cond_broadcast(&writer->changed);
+    if(writer->full == writer->slots)
+    {
+        uint64_t start = monotonic_nanos();
+        while(writer->full == writer->slots)
+        {
+            pthread_cond_wait(&writer->changed, &writer->lock);
+        }
+        writer->stats->codeOutputWait += monotonic_nanos() - start;
+    }
+    unsigned char* buffer = writer->buffers[writer->head];
+    *capacity = writer->capacities[writer->head];
+    pthread_mutex_unlock(&writer->lock);
+    return buffer;
+}
+
+/*
+Waits for the writer thread to write everything handed to it, then frees the writer. Returns 0 if a write failed.
+*/
+static int close_writer(io_pipe* writer)
+{
+    pthread_mutex_lock(&writer->lock);
+    writer->done = 1;
+    pthread_cond_broadcast(&writer->changed);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread, NULL);
+    int ok = !writer->failed;
+    free_pipe(writer);
+    return ok;
+}
+
+io_pipe* open_reader(int fd, size_t capacity, int slots, int partial, const stream_io* io)
+{
+    io_pipe* reader = open_pipe(fd, capacity, slots, partial, io, reader_thread);
+    if(reader != NULL)
+    {
+        reader->stats->inputSlots = slots;
+    }
+    return reader;
+}
+
+const unsigned char* pipe_acquire(io_pipe* reader, size_t* size)
+{
+    pthread_mutex_lock(&reader->lock);
+    if(reader->full == 0 && !reader->done)
+    {
+        uint64_t start = monotonic_nanos();
+        while(reader->full == 0 && !reader->done)
+        {
+            pthread_cond_wait(&reader->changed, &reader->lock);
+        }
+        reader->stats->codeInputWait += monotonic_nanos() - start;
+    }
+    if(reader->consumed == 0)
+    {
+        reader->stats->inputFull += (uint64_t)reader->full;
+        reader->stats->inputSamples++;
+    }
+    const unsigned char* buffer = reader->full > 0 ? reader->buffers[reader->tail] : NULL;
+    *size = reader->full > 0 ? reader->sizes[reader->tail] : 0;
+    pthread_mutex_unlock(&reader->lock);
+    return buffer;
+}
+
+void pipe_release(io_pipe* reader)
+{
+    pthread_mutex_lock(&reader->lock);
+    reader->tail = (reader->tail + 1) % reader->slots;
+    reader->full--;
+    reader->consumed = 0;
+    pthread_cond_broadcast(&reader->changed);
+    pthread_mutex_unlock(&reader->lock);
+}
+
+ssize_t pipe_read(io_pipe* reader, unsigned char* dst, size_t size)
+{
+    size_t total = 0;
+    while(total < size)
+    {
+        size_t available;
+        const unsigned char* buffer = pipe_acquire(reader, &available);
+        if(buffer == NULL)
+        {
+            break;
+        }
+        size_t take = available - reader->consumed < size - total ? available - reader->consumed : size - total;
+        memcpy(dst + total, buffer + reader->consumed, take);
+        reader->consumed += take;
+        total += take;
+        if(reader->consumed == available)
+        {
+            pipe_release(reader);
+        }
+    }
+
+    //A read failure is only reported once everything read before it has been taken
+    if(total < size && reader->failed)
+    {
+        return -1;
+    }
+    return (ssize_t)total;
+}
+
+void close_reader(io_pipe* reader)
+{
+    //A reader still inside read may wait there for as long as whoever writes the pipe likes, so when the coder
+    //gives up early the thread is left to finish on its own, with its ring and its own stats
+    pthread_mutex_lock(&reader->lock);
+    reader->stop = 1;
+    int reading = reader->reading;
+    if(reading)
+    {
+        reader->stats = &reader->ownStats;
+    }
+    pthread_cond_broadcast(&reader->changed);
+    pthread_mutex_unlock(&reader->lock);
+    if(reading)
+    {
+        pthread_detach(reader->thread);
+        return;
+    }
+    pthread_join(reader->thread, NULL);
+    free_pipe(reader);
+}
+
+void report_pipeline(const pipeline_stats* stats, double seconds)
+{
+    double total = seconds > 0 ? seconds * 1e9 : 1;
+    fprintf(stderr, "pipeline: %.3f s, %s\n", seconds, stats->uring ? "io_uring" : "read and write");
+    if(stats->inputSlots > 0)
+    {
+        fprintf(stderr, "  reader  reading %5.1f%%  waiting for the coder  %5.1f%%  buffers full %.1f of %d\n",
+            100.0 * (double)stats->readBusy / total, 100.0 * (double)stats->readWait / total,
+            stats->inputSamples > 0 ? (double)stats->inputFull / (double)stats->inputSamples : 0.0, stats->inputSlots);
+    }
+    double waiting = (double)(stats->codeInputWait + stats->codeOutputWait);
+    fprintf(stderr, "  coder   coding  %5.1f%%  waiting for input      %5.1f%%  waiting for the writer %5.1f%%\n",
+        100.0 * (total - waiting) / total, 100.0 * (double)stats->codeInputWait / total,
+        100.0 * (double)stats->codeOutputWait / total);
+    if(stats->outputSlots > 0)
+    {
+        fprintf(stderr, "  writer  writing %5.1f%%  waiting for the coder  %5.1f%%  buffers full %.1f of %d\n",
+            100.0 * (double)stats->writeBusy / total, 100.0 * (double)stats->writeWait / total,
+            stats->outputSamples > 0 ? (double)stats->outputFull / (double)stats->outputSamples : 0.0, stats->outputSlots);
+    }
+}
+
+/*
+Runs the indices left in range "id", front first, then steals the back half of the largest other range until every
+range is empty. Returns the number of tasks run.
+*/
+static size_t run_ranges(thread_pool* pool, int id)
+{
+    pool_range* own = &pool->ranges[id];
+    size_t ran = 0;
+    for(;;)
+    {
+        size_t index = SIZE_MAX;
+        pthread_mutex_lock(&own->lock);
+        if(own->begin < own->end)
+        {
+            index = own->begin++;
+        }
+        pthread_mutex_unlock(&own->lock);
+        if(index != SIZE_MAX)
+        {
+            pool->task(pool->context, index);
+            ran++;
+            continue;
+        }
+
+        //Out of work: find the range with most left, and take the back half of it (or its last index)
+        int victim = -1;
+        size_t most = 0;
+        for(int i = 0; i <= pool->threadCount; i++)
+        {
+            pthread_mutex_lock(&pool->ranges[i].lock);
+            size_t left = pool->ranges[i].end - pool->ranges[i].begin;
+            pthread_mutex_unlock(&pool->ranges[i].lock);
+            if(left > most)
+            {
+                most = left;
+                victim = i;
+            }
+        }
+        if(victim < 0)
+        {
+            return ran;
+        }
+        pthread_mutex_lock(&pool->ranges[victim].lock);
+        size_t left = pool->ranges[victim].end - pool->ranges[victim].begin;
+        size_t stolenEnd = pool->ranges[victim].end;
+        pool->ranges[victim].end -= (left + 1) / 2;
+        size_t stolenBegin = pool->ranges[victim].end;
+        pthread_mutex_unlock(&pool->ranges[victim].lock);
+
+        pthread_mutex_lock(&own->lock);
+        own->begin = stolenBegin;
+        own->end = stolenEnd;
+        pthread_mutex_unlock(&own->lock);
+    }
+}
+
+/*
+Worker thread: takes indices of the current batch until the pool is stopped.
+*/
+static void* pool_worker(void* argument)
+{
+    thread_pool* pool = argument;
+    size_t seenBatch = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    int id = pool->started++;
+    poolThread = id + 1;
+    for(;;)
+    {
+        while(!pool->stop && pool->next >= pool->count && pool->stealingBatch == seenBatch)
+        {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        if(pool->stop)
+        {
+            break;
+        }
+
+        //A work stealing batch: run this thread's range, then help the others
+        if(pool->stealingBatch != seenBatch)
+        {
+            seenBatch = pool->stealingBatch;
+            pthread_mutex_unlock(&pool->lock);
+            size_t ran = run_ranges(pool, id);
+            pthread_mutex_lock(&pool->lock);
+            pool->finished += ran;
+            if(ran > 0 && pool->finished == pool->count)
+            {
+                pthread_cond_signal(&pool->done);
+            }
+            continue;
+        }
+
+        size_t index = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+        pool->task(pool->context, index);
+        pthread_mutex_lock(&pool->lock);
+
+        if(++pool->finished == pool->count)
+        {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+thread_pool* create_pool(int threads)
+{
+    thread_pool* pool = calloc(1, sizeof(thread_pool));
+    if(pool == NULL)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    //The thread calling pool_run is one of the workers
+    pool->threads = malloc(sizeof(pthread_t) * (threads > 1 ? threads - 1 : 1));
+    pool->ranges = calloc(threads > 1 ? threads : 1, sizeof(pool_range));
+    if(pool->threads == NULL || pool->ranges == NULL)
+    {
+        destroy_pool(pool);
+        return NULL;
+    }
+    for(int i = 0; i < (threads > 1 ? threads : 1); i++)
+    {
+        pthread_mutex_init(&pool->ranges[i].lock, NULL);
+    }
+    for(int i = 0; i < threads - 1; i++)
+    {
+        if(pthread_create(&pool->threads[i], NULL, pool_worker, pool) != 0)
+        {
+            break;
+        }
+        pool->threadCount++;
+    }
+    return pool;
+}
+
+void pool_run(thread_pool* pool, pool_task task, void* context, size_t count)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->context = context;
+    pool->next = 0;
+    pool->count = count;
+    pool->finished = 0;
+    pthread_cond_broadcast(&pool->wake);
+
+    //Work on the batch alongside the pool, then wait for the tasks other threads still have running
+    while(pool->next < pool->count)
+    {
+        size_t index = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+        task(context, index);
+        pthread_mutex_lock(&pool->lock);
+        pool->finished++;
+    }
+    while(pool->finished < pool->count)
+    {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_run_stealing(thread_pool* pool, pool_task task, void* context, size_t count)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->context = context;
+    pool->next = count;    //Nothing for pool_run's way of handing out indices
+    pool->count = count;
+    pool->finished = 0;
+
+    //Every thread starts with an equal share of neighbouring indices
+    int parts = pool->threadCount + 1;
+    for(int i = 0; i < parts; i++)
+    {
+        pthread_mutex_lock(&pool->ranges[i].lock);
+        pool->ranges[i].begin = count * (size_t)i / (size_t)parts;
+        pool->ranges[i].end = count * (size_t)(i + 1) / (size_t)parts;
+        pthread_mutex_unlock(&pool->ranges[i].lock);
+    }
+    pool->stealingBatch++;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    size_t ran = run_ranges(pool, pool->threadCount);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->finished += ran;
+    while(pool->finished < pool->count)
+    {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void destroy_pool(thread_pool* pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for(int i = 0; i < pool->threadCount; i++)
+    {
+        pthread_join(pool->threads[i], NULL);
+    }
+    for(int i = 0; pool->ranges != NULL && i <= pool->threadCount; i++)
+    {
+        pthread_mutex_destroy(&pool->ranges[i].lock);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->done);
+    free(pool->ranges);
+    free(pool->threads);
+    free(pool);
+}
+
+//Archives----------------------------------------------------------------------------------------------------------------
+
+/*
+1 if "name" can be created under the directory an archive is extracted into: not empty, not absolute, not a
+directory, and without a ".." part that would climb out of it.
+*/
+static int safe_archive_name(const char* name, size_t length)
+{
+    if(length == 0 || length > ARCHIVE_MAX_NAME || name[0] == '/' || name[length - 1] == '/' || memchr(name, '\0', length) != NULL)
+    {
+        return 0;
+    }
+    for(size_t start = 0; start < length; )
+    {
+        size_t end = start;
+        while(end < length && name[end] != '/')
+        {
+            end++;
+        }
+        if(end - start == 2 && name[start] == '.' && name[start + 1] == '.')
+        {
+            return 0;
+        }
+        start = end + 1;
+    }
+    return 1;
+}
+
+/*
+Adds a regular file to the list, under its path without a leading "/" or "./".
+*/
+static int add_archive_file(archive_list* list, const char* path, const struct stat* status)
+{
+    const char* name = path;
+    while(name[0] == '/' || (name[0] == '.' && name[1] == '/'))
+    {
+        name += name[0] == '/' ? 1 : 2;
+    }
+    if(!safe_archive_name(name, strlen(name)))
+    {
+        fprintf(stderr, "ERROR --> %s cannot be stored in an archive.\n", path);
+        return 0;
+    }
+
+    if(list->count == list->capacity)
+    {
+        size_t capacity = list->capacity > 0 ? list->capacity * 2 : 64;
+        archive_entry* grown = realloc(list->entries, capacity * sizeof(archive_entry));
+        if(grown == NULL)
+        {
+            return 0;
+        }
+        list->entries = grown;
+        list->capacity = capacity;
+    }
+    archive_entry* entry = &list->entries[list->count];
+    entry->source = strdup(path);
+    if(entry->source == NULL)
+    {
+        return 0;
+    }
+    entry->name = entry->source + (name - path);
+    entry->offset = list->totalSize;
+    entry->size = (uint64_t)status->st_size;
+    entry->mode = (uint32_t)status->st_mode & 0777;
+    list->totalSize += entry->size;
+    list->count++;
+    return 1;
+}
+
+static int add_archive_path(archive_list* list, const char* path);
+
+static int compare_names(const void* a, const void* b)
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/*
+Adds everything under a directory, sorted by name so the same tree always gives the same archive.
+*/
+static int add_archive_directory(archive_list* list, const char* path)
+{
+    DIR* directory = opendir(path);
+    if(directory == NULL)
+    {
+        fprintf(stderr, "ERROR --> Unable to open %s.\n", path);
+        return 0;
+    }
+    char** names = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    int ok = 1;
+    struct dirent* item;
+    while(ok && (item = readdir(directory)) != NULL)
+    {
+        if(strcmp(item->d_name, ".") == 0 || strcmp(item->d_name, "..") == 0)
+        {
+            continue;
+        }
+        if(count == capacity)
+        {
+            capacity = capacity > 0 ? capacity * 2 : 64;
+            char** grown = realloc(names, capacity * sizeof(char*));
+            if(grown == NULL)
+            {
+                ok = 0;
+                break;
+            }
+            names = grown;
+        }
+        names[count] = strdup(item->d_name);
+        ok = names[count] != NULL;
+        count += (size_t)ok;
+    }
+    closedir(directory);
+    if(count > 0)
+    {
+        qsort(names, count, sizeof(char*), compare_names);
+    }
+
+    size_t pathLength = strlen(path);
+    const char* separator = pathLength > 0 && path[pathLength - 1] == '/' ? "" : "/";
+    for(size_t i = 0; i < count; i++)
+    {
+        if(ok)
+        {
+            char* child = malloc(pathLength + strlen(names[i]) + 2);
+            ok = child != NULL;
+            if(ok)
+            {
+                sprintf(child, "%s%s%s", path, separator, names[i]);
+                ok = add_archive_path(list, child);
+                free(child);
+            }
+        }
+        free(names[i]);
+    }
+    free(names);
+    return ok;
+}
+
+/*
+Adds a file or directory, without looking for "@" as archive_add_path does.
+*/
+static int add_archive_path(archive_list* list, const char* path)
+{
+    struct stat status;
+    if(lstat(path, &status) != 0)
+    {
+        fprintf(stderr, "ERROR --> Unable to find %s.\n", path);
+        return 0;
+    }
+    if(S_ISREG(status.st_mode))
+    {
+        return add_archive_file(list, path, &status);
+    }
+    if(S_ISDIR(status.st_mode))
+    {
+        return add_archive_directory(list, path);
+    }
+    fprintf(stderr, "Skipping %s, which is not a file or directory.\n", path);
+    return 1;
+}
+
+int archive_add_path(archive_list* list, const char* path)
+{
+    if(path[0] != '@')
+    {
+        return add_archive_path(list, path);
+    }
+
+    //A list of paths, one per line
+    FILE* file = strcmp(path, "@-") == 0 ? stdin : fopen(path + 1, "r");
+    if(file == NULL)
+    {
+        fprintf(stderr, "ERROR --> Unable to open %s.\n", path + 1);
+        return 0;
+    }
+    char* line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    int ok = 1;
+    while(ok && (length = getline(&line, &capacity, file)) > 0)
+    {
+        if(line[length - 1] == '\n')
+        {
+            line[--length] = '\0';
+        }
+        if(length > 0)
+        {
+            ok = add_archive_path(list, line);
+        }
+    }
+    free(line);
+    if(file != stdin)
+    {
+        fclose(file);
+    }
+    return ok;
+}
+
+void free_archive_list(archive_list* list)
+{
+    for(size_t i = 0; i < list->count; i++)
+    {
+        free(list->entries[i].source);
+    }
+    free(list->entries);
+    memset(list, 0, sizeof(archive_list));
+}
+
+/*
+Reads bytes [start, start + size) of the files' contents, one after another, into dst. Returns 0 if a file cannot
+be read or has got shorter since it was listed.
+*/
+static int read_archive_block(const archive_list* list, uint64_t start, size_t size, unsigned char* dst)
+{
+    //First file that ends after start
+    size_t low = 0;
+    size_t high = list->count;
+    while(low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        if(list->entries[middle].offset + list->entries[middle].size <= start)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    size_t done = 0;
+    for(size_t i = low; done < size && i < list->count; i++)
+    {
+        const archive_entry* entry = &list->entries[i];
+        uint64_t skip = start + done - entry->offset;
+        size_t piece = entry->size - skip < size - done ? (size_t)(entry->size - skip) : size - done;
+        if(piece == 0)
+        {
+            continue;
+        }
+        int fd = open(entry->source, O_RDONLY);
+        int ok = fd >= 0 && lseek(fd, (off_t)skip, SEEK_SET) == (off_t)skip && read_full(fd, dst + done, piece) == (ssize_t)piece;
+        if(fd >= 0)
+        {
+            close(fd);
+        }
+        if(!ok)
+        {
+            fprintf(stderr, "ERROR --> Unable to read %s, or it got shorter.\n", entry->source);
+            return 0;
+        }
+        done += piece;
+    }
+    return done == size;
+}
+
+//A batch of archive blocks, each read from the files it covers and then compressed by the same task
+typedef struct archive_batch
+{
+    const archive_list* list;             ///< Files being stored
+    compress_job* jobs;                   ///< One job per block of the batch
+    unsigned char** buffers;              ///< Where each job's block is read to
+    int* read;                            ///< Set for each job whose block was read
+    uint64_t start;                       ///< Offset of the batch's first block in the files' contents
+    size_t blockSize;                     ///< Bytes of input per block
+} archive_batch;
+
+static void archive_task(void* context, size_t index)
+{
+    archive_batch* batch = context;
+    batch->read[index] = read_archive_block(batch->list, batch->start + index * batch->blockSize, batch->jobs[index].srcSize, batch->buffers[index]);
+    if(batch->read[index])
+    {
+        compress_task(batch->jobs, index);
+    }
+}
+
+int compress_archive(const archive_list* list, output_sink* output, const compress_options* options)
+{
+    uint64_t startNanos = options->stats != NULL ? monotonic_nanos() : 0;
+    uint64_t startWritten = output->written;
+    size_t blockSize = options->blockSize;
+    size_t blockCount = (size_t)((list->totalSize + blockSize - 1) / blockSize);
+    size_t batchSize = (size_t)options->threads * ARCHIVE_BATCH_PER_THREAD;
+    if(batchSize > blockCount)
+    {
+        batchSize = blockCount > 0 ? blockCount : 1;
+    }
+
+    //A global table would need every file read twice, so each block gets its own
+    compress_options blockOptions = *options;
+    blockOptions.globalTable = 0;
+    blockOptions.globalLengths = NULL;
+
+    size_t written = 0;
+    size_t offsetsCapacity = blockCount + 1;
+    thread_pool* pool = create_pool(options->threads);
+    compress_job* jobs = calloc(batchSize, sizeof(compress_job));
+    unsigned char** buffers = calloc(batchSize, sizeof(unsigned char*));
+    int* read = calloc(batchSize, sizeof(int));
+    unsigned char* offsets = malloc(offsetsCapacity * 8);
+    unsigned char* table = NULL;
+    int ok = pool != NULL && jobs != NULL && buffers != NULL && read != NULL && offsets != NULL && list->count <= UINT32_MAX;
+    for(size_t i = 0; ok && i < batchSize; i++)
+    {
+        jobs[i].dst = malloc(block_bound(blockSize));
+        jobs[i].arena = create_arena(ALPHABET_SIZE);
+        buffers[i] = malloc(blockSize);
+        ok = jobs[i].dst != NULL && jobs[i].arena != NULL && buffers[i] != NULL;
+    }
+
+    write_file_header(output, list->totalSize, HUF_FLAG_ARCHIVE);
+    uint64_t position = HUF_HEADER_SIZE;
+    archive_batch batch = { list, jobs, buffers, read, 0, blockSize };
+    for(size_t first = 0; ok && first < blockCount; first += batchSize)
+    {
+        size_t count = blockCount - first < batchSize ? blockCount - first : batchSize;
+        batch.start = (uint64_t)first * blockSize;
+        for(size_t i = 0; i < count; i++)
+        {
+            uint64_t start = batch.start + i * blockSize;
+            jobs[i].src = buffers[i];
+            jobs[i].options = &blockOptions;
+            jobs[i].srcSize = list->totalSize - start < blockSize ? (size_t)(list->totalSize - start) : blockSize;
+        }
+
+        //A block made of many small files costs more to read than one cut from a big file, and text costs more to
+        //code than raw data, so a thread that runs out takes over half of the blocks another has left
+        pool_run_stealing(pool, archive_task, &batch, count);
+
+        for(size_t i = 0; ok && i < count; i++)
+        {
+            ok = read[i] && write_indexed_job(output, &jobs[i], &position, &offsets, &offsetsCapacity, &written);
+            if(ok && options->stats != NULL)
+            {
+                record_block(options->stats, batch.start + i * blockSize, jobs[i].srcSize, jobs[i].dstSize, jobs[i].nanos, jobs[i].thread);
+            }
+        }
+    }
+
+    //File table: number of files, then the name, size and permission bits of each
+    size_t tableSize = 4;
+    for(size_t i = 0; i < list->count; i++)
+    {
+        tableSize += 3 * VARINT_MAX_SIZE + strlen(list->entries[i].name);
+    }
+    table = ok ? malloc(tableSize) : NULL;
+    ok = ok && table != NULL;
+    if(ok)
+    {
+        store_u32_le(table, (uint32_t)list->count);
+        tableSize = 4;
+        for(size_t i = 0; i < list->count; i++)
+        {
+            size_t nameLength = strlen(list->entries[i].name);
+            tableSize += store_varint(table + tableSize, nameLength);
+            memcpy(table + tableSize, list->entries[i].name, nameLength);
+            tableSize += nameLength;
+            tableSize += store_varint(table + tableSize, list->entries[i].size);
+            tableSize += store_varint(table + tableSize, list->entries[i].mode);
+        }
+        write_file_end(output, position, offsets, written, table, tableSize);
+    }
+    if(options->stats != NULL)
+    {
+        options->stats->originalBytes = list->totalSize;
+        options->stats->encodedBytes = output->written - startWritten;
+        options->stats->wallNanos = monotonic_nanos() - startNanos;
+    }
+
+    for(size_t i = 0; jobs != NULL && i < batchSize; i++)
+    {
+        free(jobs[i].dst);
+        if(jobs[i].arena != NULL)
+        {
+            free_arena(jobs[i].arena);
+        }
+        free(buffers != NULL ? buffers[i] : NULL);
+    }
+    free(jobs);
+    free(buffers);
+    free(read);
+    free(offsets);
+    free(table);
+    if(pool != NULL)
+    {
+        destroy_pool(pool);
+    }
+    return ok;
+}
+
+/*
+Reads the file table entry at *table and moves past it. Returns 0 if the entry is cut short, or its name could
+create something outside the directory the archive is extracted into.
+*/
+static int next_archive_entry(const unsigned char** table, size_t* left, const char** name, size_t* nameLength, uint64_t* size, uint32_t* mode)
+{
+    uint64_t length;
+    uint64_t permissions;
+    size_t used = load_varint(*table, *left, &length);
+    if(used == 0 || length > *left - used)
+    {
+        return 0;
+    }
+    *name = (const char*)*table + used;
+    *nameLength = (size_t)length;
+    used += (size_t)length;
+    size_t sizeBytes = load_varint(*table + used, *left - used, size);
+    used += sizeBytes;
+    size_t modeBytes = sizeBytes != 0 ? load_varint(*table + used, *left - used, &permissions) : 0;
+    if(modeBytes == 0 || permissions > 0777 || !safe_archive_name(*name, *nameLength))
+    {
+        return 0;
+    }
+    used += modeBytes;
+    *mode = (uint32_t)permissions;
+    *table += used;
+    *left -= used;
+    return 1;
+}
+
+//Where extract_archive is in the file table while it writes out the decoded bytes
+typedef struct archive_writer
+{
+    const unsigned char* table;           ///< Next entry of the file table
+    size_t tableLeft;                     ///< Bytes of the table from there on
+    size_t filesLeft;                     ///< Entries not created yet
+    int fd;                               ///< File being written, -1 between files
+    uint64_t remaining;                   ///< Bytes still to write to it
+} archive_writer;
+
+/*
+Creates the file of the next table entry, and the directories above it. Returns 0 if it cannot be created.
+*/
+static int open_archive_file(archive_writer* writer)
+{
+    const char* name;
+    size_t nameLength;
+    uint64_t size;
+    uint32_t mode;
+    if(!next_archive_entry(&writer->table, &writer->tableLeft, &name, &nameLength, &size, &mode))
+    {
+        return 0;
+    }
+    char path[ARCHIVE_MAX_NAME + 1];
+    memcpy(path, name, nameLength);
+    path[nameLength] = '\0';
+    for(char* slash = strchr(path, '/'); slash != NULL; slash = strchr(slash + 1, '/'))
+    {
+        *slash = '\0';
+        int made = mkdir(path, 0777) == 0 || errno == EEXIST;
+        *slash = '/';
+        if(!made)
+        {
+            fprintf(stderr, "ERROR --> Unable to create the directories of %s.\n", path);
+            return 0;
+        }
+    }
+
+    //Never through a symbolic link that was already there
+    writer->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0600);
+    if(writer->fd < 0 || fchmod(writer->fd, mode) != 0)
+    {
+        fprintf(stderr, "ERROR --> Unable to create %s.\n", path);
+        return 0;
+    }
+    writer->remaining = size;
+    writer->filesLeft--;
+    return 1;
+}
+
+/*
+Writes decoded bytes to the files they belong to, creating each file in turn (empty ones included) and closing it
+once it is whole. Returns 0 if a file cannot be written, or there are more bytes than files.
+*/
+static int write_archive_bytes(archive_writer* writer, const unsigned char* data, size_t size)
+{
+    for(;;)
+    {
+        while(writer->fd >= 0 ? writer->remaining == 0 : writer->filesLeft > 0)
+        {
+            if(writer->fd < 0)
+            {
+                if(!open_archive_file(writer))
+                {
+                    return 0;
+                }
+                continue;
+            }
+            int closed = close(writer->fd) == 0;
+            writer->fd = -1;
+            if(!closed)
+            {
+                return 0;
+            }
+        }
+        if(size == 0)
+        {
+            return 1;
+        }
+        if(writer->fd < 0)
+        {
+            return 0;
+        }
+        size_t piece = writer->remaining < size ? (size_t)writer->remaining : size;
+        if(!write_all(writer->fd, data, piece))
+        {
+            return 0;
+        }
+        data += piece;
+        size -= piece;
+        writer->remaining -= piece;
+    }
+}
+
+int extract_archive(const unsigned char* src, size_t srcSize, int threads, run_stats* stats)
+{
+    uint64_t startNanos = stats != NULL ? monotonic_nanos() : 0;
+
+    //Header, footer and index are checked as decompress_file does. An archive always has its index.
+    if(srcSize < HUF_HEADER_SIZE + BLOCK_HEADER_SIZE + 4 + HUF_FOOTER_SIZE)
+    {
+        return 0;
+    }
+    if(memcmp(src, HUF_MAGIC, HUF_MAGIC_LEN) != 0 || src[4] != HUF_FORMAT_VERSION || src[5] != HUF_FLAG_ARCHIVE)
+    {
+        return 0;
+    }
+    const unsigned char* footer = src + srcSize - HUF_FOOTER_SIZE;
+    uint64_t originalSize = load_u64_le(src + 6);
+    uint64_t indexOffset = load_u64_le(footer);
+    size_t blockCount = load_u32_le(footer + 8);
+    if(memcmp(footer + 12, HUF_FOOTER_MAGIC, 4) != 0 || indexOffset < HUF_HEADER_SIZE + BLOCK_HEADER_SIZE + 4
+        || indexOffset > srcSize - HUF_FOOTER_SIZE || (srcSize - HUF_FOOTER_SIZE - indexOffset) / 8 != blockCount
+        || (srcSize - HUF_FOOTER_SIZE - indexOffset) % 8 != 0)
+    {
+        return 0;
+    }
+
+    //compress_archive writes the blocks back to back, so they are checked against the index one after another,
+    //which also finds the end of blocks marker and the file table after it
+    decompress_job* jobs = malloc((blockCount > 0 ? blockCount : 1) * sizeof(decompress_job));
+    if(jobs == NULL)
+    {
+        return 0;
+    }
+    uint64_t offset = HUF_HEADER_SIZE;
+    uint64_t rawOffset = 0;
+    int ok = 1;
+    for(size_t i = 0; ok && i < blockCount; i++)
+    {
+        ok = load_u64_le(src + indexOffset + i * 8) == offset && indexOffset - offset >= BLOCK_HEADER_SIZE;
+        uint32_t rawSize = ok ? load_u32_le(src + offset) : 0;
+        uint32_t payloadSize = ok ? load_u32_le(src + offset + 4) : 0;
+        unsigned char type = ok ? src[offset + 8] : 0;
+        ok = ok && rawSize != 0 && rawSize <= MAX_BLOCK_SIZE && payloadSize <= indexOffset - offset - BLOCK_HEADER_SIZE
+            && rawSize <= originalSize - rawOffset && (type & BLOCK_TYPE_MASK) <= BLOCK_ORDER1;
+        jobs[i].payload = src + offset + BLOCK_HEADER_SIZE;
+        jobs[i].payloadSize = payloadSize;
+        jobs[i].dstSize = rawSize;
+        jobs[i].type = type;
+        jobs[i].globalLengths = NULL;
+        jobs[i].stats = stats;
+        rawOffset += rawSize;
+        offset += BLOCK_HEADER_SIZE + payloadSize;
+    }
+    static const unsigned char endMarker[BLOCK_HEADER_SIZE] = { 0 };
+    ok = ok && rawOffset == originalSize && indexOffset - offset >= BLOCK_HEADER_SIZE + 4
+        && memcmp(src + offset, endMarker, BLOCK_HEADER_SIZE) == 0;
 
-        combined_node = node_combine(smallest->ptr, second_smallest->ptr); //create an interior node with combined frequencies
+    //Every entry of the file table must be valid, and the files must add up to the blocks
+    archive_writer writer;
+    writer.table = ok ? src + offset + BLOCK_HEADER_SIZE + 4 : NULL;
+    writer.tableLeft = ok ? (size_t)(indexOffset - offset - BLOCK_HEADER_SIZE - 4) : 0;
+    writer.filesLeft = ok ? load_u32_le(src + offset + BLOCK_HEADER_SIZE) : 0;
+    writer.fd = -1;
+    writer.remaining = 0;
+    const unsigned char* entry = writer.table;
+    size_t left = writer.tableLeft;
+    uint64_t filesSize = 0;
+    for(size_t i = 0; ok && i < writer.filesLeft; i++)
+    {
+        const char* name;
+        size_t nameLength;
+        uint64_t size;
+        uint32_t mode;
+        ok = next_archive_entry(&entry, &left, &name, &nameLength, &size, &mode) && size <= originalSize - filesSize;
+        filesSize += ok ? size : 0;
+    }
+    ok = ok && left == 0 && filesSize == originalSize;
+
+    //Decode a batch of blocks in parallel, write its bytes out to the files, repeat
+    size_t batchSize = (size_t)threads * ARCHIVE_BATCH_PER_THREAD;
+    thread_pool* pool = ok ? create_pool(threads) : NULL;
+    unsigned char* buffer = NULL;
+    size_t bufferSize = 0;
+    uint64_t extracted = 0;
+    ok = ok && pool != NULL;
+    for(size_t first = 0; ok && first < blockCount; first += batchSize)
+    {
+        size_t count = blockCount - first < batchSize ? blockCount - first : batchSize;
+        size_t batchRaw = 0;
+        for(size_t i = first; i < first + count; i++)
+        {
+            batchRaw += jobs[i].dstSize;
+        }
+        if(batchRaw > bufferSize)
+        {
+            free(buffer);
+            buffer = malloc(batchRaw);
+            bufferSize = buffer != NULL ? batchRaw : 0;
+            if(buffer == NULL)
+            {
+                ok = 0;
+                break;
+            }
+        }
+        unsigned char* dst = buffer;
+        for(size_t i = first; i < first + count; i++)
+        {
+            jobs[i].dst = dst;
+            dst += jobs[i].dstSize;
+        }
 
-        new_pq_node = newPQNode();
-        new_pq_node->next = NULL;
-        new_pq_node->ptr = combined_node;
+        pool_run_stealing(pool, decompress_task, jobs + first, count);
+        for(size_t i = first; i < first + count; i++)
+        {
+            ok = ok && jobs[i].ok;
+            if(ok && stats != NULL)
+            {
+                record_block(stats, extracted + (uint64_t)(jobs[i].dst - buffer), jobs[i].dstSize, BLOCK_HEADER_SIZE + jobs[i].payloadSize, jobs[i].nanos, jobs[i].thread);
+            }
+        }
+        ok = ok && write_archive_bytes(&writer, buffer, batchRaw);
+        extracted += batchRaw;
+    }
 
-        pq_insert(pq_main, new_pq_node); // put the new pq node pointing at the new interior node into the pq
+    //Empty files after the last byte
+    ok = ok && write_archive_bytes(&writer, NULL, 0);
+    if(writer.fd >= 0)
+    {
+        close(writer.fd);
+    }
+    if(ok && stats != NULL)
+    {
+        stats->originalBytes = originalSize;
+        stats->encodedBytes = srcSize;
+        stats->wallNanos = monotonic_nanos() - startNanos;
+    }
 
-        smallest = pq_main->head;
-        second_smallest = smallest->next;
+    free(buffer);
+    free(jobs);
+    if(pool != NULL)
+    {
+        destroy_pool(pool);
     }
-    
-    return smallest->ptr; // this is the root of the completed Huffman Tree
+    return ok;
 }
 
-//Shailendra
-table* create_table()
-{
-    //Allocate memory for table
-    table* valueTable = (table*) malloc(sizeof(table));
+//Daemon------------------------------------------------------------------------------------------------------------------
 
-    //Initialize values
-    valueTable->count = 0;
-    valueTable->head = 0;
+int init_table_cache(table_cache* cache)
+{
+    memset(cache, 0, sizeof(table_cache));
+    cache->entries = calloc(TABLE_CACHE_SIZE, sizeof(cached_table));
+    if(cache->entries == NULL)
+    {
+        return 0;
+    }
+    pthread_mutex_init(&cache->lock, NULL);
+    return 1;
+}
 
-    //Return table pointer
-    return valueTable;
+void free_table_cache(table_cache* cache)
+{
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->entries);
+    cache->entries = NULL;
 }
 
-//Shailendra
-table_node* create_table_node(char value, int freq)
+/*
+64 bit FNV-1a hash of the ideal code length of every character of a histogram (log2 of the total over its count,
+rounded down, plus 1; 0 for characters that do not appear). Histograms of the same shape get the same fingerprint.
+*/
+static uint64_t histogram_fingerprint(const uint64_t counts[])
 {
-    //Allocate memory for a table node
-    table_node* newNode = (table_node*) malloc(sizeof(table_node));
+    uint64_t total = 0;
+    for(int c = 0; c < ALPHABET_SIZE; c++)
+    {
+        total += counts[c];
+    }
+    int totalLog = total > 0 ? 63 - __builtin_clzll(total) : 0;
+    uint64_t hash = 14695981039346656037ull;
+    for(int c = 0; c < ALPHABET_SIZE; c++)
+    {
+        unsigned char ideal = counts[c] != 0 ? (unsigned char)(1 + totalLog - (63 - __builtin_clzll(counts[c]))) : 0;
+        hash = (hash ^ ideal) * 1099511628211ull;
+    }
+    return hash;
+}
 
-    //Initialize data
-    newNode->value = value;
-    newNode->frequency = freq;
-    newNode->binary[0] = '\0';
-    newNode->next = NULL;
+/*
+64 bit FNV-1a hash of a set of code lengths.
+*/
+static uint64_t lengths_fingerprint(const unsigned char lengths[])
+{
+    uint64_t hash = 14695981039346656037ull;
+    for(int c = 0; c < ALPHABET_SIZE; c++)
+    {
+        hash = (hash ^ lengths[c]) * 1099511628211ull;
+    }
+    return hash;
+}
 
-    //Return new pointer
-    return newNode;
+/*
+Estimated size in bits of a block coded with "lengths", code length table included, like estimate_block_bits. Returns
+-1 if a character of the block has no code.
+*/
+static double cached_block_bits(const uint64_t counts[], const unsigned char lengths[])
+{
+    uint64_t bits = 0;
+    int present = 0;
+    for(int c = 0; c < ALPHABET_SIZE; c++)
+    {
+        if(counts[c] != 0 && lengths[c] == 0)
+        {
+            return -1.0;
+        }
+        bits += counts[c] * lengths[c];
+        present += lengths[c] != 0;
+    }
+    return (double)bits + 8.0 * (BLOCK_HEADER_SIZE + ALPHABET_SIZE / 8 + (present + 1) / 2);
 }
 
-void encode(table* t, FILE* input, FILE* output){ // Made by Riley
-    char character;
-    table_node* current = t->head;    // Sets current to table head, used for traversal
-    while ((character = fgetc(input)) != EOF)    // While loop which traverses the input message character by character
+/*
+Finds the entry for "key" (and, for a decoder, "lengths"), or else the slot to replace: a free one or the least
+recently used. Called with the lock held. Sets *found if the entry was there.
+*/
+static cached_table* find_cached_table(table_cache* cache, uint64_t key, int decoder, const unsigned char lengths[], int* found)
+{
+    cached_table* oldest = &cache->entries[0];
+    for(int i = 0; i < TABLE_CACHE_SIZE; i++)
     {
-        while(current != NULL && current->value != character)    // While loop which traverses table until the character is found or current is NULL
-            current = current->next;
-        if(current != NULL){    // If current is not NULL we have the letter in the table and write the binary representation of it to the output file
-            fprintf(output, "%s", current->binary);
-            //printf("SUCCESS --> Printed '%c' to file!\n", character);
+        cached_table* entry = &cache->entries[i];
+        if(entry->lastUsed != 0 && entry->key == key && entry->decoder == decoder
+            && (!decoder || memcmp(entry->lengths, lengths, ALPHABET_SIZE) == 0))
+        {
+            *found = 1;
+            return entry;
         }
-        else{ // If current is NULL we have an error as the letter to encode is not the table, thus we print an error message
-            printf("\nERROR --> Unable to find letter in given table: '%c'. Exiting Program.\n", character);
-            exit(0);
+        if(entry->lastUsed < oldest->lastUsed)
+        {
+            oldest = entry;
         }
-        current = t->head;
     }
+    *found = 0;
+    return oldest;
 }
 
-//Riley
-void decode(tree_node* root, FILE* input, FILE* output){ 
-    char binary_char;
-    tree_node* current = root;    // Sets current to root, used for traversal
-
-    while((binary_char = fgetc(input)) != EOF){    // While loop which traverses each binary character in encoded message
-        switch(binary_char){    // Switch case for encoded message
-            case '1':    // If character is '1' current traverses right down the tree
-                current = current->right;
-                //printf("TRAVERSE RIGHT: %c\n", binary_char);
-                break;
-            case '0':    // If character is '0' current traverses left down the tree
-                current = current->left;
-                //printf("TRAVERSE LEFT: %c\n", binary_char);
-                break;
-            default:    // If character is neither '1' or '0' we print an error message
-                printf("ERROR --> '%c' is a non binary character. Exiting Program.\n", binary_char);
-                exit(0);
-                break;
-        }
-        if(current->left == NULL || current->right == NULL){    // After going down tree check if NULL is the new current's left or right child
-            fprintf(output, "%c", current->value);    // If left or right is NULL we have found a leaf which contains a letter thus we write it to the file
-            current = root;    // Return current to root to continue decoding process
+int cached_code_lengths(table_cache* cache, const uint64_t counts[], double bits, unsigned char lengths[])
+{
+    uint64_t key = histogram_fingerprint(counts);
+    int found;
+    pthread_mutex_lock(&cache->lock);
+    cached_table* entry = find_cached_table(cache, key, 0, NULL, &found);
+    if(found)
+    {
+        double cachedBits = cached_block_bits(counts, entry->lengths);
+        found = cachedBits >= 0.0 && cachedBits <= bits * entry->ratio * (1.0 + 1.0 / TABLE_CACHE_SLACK);
+    }
+    if(found)
+    {
+        memcpy(lengths, entry->lengths, ALPHABET_SIZE);
+        entry->lastUsed = ++cache->clock;
+    }
+    cache->hits[0] += (uint64_t)found;
+    cache->misses[0] += (uint64_t)!found;
+    pthread_mutex_unlock(&cache->lock);
+    return found;
+}
+
+void store_code_lengths(table_cache* cache, const uint64_t counts[], double bits, const unsigned char lengths[])
+{
+    uint64_t key = histogram_fingerprint(counts);
+    double ratio = cached_block_bits(counts, lengths) / bits;
+    int found;
+    pthread_mutex_lock(&cache->lock);
+    cached_table* entry = find_cached_table(cache, key, 0, NULL, &found);
+    entry->key = key;
+    entry->decoder = 0;
+    entry->ratio = ratio;
+    memcpy(entry->lengths, lengths, ALPHABET_SIZE);
+    entry->lastUsed = ++cache->clock;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+int cached_decode_table(table_cache* cache, const unsigned char lengths[], decode_table* dt)
+{
+    uint64_t key = lengths_fingerprint(lengths);
+    int found;
+    pthread_mutex_lock(&cache->lock);
+    cached_table* entry = find_cached_table(cache, key, 1, lengths, &found);
+    if(found)
+    {
+        memcpy(dt, &entry->decodeTable, sizeof(decode_table));
+        entry->lastUsed = ++cache->clock;
+    }
+    cache->hits[1] += (uint64_t)found;
+    cache->misses[1] += (uint64_t)!found;
+    pthread_mutex_unlock(&cache->lock);
+    if(found)
+    {
+        return 1;
+    }
+
+    //Built outside the lock, so other threads are not held up, then stored unless another thread got there first
+    if(!build_decode_table(lengths, dt))
+    {
+        return 0;
+    }
+    pthread_mutex_lock(&cache->lock);
+    entry = find_cached_table(cache, key, 1, lengths, &found);
+    if(!found)
+    {
+        entry->key = key;
+        entry->decoder = 1;
+        memcpy(entry->lengths, lengths, ALPHABET_SIZE);
+        memcpy(&entry->decodeTable, dt, sizeof(decode_table));
+    }
+    entry->lastUsed = ++cache->clock;
+    pthread_mutex_unlock(&cache->lock);
+    return 1;
+}
+
+//State shared by the daemon's connection threads
+typedef struct huffman_daemon
+{
+    compress_options options;             ///< Options every context compresses with
+    table_cache cache;                    ///< Code and decode tables shared by every connection
+    pthread_mutex_t lock;                 ///< Guards everything below
+    pthread_cond_t changed;               ///< Signalled when a connection ends
+    huffman_context* idle[DAEMON_MAX_CLIENTS]; ///< Warm contexts left by connections that have ended
+    int idleCount;                        ///< Number of contexts in idle
+    int clients;                          ///< Connections being served
+    uint64_t requests;                    ///< Requests answered
+} huffman_daemon;
+
+//One client of the daemon
+typedef struct daemon_connection
+{
+    huffman_daemon* daemon;               ///< Daemon that accepted it
+    int fd;                               ///< Connected socket
+} daemon_connection;
+
+/*
+Grows a buffer to at least "size" bytes (and at least 1). Returns it, or NULL if memory ran out.
+*/
+static unsigned char* grow_buffer(unsigned char** buffer, size_t* capacity, size_t size)
+{
+    if(size > *capacity || *buffer == NULL)
+    {
+        unsigned char* grown = realloc(*buffer, size > 0 ? size : 1);
+        if(grown == NULL)
+        {
+            return NULL;
         }
+        *buffer = grown;
+        *capacity = size > 0 ? size : 1;
     }
+    return *buffer;
 }
 
-//Shailendra
-void insert_binary_values_into_table(tree_node* huffman_root, table* t, char* binaryString)
+/*
+Writes a reply: status (0 for success), payload size, payload. Returns 0 if the client has gone.
+*/
+static int send_reply(int fd, int status, const unsigned char* payload, size_t size)
 {
-    //Check if node is a leaf
-    if(huffman_root->left == NULL && huffman_root->right == NULL)
+    unsigned char header[DAEMON_HEADER_SIZE];
+    header[0] = (unsigned char)status;
+    store_u64_le(header + 1, size);
+    return write_all(fd, header, DAEMON_HEADER_SIZE) && write_all(fd, payload, size);
+}
+
+/*
+Answers one connection's requests until the client closes it. Each request is an operation byte ('c', 'd' or 's'),
+an 8 byte payload size and the payload; each reply is a status byte, an 8 byte size and the result.
+*/
+static void* daemon_client(void* argument)
+{
+    daemon_connection* connection = argument;
+    huffman_daemon* daemon = connection->daemon;
+
+    //A context a connection before left behind, with its arena, decode table and scratch already allocated
+    pthread_mutex_lock(&daemon->lock);
+    huffman_context* ctx = daemon->idleCount > 0 ? daemon->idle[--daemon->idleCount] : NULL;
+    pthread_mutex_unlock(&daemon->lock);
+    if(ctx == NULL && (ctx = huffman_create_context()) != NULL)
     {
-        //Create pointer at head of table
-        table_node* current = t->head;
+        ctx->options = daemon->options;
+    }
 
-        //Cycle through table searching for matching character with one in tree node
-        while(current != NULL)
+    unsigned char* request = NULL;
+    unsigned char* reply = NULL;
+    size_t requestCapacity = 0;
+    size_t replyCapacity = 0;
+    for(;;)
+    {
+        unsigned char header[DAEMON_HEADER_SIZE];
+        if(ctx == NULL || read_full(connection->fd, header, DAEMON_HEADER_SIZE) != DAEMON_HEADER_SIZE)
         {
-            if(huffman_root->value == current->value)
-            {
-                strcpy(current->binary, binaryString);
-                current = NULL;
-            }
+            break;
+        }
+        uint64_t size = load_u64_le(header + 1);
+        if(size > DAEMON_MAX_PAYLOAD || grow_buffer(&request, &requestCapacity, (size_t)size) == NULL)
+        {
+            send_reply(connection->fd, 1, NULL, 0);
+            break;
+        }
+        if(read_full(connection->fd, request, (size_t)size) != (ssize_t)size)
+        {
+            break;
+        }
 
-            else
+        size_t replySize = HUFFMAN_ERROR;
+        if(header[0] == 'c' && grow_buffer(&reply, &replyCapacity, huffman_compress_bound((size_t)size)) != NULL)
+        {
+            replySize = huffman_compress(ctx, request, (size_t)size, reply, replyCapacity);
+        }
+        else if(header[0] == 'd')
+        {
+            size_t rawSize = huffman_decompressed_size(request, (size_t)size);
+            if(rawSize != HUFFMAN_ERROR && rawSize <= DAEMON_MAX_PAYLOAD && grow_buffer(&reply, &replyCapacity, rawSize) != NULL)
             {
-                current = current->next;
+                replySize = huffman_decompress(ctx, request, (size_t)size, reply, rawSize);
             }
-            
+        }
+        else if(header[0] == 's' && grow_buffer(&reply, &replyCapacity, 256) != NULL)
+        {
+            pthread_mutex_lock(&daemon->cache.lock);
+            pthread_mutex_lock(&daemon->lock);
+            replySize = (size_t)snprintf((char*)reply, 256, "requests %llu, clients %d, code tables %llu hits %llu misses, decode tables %llu hits %llu misses\n",
+                (unsigned long long)daemon->requests, daemon->clients, (unsigned long long)daemon->cache.hits[0], (unsigned long long)daemon->cache.misses[0],
+                (unsigned long long)daemon->cache.hits[1], (unsigned long long)daemon->cache.misses[1]);
+            pthread_mutex_unlock(&daemon->lock);
+            pthread_mutex_unlock(&daemon->cache.lock);
+        }
+
+        int sent = replySize != HUFFMAN_ERROR ? send_reply(connection->fd, 0, reply, replySize) : send_reply(connection->fd, 1, NULL, 0);
+        pthread_mutex_lock(&daemon->lock);
+        daemon->requests++;
+        pthread_mutex_unlock(&daemon->lock);
+        if(!sent)
+        {
+            break;
         }
     }
+    free(request);
+    free(reply);
+    close(connection->fd);
 
-    //If node is not a leaf
-    else
+    //The context stays warm for the next connection
+    pthread_mutex_lock(&daemon->lock);
+    if(ctx != NULL && daemon->idleCount < DAEMON_MAX_CLIENTS)
     {
-        //Declare Temporary String for traversal
-        char copyBinary[10];
-        copyBinary[0] = '\0';
-        
-        //Traverse left subtree
-        strcpy(copyBinary, binaryString);
-        strcat(copyBinary, "0");
-        insert_binary_values_into_table(huffman_root->left, t, copyBinary);
+        daemon->idle[daemon->idleCount++] = ctx;
+        ctx = NULL;
+    }
+    daemon->clients--;
+    pthread_cond_signal(&daemon->changed);
+    pthread_mutex_unlock(&daemon->lock);
+    huffman_free_context(ctx);
+    free(connection);
+    return NULL;
+}
 
-        //Traverse right subtree
-        strcpy(copyBinary, binaryString);
-        strcat(copyBinary, "1");
-        insert_binary_values_into_table(huffman_root->right, t, copyBinary);
+/*
+Fills in the address of a Unix domain socket. Returns 0 if the path is too long.
+*/
+static int socket_address(const char* socketPath, struct sockaddr_un* address)
+{
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+    if(strlen(socketPath) >= sizeof(address->sun_path))
+    {
+        return 0;
     }
-    
+    strcpy(address->sun_path, socketPath);
+    return 1;
 }
 
-//Adam
-pq_node* newPQNode() { //creates a new priority queue node
+int run_daemon(const char* socketPath, const compress_options* options)
+{
+    //A client that goes away mid-reply must not kill the daemon
+    signal(SIGPIPE, SIG_IGN);
+
+    struct sockaddr_un address;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || !socket_address(socketPath, &address))
+    {
+        fprintf(stderr, "ERROR --> Unable to create a socket at %s.\n", socketPath);
+        if(fd >= 0)
+        {
+            close(fd);
+        }
+        return 0;
+    }
+
+    //A socket nobody answers on was left by a daemon that was killed, so it is replaced. Anything else is not.
+    struct stat status;
+    if(lstat(socketPath, &status) == 0 && S_ISSOCK(status.st_mode))
+    {
+        if(connect(fd, (struct sockaddr*)&address, sizeof(address)) == 0)
+        {
+            fprintf(stderr, "ERROR --> A daemon is already listening on %s.\n", socketPath);
+            close(fd);
+            return 0;
+        }
+        unlink(socketPath);
+    }
+    //Only the daemon's user may connect, so the socket is created without permissions for anyone else
+    mode_t oldMask = umask(077);
+    int bound = bind(fd, (struct sockaddr*)&address, sizeof(address)) == 0;
+    umask(oldMask);
+    if(!bound || listen(fd, SOMAXCONN) != 0)
+    {
+        fprintf(stderr, "ERROR --> Unable to listen on %s.\n", socketPath);
+        close(fd);
+        return 0;
+    }
+
+    //Every connection codes on one thread of its own, so the contexts are single threaded
+    huffman_daemon* daemon = calloc(1, sizeof(huffman_daemon));
+    if(daemon == NULL || !init_table_cache(&daemon->cache))
+    {
+        fprintf(stderr, "ERROR --> Not enough memory.\n");
+        free(daemon);
+        close(fd);
+        return 0;
+    }
+    daemon->options = *options;
+    daemon->options.threads = 1;
+    daemon->options.globalTable = 0;
+    daemon->options.globalLengths = NULL;
+    daemon->options.cache = &daemon->cache;
+    daemon->options.stats = NULL;
+    pthread_mutex_init(&daemon->lock, NULL);
+    pthread_cond_init(&daemon->changed, NULL);
+
+    pthread_attr_t detached;
+    pthread_attr_init(&detached);
+    pthread_attr_setdetachstate(&detached, PTHREAD_CREATE_DETACHED);
+    for(;;)
+    {
+        pthread_mutex_lock(&daemon->lock);
+        while(daemon->clients >= DAEMON_MAX_CLIENTS)
+        {
+            pthread_cond_wait(&daemon->changed, &daemon->lock);
+        }
+        pthread_mutex_unlock(&daemon->lock);
+
+        int client = accept(fd, NULL, NULL);
+        if(client < 0)
+        {
+            if(errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            if(errno == EMFILE || errno == ENFILE)
+            {
+                //Out of file descriptors: wait until a client leaves and closes its own, or a while for other
+                //processes to close theirs, instead of retrying at once
+                struct timespec until;
+                clock_gettime(CLOCK_REALTIME, &until);
+                until.tv_nsec += DAEMON_RETRY_MILLISECONDS * 1000000L;
+                until.tv_sec += until.tv_nsec / 1000000000L;
+                until.tv_nsec %= 1000000000L;
+                pthread_mutex_lock(&daemon->lock);
+                pthread_cond_timedwait(&daemon->changed, &daemon->lock, &until);
+                pthread_mutex_unlock(&daemon->lock);
+                continue;
+            }
+            break;
+        }
+        daemon_connection* connection = malloc(sizeof(daemon_connection));
+        pthread_t thread;
+        pthread_mutex_lock(&daemon->lock);
+        daemon->clients++;
+        pthread_mutex_unlock(&daemon->lock);
+        if(connection != NULL)
+        {
+            connection->daemon = daemon;
+            connection->fd = client;
+        }
+        if(connection == NULL || pthread_create(&thread, &detached, daemon_client, connection) != 0)
+        {
+            free(connection);
+            close(client);
+            pthread_mutex_lock(&daemon->lock);
+            daemon->clients--;
+            pthread_mutex_unlock(&daemon->lock);
+        }
+    }
 
-    pq_node* node = malloc(sizeof(pq_node));
-    node->next = NULL;
-    node->ptr = NULL;
-    return node;
+    //Connections still being served keep the daemon's state, so it is left to the process exit
+    fprintf(stderr, "ERROR --> Unable to accept connections on %s.\n", socketPath);
+    pthread_attr_destroy(&detached);
+    close(fd);
+    return 0;
 }
 
-//Tatiana
-table* convert_to_table(FILE *input) { //needs two * instead of one because
-    //table *t = (table*) malloc(sizeof(table)); //create a table
-    table *t = create_table();
+int daemon_request(const char* socketPath, int operation, const char* inputPath)
+{
+    signal(SIGPIPE, SIG_IGN);
 
-    //assuming input.txt is already opened
-    char ch;
+    input_span input;
+    memset(&input, 0, sizeof(input));
+    if(operation != 's' && !open_input(inputPath != NULL ? inputPath : "/dev/stdin", &input))
+    {
+        fprintf(stderr, "NO FILE FOUND\n");
+        return 0;
+    }
 
-    while ((ch = fgetc(input)) != EOF) { //read each character
-        table_node *node = search_for_table_node(ch, t);
-        if (node == NULL) { //character not in table
-            node = (table_node*) malloc(sizeof(table_node)); //create a node
-            node->value = ch;
-            //node->binary = NULL;
-            node->frequency = 1;
-            node->next = t->head; //node's next is current table's head
+    struct sockaddr_un address;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    int ok = fd >= 0 && socket_address(socketPath, &address) && connect(fd, (struct sockaddr*)&address, sizeof(address)) == 0;
+    if(!ok)
+    {
+        fprintf(stderr, "ERROR --> No daemon is listening on %s.\n", socketPath);
+    }
 
-            t->head = node;     //set new head
-            t->count++;
+    unsigned char header[DAEMON_HEADER_SIZE];
+    header[0] = (unsigned char)operation;
+    store_u64_le(header + 1, input.size);
+    ok = ok && input.size <= DAEMON_MAX_PAYLOAD && write_all(fd, header, DAEMON_HEADER_SIZE) && write_all(fd, input.data, input.size);
 
-        } else { //character is already in the table
-            node->frequency += 1; //increase frequency
-        }
+    //The reply is copied to standard output as it arrives
+    ok = ok && read_full(fd, header, DAEMON_HEADER_SIZE) == DAEMON_HEADER_SIZE && header[0] == 0;
+    uint64_t left = ok ? load_u64_le(header + 1) : 0;
+    unsigned char chunk[1 << 16];
+    while(ok && left > 0)
+    {
+        size_t piece = left < sizeof(chunk) ? (size_t)left : sizeof(chunk);
+        ok = read_full(fd, chunk, piece) == (ssize_t)piece && write_all(STDOUT_FILENO, chunk, piece);
+        left -= piece;
     }
 
-    return t;
+    if(fd >= 0)
+    {
+        close(fd);
+    }
+    if(operation != 's')
+    {
+        close_input(&input);
+    }
+    return ok;
 }
 
-//Tatiana
-table_node* search_for_table_node(char character, table *t) {
-    table_node *current; //create a node
+//Statistics--------------------------------------------------------------------------------------------------------------
 
-    current = t->head; //assign node to current
-    while ((current != NULL) && (current->value != character)) {
-        current = current->next; //update current
+run_stats* create_run_stats(int decoding, int threads)
+{
+    run_stats* stats = calloc(1, sizeof(run_stats));
+    if(stats == NULL)
+    {
+        return NULL;
     }
+    stats->decoding = decoding;
+    stats->threadCount = threads;
+    return stats;
+}
 
-    return current;
+void free_run_stats(run_stats* stats)
+{
+    free(stats->records);
+    free(stats);
 }
 
-//Adam
-pq* new_pq (){ //creates a new priority queue
-    pq* pq1 = malloc(sizeof(pq));
-    pq1->head = NULL;
-    return pq1;
+static int compare_nanos(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
 }
 
-//Christine
-pq* table_to_queue(table* t) {
-  
-  pq *queue = new_pq();                     // Initalizes pq  
-  table_node *current_t = t->head;      // Sets current to the head of the table_node
+void report_stats(const run_stats* stats, int json, FILE* out)
+{
+    static const char* stageNames[STAGE_COUNT] = { "histogram", "tables", "encode", "decode" };
+    static const char* typeNames[BLOCK_TYPE_COUNT] = { "huffman", "raw", "rle", "order1", "global" };
+    static const char* codingNames[] = { "blocks", "words", "adaptive", "dictionary" };
 
-  // Goes through the length of the table (table_count)
-  for (int i = 0; i < t->count; i++) {
+    //The threads' counters, added together
+    thread_stats total;
+    memset(&total, 0, sizeof(total));
+    for(int t = 0; t < stats->threadCount; t++)
+    {
+        const thread_stats* own = &stats->threads[t];
+        for(int s = 0; s < STAGE_COUNT; s++)
+        {
+            total.stageNanos[s] += own->stageNanos[s];
+        }
+        for(int c = 0; c < ALPHABET_SIZE; c++)
+        {
+            total.counts[c] += own->counts[c];
+        }
+        for(int l = 0; l <= STATS_MAX_CODE_LEN; l++)
+        {
+            total.lengthSymbols[l] += own->lengthSymbols[l];
+        }
+        for(int b = 0; b < BLOCK_TYPE_COUNT; b++)
+        {
+            total.typeBlocks[b] += own->typeBlocks[b];
+            total.typeBytes[b] += own->typeBytes[b];
+        }
+        total.blockEntropyBits += own->blockEntropyBits;
+        total.maxLength = own->maxLength > total.maxLength ? own->maxLength : total.maxLength;
+    }
 
-    // Makes a new tree node, using the current table node's (current_t) value / freq
-    tree_node *tree = newNode(current_t->value, current_t->frequency, NULL, NULL);
-    // Increment current_t 
-    current_t = current_t->next;
-    // Makes a new priority queue node
-    pq_node *pqNode = newPQNode();
-    // Sets the pq node's tree as the tree node created above
-    pqNode->ptr = tree;
-    // Yeet it into the distance
-    pq_insert(queue, pqNode);
-  }
+    //Characters of huffman and global blocks with a code of at most DECODE_TABLE_BITS bits are decoded from one table
+    //lookup; longer ones go through the slow path. A dictionary frame is decoded the same way. Word and adaptive files
+    //have no such table, and code lengths of a word file count tokens rather than characters.
+    int blocks = stats->coding == CODING_BLOCKS;
+    int lookups = blocks || stats->coding == CODING_DICTIONARY;
+    int lengthLimit = lookups ? MAX_CODE_LEN : STATS_MAX_CODE_LEN;
+    const char* symbolName = stats->coding == CODING_WORDS ? "tokens" : "characters";
+    uint64_t characters = 0;
+    uint64_t coded = 0;
+    uint64_t codeBits = 0;
+    uint64_t slow = 0;
+    for(int c = 0; c < ALPHABET_SIZE; c++)
+    {
+        characters += total.counts[c];
+    }
+    for(int l = 1; l <= STATS_MAX_CODE_LEN; l++)
+    {
+        coded += total.lengthSymbols[l];
+        codeBits += (uint64_t)l * total.lengthSymbols[l];
+        slow += l > DECODE_TABLE_BITS ? total.lengthSymbols[l] : 0;
+    }
+    double perCharacter = characters > 0 ? 1.0 / (double)characters : 0.0;
+    double entropy = entropy_bits(total.counts) * perCharacter;
+    double blockEntropy = total.blockEntropyBits * perCharacter;
+    double achieved = stats->originalBytes > 0 ? 8.0 * (double)stats->encodedBytes / (double)stats->originalBytes : 0.0;
+    double averageLength = coded > 0 ? (double)codeBits / (double)coded : 0.0;
+    double hitRate = coded > 0 ? (double)(coded - slow) / (double)coded : 1.0;
+    double wall = (double)stats->wallNanos / 1e9;
+    double megabytes = (double)stats->originalBytes / 1e6;
 
-  return queue;
-}
\ No newline at end of file
+    //Blocks are timed as they are taken: when encoding, that is a block of input before -e splits it into the blocks
+    //that are written, so the two counts differ
+    uint64_t writtenBlocks = 0;
+    for(int b = 0; b < BLOCK_TYPE_COUNT; b++)
+    {
+        writtenBlocks += total.typeBlocks[b];
+    }
+    const char* timedBlocks = stats->decoding ? "blocks" : "input blocks";
+
+    //Block timings, sorted for the median and the 99th percentile
+    uint64_t* sorted = stats->recordCount > 0 ? malloc(stats->recordCount * sizeof(uint64_t)) : NULL;
+    size_t slowest = 0;
+    for(size_t i = 0; sorted != NULL && i < stats->recordCount; i++)
+    {
+        sorted[i] = stats->records[i].nanos;
+        slowest = stats->records[i].nanos > stats->records[slowest].nanos ? i : slowest;
+    }
+    if(sorted != NULL)
+    {
+        qsort(sorted, stats->recordCount, sizeof(uint64_t), compare_nanos);
+    }
+
+    if(json)
+    {
+        fprintf(out, "{\"phase\":\"%s\",\"coding\":\"%s\",\"wall_seconds\":%.6f,\"threads\":%d,\"original_bytes\":%llu,\"encoded_bytes\":%llu,",
+            stats->decoding ? "decode" : "encode", codingNames[stats->coding], wall, stats->threadCount,
+            (unsigned long long)stats->originalBytes, (unsigned long long)stats->encodedBytes);
+        fprintf(out, "\"entropy_bits_per_char\":%.6f,\"achieved_bits_per_char\":%.6f,\"block_entropy_bits_per_char\":", entropy, achieved);
+        fprintf(out, blocks ? "%.6f," : "null,", blockEntropy);
+        fprintf(out, "\"code_length\":{\"max\":%d,\"average\":%.6f,\"%s_by_length\":[", total.maxLength, averageLength,
+            stats->coding == CODING_WORDS ? "tokens" : "chars");
+        for(int l = 1; l <= lengthLimit; l++)
+        {
+            fprintf(out, "%s%llu", l > 1 ? "," : "", (unsigned long long)total.lengthSymbols[l]);
+        }
+        fprintf(out, "]},\"decode_table\":");
+        if(lookups)
+        {
+            fprintf(out, "{\"bits\":%d,\"fast_chars\":%llu,\"slow_chars\":%llu,\"hit_rate\":%.6f}", DECODE_TABLE_BITS,
+                (unsigned long long)(coded - slow), (unsigned long long)slow, hitRate);
+        }
+        else
+        {
+            fprintf(out, "null");
+        }
+        fprintf(out, ",\"block_types\":{");
+        for(int b = 0; b < BLOCK_TYPE_COUNT; b++)
+        {
+            fprintf(out, "%s\"%s\":{\"blocks\":%llu,\"bytes\":%llu}", b > 0 ? "," : "", typeNames[b],
+                (unsigned long long)total.typeBlocks[b], (unsigned long long)total.typeBytes[b]);
+        }
+        fprintf(out, "},\"stages\":{");
+        for(int s = 0, first = 1; s < STAGE_COUNT; s++)
+        {
+            if((s == STAGE_DECODE) != (stats->decoding != 0))
+            {
+                continue;
+            }
+            double seconds = (double)total.stageNanos[s] / 1e9;
+            fprintf(out, "%s\"%s\":{\"thread_seconds\":%.6f,\"mb_per_s\":%.3f}", first ? "" : ",", stageNames[s], seconds,
+                seconds > 0 ? megabytes / seconds : 0.0);
+            first = 0;
+        }
+        fprintf(out, "},\"thread_stats\":[");
+        for(int t = 0; blocks && t < stats->threadCount; t++)
+        {
+            fprintf(out, "%s{\"thread\":%d,\"blocks\":%llu,\"busy_seconds\":%.6f}", t > 0 ? "," : "", t,
+                (unsigned long long)stats->threads[t].jobs, (double)stats->threads[t].nanos / 1e9);
+        }
+        fprintf(out, "],\"written_blocks\":%llu,\"timed_blocks\":\"%s\",\"records_complete\":%s,\"blocks\":[",
+            (unsigned long long)writtenBlocks, stats->decoding ? "written" : "input", stats->failed ? "false" : "true");
+        for(size_t i = 0; i < stats->recordCount; i++)
+        {
+            const block_record* record = &stats->records[i];
+            fprintf(out, "%s{\"offset\":%llu,\"original\":%u,\"encoded\":%u,\"thread\":%d,\"seconds\":%.6f}", i > 0 ? "," : "",
+                (unsigned long long)record->offset, record->rawSize, record->encodedSize, record->thread, (double)record->nanos / 1e9);
+        }
+        fprintf(out, "]}\n");
+        free(sorted);
+        return;
+    }
+
+    fprintf(out, "statistics (%s%s%s): %.3f s, %d thread%s\n", stats->decoding ? "decode" : "encode", blocks ? "" : ", ",
+        blocks ? "" : codingNames[stats->coding], wall, stats->threadCount, stats->threadCount > 1 ? "s" : "");
+    fprintf(out, "  bytes         original %llu  encoded %llu  ratio %.3f  %.1f MB/s\n", (unsigned long long)stats->originalBytes,
+        (unsigned long long)stats->encodedBytes, stats->encodedBytes > 0 ? (double)stats->originalBytes / (double)stats->encodedBytes : 0.0,
+        wall > 0 ? megabytes / wall : 0.0);
+    if(blocks)
+    {
+        fprintf(out, "  bits/char     entropy %.3f  entropy of each block %.3f  achieved %.3f\n", entropy, blockEntropy, achieved);
+    }
+    else
+    {
+        fprintf(out, "  bits/char     entropy %.3f  achieved %.3f\n", entropy, achieved);
+    }
+    fprintf(out, "  code length   max %d  average %.3f  %s by length:", total.maxLength, averageLength, symbolName);
+    for(int l = 1; l <= lengthLimit; l++)
+    {
+        if(total.lengthSymbols[l] != 0)
+        {
+            fprintf(out, " %d:%.1f%%", l, 100.0 * (double)total.lengthSymbols[l] / (double)coded);
+        }
+    }
+    fprintf(out, "\n");
+    if(lookups)
+    {
+        fprintf(out, "  decode table  %.3f%% of characters in one lookup, %.3f%% on the slow path (codes over %d bits)\n",
+            100.0 * hitRate, 100.0 * (1.0 - hitRate), DECODE_TABLE_BITS);
+    }
+    if(blocks)
+    {
+        fprintf(out, "  block types   %llu written:", (unsigned long long)writtenBlocks);
+        for(int b = 0; b < BLOCK_TYPE_COUNT; b++)
+        {
+            fprintf(out, " %s %llu (%.1f MB)", typeNames[b], (unsigned long long)total.typeBlocks[b], (double)total.typeBytes[b] / 1e6);
+        }
+        fprintf(out, "\n");
+    }
+    fprintf(out, "  thread time  ");
+    for(int s = 0; s < STAGE_COUNT; s++)
+    {
+        //A file coded as one bitstream may not go through every stage: adaptive coding has no histogram or tables
+        if((s == STAGE_DECODE) == (stats->decoding != 0) && (blocks || s >= STAGE_ENCODE || total.stageNanos[s] != 0))
+        {
+            double seconds = (double)total.stageNanos[s] / 1e9;
+            fprintf(out, " %s %.3f s (%.1f MB/s)", stageNames[s], seconds, seconds > 0 ? megabytes / seconds : 0.0);
+        }
+    }
+    fprintf(out, "\n");
+    for(int t = 0; blocks && t < stats->threadCount; t++)
+    {
+        fprintf(out, "  thread %-6d %llu %s, busy %.3f s (%.1f%%)\n", t, (unsigned long long)stats->threads[t].jobs, timedBlocks,
+            (double)stats->threads[t].nanos / 1e9, wall > 0 ? 100.0 * (double)stats->threads[t].nanos / 1e9 / wall : 0.0);
+    }
+    if(sorted != NULL)
+    {
+        size_t count = stats->recordCount;
+        fprintf(out, "  block time    %zu %s  min %.3f ms  median %.3f ms  p99 %.3f ms  max %.3f ms (block at %llu)%s\n",
+            count, timedBlocks, (double)sorted[0] / 1e6, (double)sorted[count / 2] / 1e6, (double)sorted[count - 1 - count / 100] / 1e6,
+            (double)sorted[count - 1] / 1e6, (unsigned long long)stats->records[slowest].offset,
+            stats->failed ? " (not every block recorded)" : "");
+    }
+    free(sorted);
+}